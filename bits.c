@@ -0,0 +1,120 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdlib.h>
+
+#include "bits.h"
+
+void bits_init_writer(struct bit_writer * const writer) {
+	writer->data = NULL;
+	writer->capacity = 0;
+	writer->size = 0;
+	writer->failed = 0;
+}
+
+void bits_free_writer(struct bit_writer * const writer) {
+	free(writer->data);
+	bits_init_writer(writer);
+}
+
+void bits_write(
+		struct bit_writer * const writer,
+		unsigned int const value,
+		unsigned int const count) {
+
+	if (writer->failed) {
+		return;
+	}
+
+	// Grow by doubling, with room for a full 32-bit write
+	if (writer->size + count > 8 * writer->capacity) {
+		size_t capacity = writer->capacity ? 2 * writer->capacity : 256;
+		while (writer->size + count > 8 * capacity) {
+			capacity *= 2;
+		}
+		unsigned char * data = realloc(writer->data, capacity);
+		if (!data) {
+			writer->failed = 1;
+			return;
+		}
+		for (size_t i = writer->capacity; i < capacity; i++) {
+			data[i] = 0;
+		}
+		writer->data = data;
+		writer->capacity = capacity;
+	}
+
+	for (unsigned int i = count; i > 0; i--) {
+		if (value & (1U << (i - 1))) {
+			writer->data[writer->size >> 3] |= 0x80 >> (writer->size & 7);
+		}
+		writer->size++;
+	}
+}
+
+void bits_init_reader(
+		struct bit_reader * const reader,
+		unsigned char const * const data,
+		size_t const size) {
+	reader->data = data;
+	reader->size = 8 * size;
+	reader->position = 0;
+	reader->overrun = 0;
+}
+
+unsigned int bits_read(
+		struct bit_reader * const reader,
+		unsigned int const count) {
+	unsigned int value = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		value <<= 1;
+		if (reader->position >= reader->size) {
+			reader->overrun = 1;
+			continue;
+		}
+		if (reader->data[reader->position >> 3] & (0x80 >> (reader->position & 7))) {
+			value |= 1;
+		}
+		reader->position++;
+	}
+	return value;
+}
+
+unsigned int bits_peek(
+		struct bit_reader const * const reader,
+		unsigned int const count) {
+	size_t const byte = reader->position >> 3;
+	size_t const num_bytes = reader->size >> 3;
+	unsigned int window = 0;
+	for (size_t i = byte; i < byte + 4; i++) {
+		window = (window << 8) | (i < num_bytes ? reader->data[i] : 0);
+	}
+	return (window << (reader->position & 7)) >> (32 - count);
+}
+
+void bits_skip(
+		struct bit_reader * const reader,
+		unsigned int const count) {
+	if (count > reader->size - reader->position) {
+		reader->position = reader->size;
+		reader->overrun = 1;
+		return;
+	}
+	reader->position += count;
+}
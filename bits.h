@@ -0,0 +1,79 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __BITS_H__
+#define __BITS_H__
+
+#include <stddef.h>
+
+/*
+ * Growable MSB-first bit stream. Allocation failures are sticky: once
+ * failed is set, further writes are ignored and the caller reports
+ * the error when it is done writing.
+ */
+struct bit_writer {
+	unsigned char * data;
+	size_t capacity;
+	size_t size;
+	int failed;
+};
+
+/*
+ * MSB-first reader over a caller-owned buffer. Reading past the end
+ * returns zeroes and sets overrun, which decoders check once at the end.
+ */
+struct bit_reader {
+	unsigned char const * data;
+	size_t size;
+	size_t position;
+	int overrun;
+};
+
+void bits_init_writer(struct bit_writer * const writer);
+
+void bits_free_writer(struct bit_writer * const writer);
+
+void bits_write(
+	struct bit_writer * const writer,
+	unsigned int const value,
+	unsigned int const count);
+
+void bits_init_reader(
+	struct bit_reader * const reader,
+	unsigned char const * const data,
+	size_t const size);
+
+unsigned int bits_read(
+	struct bit_reader * const reader,
+	unsigned int const count);
+
+/*
+ * Returns the next 1 to 24 bits without consuming them, with zeroes
+ * past the end and without setting overrun, for table-driven decoders,
+ * which then skip the bits they actually used.
+ */
+unsigned int bits_peek(
+	struct bit_reader const * const reader,
+	unsigned int const count);
+
+void bits_skip(
+	struct bit_reader * const reader,
+	unsigned int const count);
+
+#endif
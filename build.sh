@@ -22,7 +22,7 @@ mkdir -p out/gfx
 mkdir -p out/tos
 
 rm -f out/bin/pxqueeze
-cc pxqueeze.c huffman.c rle.c tga.c -o out/bin/pxqueeze
-out/bin/pxqueeze
+cc -O3 main.c pxqueeze.c bits.c bwt.c coder.c histogram.c huffman.c lz.c model.c mtf.c predict.c rle.c server.c tga.c tile.c universal.c -o out/bin/pxqueeze -lm -pthread
+out/bin/pxqueeze -t out/gfx/jbq.tga
 
 # ~/code/rmac/rmac -s -v -p -4 src/pxq_test.s -o out/tos/PXQ.PRG
@@ -17,132 +17,170 @@
 
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-#define _GNU_SOURCE
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-int comparein(void const* v1, void const* v2, void* c) {
-	return memcmp(*(int*const*)v1, *(int*const*)v2, *(int*)c * sizeof(int));
-}
-
-struct offsetvalue {
-	int offset;
-	int value;
-};
-
-int compareov(void const* v1, void const* v2, void* c) {
-	struct offsetvalue const* ov1 = (struct offsetvalue const*)v1;
-	struct offsetvalue const* ov2 = (struct offsetvalue const*)v2;
-	if (ov1 -> value < ov2 -> value) {
-		return -1;
-	}
-	if (ov1 -> value > ov2 -> value) {
-		return 1;
-	}
-	if (ov1 -> offset < ov2 -> offset) {
-		return -1;
-	}
-	if (ov1 -> offset > ov2 -> offset) {
-		return 1;
-	}
-	return 0;
-}
-
-void main() {
-	unsigned char* input = "ABRACADABRA";
-	int inputsize = strlen(input);
-	int outputsize = inputsize + 1;
-
-	printf("Input string: %s\n\n", input);
-
-	int* rotations = malloc(2 * outputsize * sizeof(int));
-	rotations[outputsize - 1] = rotations[2 * outputsize - 1] = '~';
-	for (int i = 0; i < inputsize ; i++) {
-		rotations[i] = rotations[outputsize + i] = input[inputsize - 1 - i];
-	}
-
-	printf("Prepared rotations buffer: ");
-	for (int i = 0; i < 2 * outputsize; i++) {
-		printf("%c", rotations[i]);
-	}
-	printf("\n\n");
-
-	int** sortedrotations = malloc(outputsize * sizeof(int*));
-	for (int i = 0; i < outputsize ; i++) {
-		sortedrotations[i] = rotations + i;
+#include "bwt.h"
+
+enum pxq_status bwt_encode(
+		unsigned int * const output,
+		unsigned int * const outPrimary,
+		unsigned int const * const input,
+		unsigned int const size) {
+
+	if (size == 0) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	// Rotations, sorted by their first k symbols, and the rank of each
+	// rotation among those, which equal rotations share
+	unsigned int const count_size = size > PXQ_MAX_SYMBOLS ? size : PXQ_MAX_SYMBOLS;
+	unsigned int * sorted = malloc(size * sizeof(unsigned int));
+	unsigned int * by_second = malloc(size * sizeof(unsigned int));
+	unsigned int * ranks = malloc(size * sizeof(unsigned int));
+	unsigned int * new_ranks = malloc(size * sizeof(unsigned int));
+	unsigned int * counts = malloc((count_size + 1) * sizeof(unsigned int));
+	if (!sorted || !by_second || !ranks || !new_ranks || !counts) {
+		free(sorted);
+		free(by_second);
+		free(ranks);
+		free(new_ranks);
+		free(counts);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	// Sort by the first symbol. Blocks are often much smaller than the
+	// symbol range, only count up to the largest symbol.
+	unsigned int num_symbols = 0;
+	for (unsigned int i = 0; i < size; i++) {
+		if (input[i] >= num_symbols) {
+			num_symbols = input[i] + 1;
+		}
 	}
-
-	printf("Unsorted rotations:\n");
-	for (int j = 0; j < outputsize; j++) {
-		for (int i = 0; i < outputsize ; i++) {
-			printf("%c", sortedrotations[j][i]);
+	if (num_symbols > PXQ_MAX_SYMBOLS) {
+		free(sorted);
+		free(by_second);
+		free(ranks);
+		free(new_ranks);
+		free(counts);
+		return PXQ_ERROR_PARAMS;
+	}
+	memset(counts, 0, (num_symbols + 1) * sizeof(unsigned int));
+	for (unsigned int i = 0; i < size; i++) {
+		counts[input[i] + 1]++;
+	}
+	for (unsigned int s = 0; s < num_symbols; s++) {
+		counts[s + 1] += counts[s];
+	}
+	for (unsigned int i = 0; i < size; i++) {
+		sorted[counts[input[i]]++] = i;
+	}
+	unsigned int num_ranks = 1;
+	ranks[sorted[0]] = 0;
+	for (unsigned int i = 1; i < size; i++) {
+		if (input[sorted[i]] != input[sorted[i - 1]]) {
+			num_ranks++;
 		}
-		printf("\n");
+		ranks[sorted[i]] = num_ranks - 1;
 	}
-	printf("\n");
 
-	qsort_r(sortedrotations, outputsize, sizeof(int*), comparein, &outputsize);
+	// Rotations sorted by their first k symbols, then by the next k,
+	// are sorted by their first 2k symbols. Listing the rotations that
+	// start k symbols before each sorted one sorts them by their next k
+	// symbols, and a stable counting sort by rank does the rest.
+	for (unsigned int k = 1; k < size && num_ranks < size; k *= 2) {
+		for (unsigned int i = 0; i < size; i++) {
+			by_second[i] = sorted[i] >= k ? sorted[i] - k : sorted[i] + size - k;
+		}
+		memset(counts, 0, (num_ranks + 1) * sizeof(unsigned int));
+		for (unsigned int i = 0; i < size; i++) {
+			counts[ranks[i] + 1]++;
+		}
+		for (unsigned int r = 0; r < num_ranks; r++) {
+			counts[r + 1] += counts[r];
+		}
+		for (unsigned int i = 0; i < size; i++) {
+			sorted[counts[ranks[by_second[i]]]++] = by_second[i];
+		}
 
-	printf("Sorted rotations:\n");
-	for (int j = 0; j < outputsize; j++) {
-		for (int i = 0; i < outputsize ; i++) {
-			printf("%c", sortedrotations[j][i]);
+		num_ranks = 1;
+		new_ranks[sorted[0]] = 0;
+		for (unsigned int i = 1; i < size; i++) {
+			unsigned int const a = sorted[i];
+			unsigned int const b = sorted[i - 1];
+			unsigned int const a_next = a + k < size ? a + k : a + k - size;
+			unsigned int const b_next = b + k < size ? b + k : b + k - size;
+			if (ranks[a] != ranks[b] || ranks[a_next] != ranks[b_next]) {
+				num_ranks++;
+			}
+			new_ranks[a] = num_ranks - 1;
 		}
-		printf("\n");
+		unsigned int * const swap = ranks;
+		ranks = new_ranks;
+		new_ranks = swap;
 	}
-	printf("\n");
 
-	int* output = malloc(outputsize * sizeof(int));
-	for(int i = 0; i < outputsize ; i++) {
-		output[i] = sortedrotations[i][outputsize - 1];
+	// Rotations that are still equal can be in any order, they all
+	// have the same last symbol
+	for (unsigned int i = 0; i < size; i++) {
+		if (sorted[i] == 0) {
+			*outPrimary = i;
+		}
+		output[i] = input[sorted[i] ? sorted[i] - 1 : size - 1];
 	}
 
-	printf("Transformed string: ");
-	for(int i = 0; i < outputsize ; i++) {
-		printf("%c", output[i]);
-	}
-	printf("\n\n");
+	free(sorted);
+	free(by_second);
+	free(ranks);
+	free(new_ranks);
+	free(counts);
+	return PXQ_OK;
+}
 
-	struct offsetvalue * offsetvalues = malloc(outputsize * sizeof(struct offsetvalue));
+enum pxq_status bwt_decode(
+		unsigned int * const output,
+		unsigned int const * const input,
+		unsigned int const size,
+		unsigned int const primary) {
 
-	for (int i = 0; i < outputsize ; i++) {
-		offsetvalues[i].offset = i;
-		offsetvalues[i].value = output[i];
+	if (primary >= size) {
+		return PXQ_ERROR_FORMAT;
 	}
 
-	printf("Operations on output matrix, without sorting:\n");
-	for (int i = 0; i < outputsize ; i++) {
-		printf("Row %d gets %c prepended\n", offsetvalues[i].offset, offsetvalues[i].value);
+	unsigned int * counts = calloc(PXQ_MAX_SYMBOLS + 1, sizeof(unsigned int));
+	unsigned int * next = malloc(size * sizeof(unsigned int));
+	if (!counts || !next) {
+		free(counts);
+		free(next);
+		return PXQ_ERROR_MEMORY;
 	}
-	printf("\n");
-
-	qsort_r(offsetvalues, outputsize, sizeof(struct offsetvalue), compareov, 0);
 
-	printf("Operations on output matrix, with sorting, in destination order:\n");
-	for (int i = 0; i < outputsize ; i++) {
-		printf("New row %d comes from %d and gets %c prepended\n", i, offsetvalues[i].offset, offsetvalues[i].value);
+	// Sorting the last column, stably, gives the first column: the row
+	// where each last symbol lands is the rotation that starts one
+	// symbol earlier
+	for (unsigned int i = 0; i < size; i++) {
+		if (input[i] >= PXQ_MAX_SYMBOLS) {
+			free(counts);
+			free(next);
+			return PXQ_ERROR_FORMAT;
+		}
+		counts[input[i] + 1]++;
 	}
-	printf("\n");
-
-	int* inverseoffsets = malloc(outputsize * sizeof(int));
-
-	for (int i = 0; i < outputsize ; i++) {
-		inverseoffsets[offsetvalues[i].offset] = i;
+	for (unsigned int s = 0; s < PXQ_MAX_SYMBOLS; s++) {
+		counts[s + 1] += counts[s];
 	}
-
-	printf("Operations on output matrix, with sorting, in source order:\n");
-	for (int i = 0; i < outputsize ; i++) {
-		printf("Row %d goes to %d and gets %c prepended\n",
-					i, inverseoffsets[i], offsetvalues[inverseoffsets[i]].value);
+	for (unsigned int i = 0; i < size; i++) {
+		next[i] = counts[input[i]]++;
 	}
-	printf("\n");
 
-	printf("Recovered string: ");
-	int targetrotation = outputsize - 1;
-	for (int i = 0; i < outputsize - 1; i++) {
-		printf("%c", output[targetrotation]);
-		targetrotation = inverseoffsets[targetrotation];
+	// The primary row ends with the last symbol of the block
+	unsigned int row = primary;
+	for (unsigned int i = size; i > 0; i--) {
+		output[i - 1] = input[row];
+		row = next[row];
 	}
-	printf("\n\n");
+
+	free(counts);
+	free(next);
+	return PXQ_OK;
 }
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __BWT_H__
+#define __BWT_H__
+
+#include "pxqueeze.h"
+
+/*
+ * Burrows-Wheeler transform of a block of symbols: the last symbol of
+ * each rotation of the block, in the order of the sorted rotations, and
+ * the primary index, i.e. where the unrotated block ends up. Rotations
+ * are sorted by prefix doubling, which takes O(n log n) even on the long
+ * runs of graphics. The output may not alias the input.
+ */
+enum pxq_status bwt_encode(
+	unsigned int * const output,
+	unsigned int * const outPrimary,
+	unsigned int const * const input,
+	unsigned int const size);
+
+enum pxq_status bwt_decode(
+	unsigned int * const output,
+	unsigned int const * const input,
+	unsigned int const size,
+	unsigned int const primary);
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "coder.h"
+#include "universal.h"
+
+/*
+ * Every stream header starts with the coder, minus one, in 3 bits
+ */
+#define CODER_TYPE_BITS 3
+
+/*
+* Helper function: exact cost of every coder, and the best parameter of
+* each universal code
+*/
+static enum pxq_status _all_costs(
+		unsigned int * const costs,
+		unsigned int * const params,
+		unsigned int const * const symbols,
+		unsigned int const * const frequencies,
+		unsigned int const count,
+		unsigned char * const scratch);
+
+/*
+* Helper function: cheapest coder, or the forced one
+*/
+static enum pxq_coder _pick(
+		unsigned int const * const costs,
+		enum pxq_coder const forced);
+
+enum pxq_status coder_choose(
+		struct stream_coder * const coder,
+		unsigned int * const outCosts,
+		unsigned int const * const frequencies,
+		unsigned int const num_frequencies,
+		enum pxq_coder const forced) {
+
+	memset(coder, 0, sizeof(struct stream_coder));
+
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < num_frequencies; i++) {
+		if (frequencies[i] > 0) {
+			count++;
+		}
+	}
+
+	unsigned int * symbols = malloc((count + 1) * sizeof(unsigned int));
+	unsigned int * sparse = malloc((count + 1) * sizeof(unsigned int));
+	unsigned char * scratch = malloc(count + 1);
+	if (!symbols || !sparse || !scratch) {
+		free(symbols);
+		free(sparse);
+		free(scratch);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	count = 0;
+	for (unsigned int i = 0; i < num_frequencies; i++) {
+		if (frequencies[i] > 0) {
+			symbols[count] = i;
+			sparse[count] = frequencies[i];
+			count++;
+		}
+	}
+
+	unsigned int costs[PXQ_CODER_COUNT];
+	unsigned int params[PXQ_CODER_COUNT];
+	enum pxq_status status = _all_costs(costs, params, symbols, sparse, count, scratch);
+
+	if (status == PXQ_OK) {
+		coder->coder = _pick(costs, forced);
+		coder->param = params[coder->coder];
+		coder->offset = count > 0 ? symbols[0] : 0;
+		if (coder->coder == PXQ_CODER_HUFFMAN) {
+			status = huffman_build_table(&coder->huffman, frequencies, num_frequencies);
+		}
+		if (outCosts) {
+			memcpy(outCosts, costs, sizeof(costs));
+		}
+	}
+
+	free(symbols);
+	free(sparse);
+	free(scratch);
+	return status;
+}
+
+enum pxq_status coder_sparse_cost(
+		unsigned int * const outCost,
+		unsigned int const * const symbols,
+		unsigned int const * const frequencies,
+		unsigned int const count,
+		unsigned char * const scratch,
+		enum pxq_coder const forced) {
+
+	unsigned int costs[PXQ_CODER_COUNT];
+	unsigned int params[PXQ_CODER_COUNT];
+	enum pxq_status status = _all_costs(costs, params, symbols, frequencies, count, scratch);
+	if (status == PXQ_OK) {
+		*outCost = costs[_pick(costs, forced)];
+	}
+	return status;
+}
+
+unsigned int coder_header_bits(struct stream_coder const * const coder) {
+	if (coder->coder == PXQ_CODER_AUTO) {
+		return 0;
+	}
+	if (coder->coder == PXQ_CODER_HUFFMAN) {
+		return CODER_TYPE_BITS + huffman_serialized_bits(&coder->huffman);
+	}
+	return CODER_TYPE_BITS
+				+ universal_bits(PXQ_CODER_GAMMA, 0, coder->offset)
+				+ universal_param_bits(coder->coder, coder->param);
+}
+
+unsigned int coder_decoder_bytes(struct stream_coder const * const coder) {
+	if (coder->coder == PXQ_CODER_AUTO) {
+		return 0;
+	}
+	if (coder->coder == PXQ_CODER_HUFFMAN) {
+		return huffman_decoder_bytes(&coder->huffman);
+	}
+	return 4;
+}
+
+void coder_write_header(
+		struct bit_writer * const writer,
+		struct stream_coder const * const coder) {
+	bits_write(writer, coder->coder - 1, CODER_TYPE_BITS);
+	if (coder->coder == PXQ_CODER_HUFFMAN) {
+		huffman_write_table(writer, &coder->huffman);
+	} else {
+		universal_write(writer, PXQ_CODER_GAMMA, 0, coder->offset);
+		universal_write_param(writer, coder->coder, coder->param);
+	}
+}
+
+enum pxq_status coder_read_header(
+		struct stream_coder * const coder,
+		struct bit_reader * const reader) {
+
+	memset(coder, 0, sizeof(struct stream_coder));
+
+	coder->coder = bits_read(reader, CODER_TYPE_BITS) + 1;
+	if (reader->overrun || coder->coder >= PXQ_CODER_COUNT) {
+		return PXQ_ERROR_FORMAT;
+	}
+	if (coder->coder == PXQ_CODER_HUFFMAN) {
+		return huffman_read_table(&coder->huffman, reader);
+	}
+	coder->offset = universal_read(reader, PXQ_CODER_GAMMA, 0);
+	coder->param = universal_read_param(reader, coder->coder);
+	if (reader->overrun || coder->offset >= PXQ_MAX_SYMBOLS) {
+		return PXQ_ERROR_FORMAT;
+	}
+	return PXQ_OK;
+}
+
+unsigned int coder_symbol_bits(
+		struct stream_coder const * const coder,
+		unsigned int const symbol) {
+	if (coder->coder == PXQ_CODER_HUFFMAN) {
+		struct huffman_table const * const table = &coder->huffman;
+		if (symbol >= table->num_symbols) {
+			return ~0U;
+		}
+		if (table->distinct_symbols < 2) {
+			return symbol == table->num_symbols - 1 ? 0 : ~0U;
+		}
+		return table->code_lengths[symbol] ? table->code_lengths[symbol] : ~0U;
+	}
+	if (symbol < coder->offset) {
+		return ~0U;
+	}
+	return universal_bits(coder->coder, coder->param, symbol - coder->offset);
+}
+
+void coder_write_symbol(
+		struct bit_writer * const writer,
+		struct stream_coder const * const coder,
+		unsigned int const symbol) {
+	if (coder->coder == PXQ_CODER_HUFFMAN) {
+		huffman_write_symbol(writer, &coder->huffman, symbol);
+	} else {
+		universal_write(writer, coder->coder, coder->param, symbol - coder->offset);
+	}
+}
+
+unsigned int coder_read_symbol(
+		struct bit_reader * const reader,
+		struct stream_coder const * const coder) {
+	if (coder->coder == PXQ_CODER_HUFFMAN) {
+		return huffman_read_symbol(reader, &coder->huffman);
+	}
+	return universal_read(reader, coder->coder, coder->param) + coder->offset;
+}
+
+void coder_free(struct stream_coder * const coder) {
+	huffman_free_table(&coder->huffman);
+	memset(coder, 0, sizeof(struct stream_coder));
+}
+
+static enum pxq_status _all_costs(
+		unsigned int * const costs,
+		unsigned int * const params,
+		unsigned int const * const symbols,
+		unsigned int const * const frequencies,
+		unsigned int const count,
+		unsigned char * const scratch) {
+
+	costs[PXQ_CODER_AUTO] = ~0U;
+	params[PXQ_CODER_AUTO] = 0;
+
+	unsigned int bits;
+	enum pxq_status status = huffman_code_lengths(scratch, &bits, frequencies, count);
+	if (status != PXQ_OK) {
+		return status;
+	}
+	costs[PXQ_CODER_HUFFMAN] = CODER_TYPE_BITS + bits
+				+ huffman_table_bits(symbols, scratch, count);
+	params[PXQ_CODER_HUFFMAN] = 0;
+
+	unsigned int const offset = count > 0 ? symbols[0] : 0;
+	for (enum pxq_coder c = PXQ_CODER_GAMMA; c < PXQ_CODER_COUNT; c++) {
+		params[c] = universal_best_param(&bits, c, offset, symbols, frequencies, count);
+		unsigned long long const cost = (unsigned long long)bits + CODER_TYPE_BITS
+					+ universal_bits(PXQ_CODER_GAMMA, 0, offset)
+					+ universal_param_bits(c, params[c]);
+		costs[c] = cost > ~0U ? ~0U : (unsigned int)cost;
+	}
+
+	return PXQ_OK;
+}
+
+static enum pxq_coder _pick(
+		unsigned int const * const costs,
+		enum pxq_coder const forced) {
+	if (forced != PXQ_CODER_AUTO) {
+		return forced;
+	}
+	// On a tie, prefer the table-free codes, which decode without setup
+	enum pxq_coder best = PXQ_CODER_HUFFMAN;
+	for (enum pxq_coder c = PXQ_CODER_GAMMA; c < PXQ_CODER_COUNT; c++) {
+		if (costs[c] <= costs[best]) {
+			best = c;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __CODER_H__
+#define __CODER_H__
+
+#include "bits.h"
+#include "huffman.h"
+#include "pxqueeze.h"
+
+/*
+ * Entropy coder for one stream of symbols: either a Huffman table, or a
+ * universal code with its parameter. Universal codes code each symbol
+ * minus the smallest symbol of the stream.
+ */
+struct stream_coder {
+	enum pxq_coder coder;
+	unsigned int param;
+	unsigned int offset;
+	struct huffman_table huffman;
+};
+
+/*
+ * Computes the exact cost, stream header included, of every coder for
+ * a frequency array, and sets up the cheapest one (or the forced one,
+ * unless it's PXQ_CODER_AUTO). outCosts is indexed by enum pxq_coder,
+ * and may be NULL.
+ */
+enum pxq_status coder_choose(
+		struct stream_coder * const coder,
+		unsigned int * const outCosts,
+		unsigned int const * const frequencies,
+		unsigned int const num_frequencies,
+		enum pxq_coder const forced);
+
+/*
+ * Cost of the coder that coder_choose would pick, from the symbols that
+ * occur (in increasing order) and their frequencies. scratch holds
+ * count entries.
+ */
+enum pxq_status coder_sparse_cost(
+		unsigned int * const outCost,
+		unsigned int const * const symbols,
+		unsigned int const * const frequencies,
+		unsigned int const count,
+		unsigned char * const scratch,
+		enum pxq_coder const forced);
+
+/*
+ * Size of the stream header, 0 for a coder that was never set up.
+ */
+unsigned int coder_header_bits(struct stream_coder const * const coder);
+
+/*
+ * RAM that a decoder on the target needs for the coder, in bytes.
+ * Universal codes only need their parameter and offset, and a coder
+ * that was never set up needs nothing.
+ */
+unsigned int coder_decoder_bytes(struct stream_coder const * const coder);
+
+void coder_write_header(
+		struct bit_writer * const writer,
+		struct stream_coder const * const coder);
+
+enum pxq_status coder_read_header(
+		struct stream_coder * const coder,
+		struct bit_reader * const reader);
+
+/*
+ * Size of one symbol with an existing coder, or ~0U if the coder can't
+ * represent it (e.g. a Huffman table built without that symbol).
+ */
+unsigned int coder_symbol_bits(
+		struct stream_coder const * const coder,
+		unsigned int const symbol);
+
+void coder_write_symbol(
+		struct bit_writer * const writer,
+		struct stream_coder const * const coder,
+		unsigned int const symbol);
+
+unsigned int coder_read_symbol(
+		struct bit_reader * const reader,
+		struct stream_coder const * const coder);
+
+void coder_free(struct stream_coder * const coder);
+
+#endif
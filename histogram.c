@@ -0,0 +1,171 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+* Helper function: slot where a key is, or where it would go
+*/
+static unsigned int _find_slot(
+		struct histogram const * const histogram,
+		unsigned int const key);
+
+/*
+* Helper function: make room for one more entry
+*/
+static enum pxq_status _grow(struct histogram * const histogram);
+
+static int _compare_keys(void const * const v1, void const * const v2);
+
+void histogram_init(struct histogram * const histogram) {
+	memset(histogram, 0, sizeof(struct histogram));
+}
+
+void histogram_free(struct histogram * const histogram) {
+	free(histogram->keys);
+	free(histogram->counts);
+	free(histogram->slots);
+	memset(histogram, 0, sizeof(struct histogram));
+}
+
+void histogram_clear(struct histogram * const histogram) {
+	histogram->num_entries = 0;
+	if (histogram->slots) {
+		memset(histogram->slots, 0, histogram->num_slots * sizeof(unsigned int));
+	}
+}
+
+enum pxq_status histogram_add(
+		struct histogram * const histogram,
+		unsigned int const key,
+		unsigned int const count) {
+	if (histogram->num_slots) {
+		unsigned int const slot = _find_slot(histogram, key);
+		if (histogram->slots[slot]) {
+			histogram->counts[histogram->slots[slot] - 1] += count;
+			return PXQ_OK;
+		}
+	}
+
+	if (histogram->num_entries == histogram->capacity) {
+		enum pxq_status const status = _grow(histogram);
+		if (status != PXQ_OK) {
+			return status;
+		}
+	}
+
+	unsigned int const entry = histogram->num_entries++;
+	histogram->keys[entry] = key;
+	histogram->counts[entry] = count;
+	histogram->slots[_find_slot(histogram, key)] = entry + 1;
+	return PXQ_OK;
+}
+
+void histogram_subtract(
+		struct histogram * const histogram,
+		unsigned int const key,
+		unsigned int const count) {
+	if (histogram->num_slots == 0) {
+		return;
+	}
+	unsigned int const entry = histogram->slots[_find_slot(histogram, key)];
+	if (entry) {
+		unsigned int * const counts = &histogram->counts[entry - 1];
+		*counts = *counts > count ? *counts - count : 0;
+	}
+}
+
+unsigned int histogram_count(
+		struct histogram const * const histogram,
+		unsigned int const key) {
+	if (histogram->num_slots == 0) {
+		return 0;
+	}
+	unsigned int const entry = histogram->slots[_find_slot(histogram, key)];
+	return entry ? histogram->counts[entry - 1] : 0;
+}
+
+unsigned int histogram_sorted(
+		struct histogram const * const histogram,
+		unsigned int * const outKeys,
+		unsigned int * const outCounts) {
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < histogram->num_entries; i++) {
+		if (histogram->counts[i]) {
+			outKeys[count++] = histogram->keys[i];
+		}
+	}
+	qsort(outKeys, count, sizeof(unsigned int), _compare_keys);
+	for (unsigned int i = 0; i < count; i++) {
+		outCounts[i] = histogram_count(histogram, outKeys[i]);
+	}
+	return count;
+}
+
+static unsigned int _find_slot(
+		struct histogram const * const histogram,
+		unsigned int const key) {
+	unsigned int const mask = histogram->num_slots - 1;
+	unsigned int hash = key * 0x9E3779B1u;
+	hash ^= hash >> 15;
+	unsigned int slot = hash & mask;
+	while (histogram->slots[slot] && histogram->keys[histogram->slots[slot] - 1] != key) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static enum pxq_status _grow(struct histogram * const histogram) {
+	unsigned int const capacity = histogram->capacity ? histogram->capacity * 2 : 64;
+	unsigned int * const keys = realloc(histogram->keys, capacity * sizeof(unsigned int));
+	if (!keys) {
+		return PXQ_ERROR_MEMORY;
+	}
+	histogram->keys = keys;
+	unsigned int * const counts = realloc(histogram->counts, capacity * sizeof(unsigned int));
+	if (!counts) {
+		return PXQ_ERROR_MEMORY;
+	}
+	histogram->counts = counts;
+	histogram->capacity = capacity;
+
+	// Keep the table at most half full
+	if (capacity * 2 > histogram->num_slots) {
+		unsigned int * const slots = calloc(capacity * 2, sizeof(unsigned int));
+		if (!slots) {
+			return PXQ_ERROR_MEMORY;
+		}
+		free(histogram->slots);
+		histogram->slots = slots;
+		histogram->num_slots = capacity * 2;
+		for (unsigned int i = 0; i < histogram->num_entries; i++) {
+			histogram->slots[_find_slot(histogram, histogram->keys[i])] = i + 1;
+		}
+	}
+	return PXQ_OK;
+}
+
+static int _compare_keys(void const * const v1, void const * const v2) {
+	unsigned int const k1 = *(unsigned int const *)v1;
+	unsigned int const k2 = *(unsigned int const *)v2;
+	return (k1 > k2) - (k1 < k2);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include "pxqueeze.h"
+
+/*
+ * Sparse histogram of 32-bit keys, for alphabets too large to count in
+ * an array, such as pairs of symbols. Memory follows the number of
+ * distinct keys, not the size of the alphabet.
+ *
+ * Entries are kept in order of first appearance. An open addressing
+ * table, at most half full, finds them: slots hold entry numbers plus
+ * one, zero marks an empty slot.
+ */
+struct histogram {
+	unsigned int * keys;
+	unsigned int * counts;
+	unsigned int num_entries;
+	unsigned int capacity;
+	unsigned int * slots;
+	unsigned int num_slots;
+};
+
+/*
+ * Starts empty, nothing is allocated until the first key is added.
+ */
+void histogram_init(struct histogram * const histogram);
+
+void histogram_free(struct histogram * const histogram);
+
+/*
+ * Forgets all the keys, keeps the memory for reuse.
+ */
+void histogram_clear(struct histogram * const histogram);
+
+enum pxq_status histogram_add(
+		struct histogram * const histogram,
+		unsigned int const key,
+		unsigned int const count);
+
+/*
+ * Removes occurrences of a key that was added before. Keys whose count
+ * drops to zero stay in the table, and aren't listed any more.
+ */
+void histogram_subtract(
+		struct histogram * const histogram,
+		unsigned int const key,
+		unsigned int const count);
+
+unsigned int histogram_count(
+		struct histogram const * const histogram,
+		unsigned int const key);
+
+/*
+ * Lists the keys with a non-zero count, in increasing order, and their
+ * counts. Both arrays hold num_entries entries. Returns how many keys
+ * were listed.
+ */
+unsigned int histogram_sorted(
+		struct histogram const * const histogram,
+		unsigned int * const outKeys,
+		unsigned int * const outCounts);
+
+#endif
@@ -17,200 +17,522 @@
 
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void generate_huffman_table(
-		unsigned int const ** const output_table,
-		unsigned int * const output_size,
-		unsigned int * const output_num_symbols,
-		unsigned int const * const input,
-		unsigned int const input_pitch,
-		unsigned int const input_size) {
+#include "huffman.h"
+#include "universal.h"
+
+/*
+ * A symbol and its weight, sorted by weight to build the tree
+ */
+struct _huffman_leaf {
+	unsigned int weight;
+	unsigned int symbol;
+};
+
+static int _compare_leaves(void const * const v1, void const * const v2);
+
+/*
+* Helper function: number of bits needed to store a value
+*/
+static unsigned int _width(unsigned int const value);
+
+/*
+* Helper function: size of the header of a serialized table, up to the
+* first code length if codes follow (see huffman_write_table)
+*/
+static unsigned int _header_bits(
+		unsigned int const num_symbols,
+		unsigned int const distinct_symbols);
+
+/*
+* Helper function: size of the symbols that don't occur before a
+* symbol, and of the change to its code length, in a serialized table
+* (see huffman_write_table)
+*/
+static unsigned int _symbol_bits(
+		unsigned int const symbol,
+		unsigned int const length,
+		unsigned int * const current,
+		unsigned int * const next_symbol);
+
+/*
+* Helper function: derive canonical codes and decoding tables from the
+* code lengths, checking that they describe a valid code
+*/
+static enum pxq_status _prepare_canonical(struct huffman_table * const table);
+
+/*
+* Helper function: fill the lookup table of the short codes
+*/
+static enum pxq_status _prepare_lookup(struct huffman_table * const table);
+
+enum pxq_status huffman_build_table(
+		struct huffman_table * const table,
+		unsigned int const * const frequencies,
+		unsigned int const num_frequencies) {
+
+	memset(table, 0, sizeof(struct huffman_table));
+
 	// Compute symbol range
 	unsigned int num_symbols = 0;
-	for (unsigned int i = 0; i < input_size ; i++) {
-		if (input[i * input_pitch] > num_symbols) {
-			num_symbols = input[i * input_pitch];
+	for (unsigned int i = 0; i < num_frequencies; i++) {
+		if (frequencies[i] > 0) {
+			num_symbols = i + 1;
 		}
 	}
-	printf("Symbols in RLE runs range from 0 to %u\n", num_symbols);
-	num_symbols++;
-	*output_num_symbols = num_symbols;
+	table->num_symbols = num_symbols;
+
+	table->code_lengths = calloc(num_symbols + 1, sizeof(unsigned char));
+	if (!table->code_lengths) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	unsigned int bits;
+	enum pxq_status status = huffman_code_lengths(table->code_lengths, &bits,
+				frequencies, num_symbols);
+	if (status == PXQ_OK) {
+		status = _prepare_canonical(table);
+	}
+	if (status != PXQ_OK) {
+		huffman_free_table(table);
+	}
+	return status;
+}
+
+void huffman_free_table(struct huffman_table * const table) {
+	free(table->codes);
+	free(table->code_lengths);
+	free(table->sorted_symbols);
+	free(table->lookup);
+	memset(table, 0, sizeof(struct huffman_table));
+}
+
+enum pxq_status huffman_code_lengths(
+		unsigned char * const lengths,
+		unsigned int * const outBits,
+		unsigned int const * const frequencies,
+		unsigned int const num_frequencies) {
 
-	// Count number of instances of each symbol
-	unsigned int* symbol_frequencies = malloc(num_symbols * sizeof(unsigned int));
+	memset(lengths, 0, num_frequencies * sizeof(unsigned char));
+	*outBits = 0;
 
-	if (!symbol_frequencies) {
-		fprintf(stderr, __FILE__":%d Could not allocate %lu bytes for symbol frequencies\n",
-					__LINE__,
-					num_symbols * sizeof(unsigned int));
-		exit(1);
+	unsigned int num_leaves = 0;
+	for (unsigned int i = 0; i < num_frequencies; i++) {
+		if (frequencies[i] > 0) {
+			num_leaves++;
+		}
 	}
 
-	memset(symbol_frequencies, 0, num_symbols * sizeof(unsigned int));
+	// Zero or one symbol: nothing to encode
+	if (num_leaves < 2) {
+		return PXQ_OK;
+	}
 
-	for (unsigned int i = 0; i < input_size ; i++) {
-		symbol_frequencies[input[i * input_pitch]]++;
+	struct _huffman_leaf * leaves = malloc(num_leaves * sizeof(struct _huffman_leaf));
+	unsigned int * weights = malloc(2 * num_leaves * sizeof(unsigned int));
+	unsigned int * parents = malloc(2 * num_leaves * sizeof(unsigned int));
+	if (!leaves || !weights || !parents) {
+		free(leaves);
+		free(weights);
+		free(parents);
+		return PXQ_ERROR_MEMORY;
 	}
 
-	// Count distinct symbols, which is the number of leaves in the tree
-	unsigned int distinct_symbols = 0;
-	for (unsigned int i = 0; i < num_symbols; i++) {
-		if (symbol_frequencies[i] > 0) {
-			distinct_symbols++;
+	// Flatten the frequencies until the deepest code fits within the
+	// limit. This almost never happens with real images.
+	for (unsigned int shift = 0; ; shift++) {
+		unsigned int l = 0;
+		for (unsigned int i = 0; i < num_frequencies; i++) {
+			if (frequencies[i] > 0) {
+				leaves[l].weight = ((frequencies[i] - 1) >> shift) + 1;
+				leaves[l].symbol = i;
+				l++;
+			}
+		}
+		qsort(leaves, num_leaves, sizeof(struct _huffman_leaf), _compare_leaves);
+
+		// Leaves, sorted by weight, followed by internal nodes in creation
+		// order. Internal nodes are created with non-decreasing weights, so
+		// both halves act as sorted queues (two-queue Huffman construction).
+		for (unsigned int i = 0; i < num_leaves; i++) {
+			weights[i] = leaves[i].weight;
+		}
+		unsigned int next_leaf = 0;
+		unsigned int next_node = num_leaves;
+		unsigned int end_node = num_leaves;
+		for (unsigned int j = 0; j + 1 < num_leaves; j++) {
+			unsigned int merged = 0;
+			for (int k = 0; k < 2; k++) {
+				unsigned int child;
+				if (next_node == end_node
+							|| (next_leaf < num_leaves && weights[next_leaf] <= weights[next_node])) {
+					child = next_leaf++;
+				} else {
+					child = next_node++;
+				}
+				merged += weights[child];
+				parents[child] = end_node;
+			}
+			weights[end_node++] = merged;
+		}
+
+		// Parents are always created after their children, so walking
+		// back from the root sees every parent before its children.
+		// Depths overwrite the weights, which aren't needed anymore.
+		unsigned int max_depth = 0;
+		weights[end_node - 1] = 0;
+		for (unsigned int i = end_node - 1; i > 0; i--) {
+			weights[i - 1] = weights[parents[i - 1]] + 1;
+			if (weights[i - 1] > max_depth) {
+				max_depth = weights[i - 1];
+			}
 		}
+
+		if (max_depth <= HUFFMAN_MAX_LENGTH) {
+			unsigned int bits = 0;
+			for (unsigned int i = 0; i < num_leaves; i++) {
+				lengths[leaves[i].symbol] = weights[i];
+				bits += frequencies[leaves[i].symbol] * weights[i];
+			}
+			*outBits = bits;
+			break;
+		}
+	}
+
+	free(leaves);
+	free(weights);
+	free(parents);
+	return PXQ_OK;
+}
+
+unsigned int huffman_table_bits(
+		unsigned int const * const symbols,
+		unsigned char const * const lengths,
+		unsigned int const count) {
+
+	unsigned int const num_symbols = count > 0 ? symbols[count - 1] + 1 : 0;
+	unsigned int bits = _header_bits(num_symbols, count);
+	if (count < 2) {
+		return bits;
+	}
+
+	unsigned int current = lengths[0];
+	unsigned int next_symbol = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		bits += _symbol_bits(symbols[i], lengths[i], &current, &next_symbol);
 	}
+	return bits;
+}
 
-	printf("Generating Huffman table for symbol range 0 to %u (%u distinct)\n",
-				num_symbols - 1,
-				distinct_symbols);
+unsigned int huffman_decoder_bytes(struct huffman_table const * const table) {
+	unsigned int const symbol_bytes = table->num_symbols > 256 ? 2 : 1;
+	if (table->distinct_symbols < 2) {
+		return symbol_bytes;
+	}
+	return 2 * HUFFMAN_MAX_LENGTH + table->distinct_symbols * symbol_bytes;
+}
 
-/* The size numbers are wrong
-	unsigned int symbol_bits = 0;
-	while(size > 1U << symbol_bits) {
-		symbol_bits++;
+unsigned int huffman_serialized_bits(struct huffman_table const * const table) {
+	unsigned int bits = _header_bits(table->num_symbols, table->distinct_symbols);
+	if (table->distinct_symbols < 2) {
+		return bits;
 	}
 
-	unsigned int node_bits = 0;
-	while(distinct_symbols > 1U << node_bits) {
-		node_bits++;
+	unsigned int current = 0;
+	unsigned int next_symbol = 0;
+	for (unsigned int s = 0; s < table->num_symbols; s++) {
+		unsigned int const length = table->code_lengths[s];
+		if (length == 0) {
+			continue;
+		}
+		if (next_symbol == 0) {
+			current = length;
+		}
+		bits += _symbol_bits(s, length, &current, &next_symbol);
 	}
+	return bits;
+}
 
-	printf("Dense Huffman table will have %u entries of %u bits each (%u total)\n",
-				distinct_symbols - 1, symbol_bits + 1,
-				(distinct_symbols - 1) * (symbol_bits + 1));
+/*
+ * Table format, in the spirit of bzip2: the symbol range (5 bits of
+ * width, then the range itself), one bit set if codes follow, then the
+ * first code length in 5 bits and, for every symbol, the change from
+ * the previous length: 10 adds one, 110 removes one, 0 ends the symbol.
+ * 111 followed by an Elias gamma count skips symbols that don't occur.
+ */
+void huffman_write_table(
+		struct bit_writer * const writer,
+		struct huffman_table const * const table) {
 
-	printf("Sparse Huffman table will have %u entries of %u bits each,\n",
-				distinct_symbols - 1, node_bits + 1);
-	printf("  plus a dictionary of %u entries of %u bits each (%u total)\n",
-				distinct_symbols, symbol_bits,
-				(distinct_symbols - 1) * (node_bits + 1) + distinct_symbols * symbol_bits);
-*/
+	unsigned int const width = _width(table->num_symbols);
+	bits_write(writer, width, 5);
+	bits_write(writer, table->num_symbols, width);
+	bits_write(writer, table->distinct_symbols > 1, 1);
+	if (table->distinct_symbols < 2) {
+		return;
+	}
+
+	unsigned int current = 0;
+	for (unsigned int s = 0; s < table->num_symbols; s++) {
+		if (table->code_lengths[s]) {
+			current = table->code_lengths[s];
+			break;
+		}
+	}
+	bits_write(writer, current, 5);
 
-	unsigned int* values = malloc(distinct_symbols * sizeof(unsigned int));
-	if (!values) {
-		fprintf(stderr, __FILE__":%d Could not allocate %lu bytes for Huffman values\n",
-					__LINE__,
-					distinct_symbols * sizeof(unsigned int));
-		exit(1);
-	}
-
-	unsigned int* weights = malloc(distinct_symbols * sizeof(unsigned int));
-	if (!weights) {
-		fprintf(stderr, __FILE__":%d Could not allocate %lu bytes for Huffman weights\n",
-					__LINE__,
-					distinct_symbols * sizeof(unsigned int));
-		exit(1);
-	}
-
-	// populate the table of values / weights with leaf values
-	unsigned int w = 0;
-	for (int i = 0; i < num_symbols; i++) {
-		if (symbol_frequencies[i] > 0) {
-			values[w] = i;
-			weights[w] = symbol_frequencies[i];
-			w++;
-		}
-	}
-
-	// sort the table (I know, bubble sort isn't fast)
-	for (int j = 0; j < distinct_symbols - 1; j++) {
-		for (int i = 0; i < distinct_symbols - 1; i++) {
-			if (weights[i] > weights[i + 1]) {
-				unsigned int t;
-				t = weights[i];
-				weights[i] = weights[i + 1];
-				weights[i + 1] = t;
-				t = values[i];
-				values[i] = values[i + 1];
-				values[i + 1] = t;
+	unsigned int s = 0;
+	while (s < table->num_symbols) {
+		unsigned int const length = table->code_lengths[s];
+		if (length == 0) {
+			unsigned int run = 0;
+			while (s + run < table->num_symbols && table->code_lengths[s + run] == 0) {
+				run++;
 			}
+			bits_write(writer, 7, 3);
+			universal_write(writer, PXQ_CODER_GAMMA, 0, run - 1);
+			s += run;
+			continue;
 		}
+		while (current < length) {
+			bits_write(writer, 2, 2);
+			current++;
+		}
+		while (current > length) {
+			bits_write(writer, 6, 3);
+			current--;
+		}
+		bits_write(writer, 0, 1);
+		s++;
 	}
+}
+
+enum pxq_status huffman_read_table(
+		struct huffman_table * const table,
+		struct bit_reader * const reader) {
+
+	memset(table, 0, sizeof(struct huffman_table));
 
-//	for (int i = 0; i < distinct_symbols; i++) {
-//		printf("Initial weight %u value %u\n", weights[i], values[i]);
-//	}
-
-	printf("Creating Huffman table with %u entries\n", 2 * (distinct_symbols - 1));
-	unsigned int* huffman = malloc(2 * (distinct_symbols - 1) * sizeof(unsigned int));
-	if (!huffman) {
-		fprintf(stderr, __FILE__":%d Could not allocate %lu bytes for Huffman table\n",
-					__LINE__,
-					2 * (distinct_symbols - 1) * sizeof(unsigned int));
-		exit(1);
-	}
-
-	unsigned int next_node = num_symbols + distinct_symbols - 2;
-
-	for (unsigned int j = 0; j < distinct_symbols - 1; j++) {
-//		printf("Creating node %u from %u and %u, weight %u\n",
-//					input_size + distinct_symbols - j - 2,
-//					values[j],
-//					values[j + 1],
-//					weights[j] + weights[j + 1]);
-		huffman[2 * (distinct_symbols - 2 - j)] = values[j];
-		huffman[2 * (distinct_symbols - 2 - j) + 1] = values[j + 1];
-		values[j + 1] = num_symbols + distinct_symbols - j - 2;
-		weights[j + 1] += weights[j];
-		for (int i = j; i < distinct_symbols - 1; i++) {
-			if (weights[i] > weights[i + 1]) {
-				unsigned int t;
-				t = weights[i];
-				weights[i] = weights[i + 1];
-				weights[i + 1] = t;
-				t = values[i];
-				values[i] = values[i + 1];
-				values[i + 1] = t;
+	unsigned int const width = bits_read(reader, 5);
+	if (width > 17) {
+		return PXQ_ERROR_FORMAT;
+	}
+	unsigned int const num_symbols = bits_read(reader, width);
+	unsigned int const has_codes = bits_read(reader, 1);
+	if (reader->overrun || num_symbols > PXQ_MAX_SYMBOLS
+				|| (has_codes && num_symbols < 2)) {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	table->num_symbols = num_symbols;
+	table->code_lengths = calloc(num_symbols + 1, sizeof(unsigned char));
+	if (!table->code_lengths) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	if (has_codes) {
+		unsigned int current = bits_read(reader, 5);
+		unsigned int s = 0;
+		while (s < num_symbols && !reader->overrun) {
+			if (!bits_read(reader, 1)) {
+				if (current == 0 || current > HUFFMAN_MAX_LENGTH) {
+					huffman_free_table(table);
+					return PXQ_ERROR_FORMAT;
+				}
+				table->code_lengths[s++] = current;
+			} else if (!bits_read(reader, 1)) {
+				current++;
+			} else if (!bits_read(reader, 1)) {
+				current--;
+			} else {
+				unsigned int const run = universal_read(reader, PXQ_CODER_GAMMA, 0) + 1;
+				if (reader->overrun || run > num_symbols - s) {
+					huffman_free_table(table);
+					return PXQ_ERROR_FORMAT;
+				}
+				s += run;
 			}
 		}
+		if (reader->overrun) {
+			huffman_free_table(table);
+			return PXQ_ERROR_FORMAT;
+		}
 	}
 
-	free(values);
-	free(weights);
+	enum pxq_status status = _prepare_canonical(table);
+	if (status == PXQ_OK && table->distinct_symbols > 1) {
+		status = _prepare_lookup(table);
+	}
+	if (status != PXQ_OK) {
+		huffman_free_table(table);
+	}
+	return status;
+}
 
-	for (int i = 0; i < distinct_symbols - 1; i++) {
-//		printf("Huffman node %u: children %u and %u\n",
-//					i + input_size,
-//					huffman[2 * i],
-//					huffman [2 * i + 1]);
-	}
-	printf("Completed Huffman table with %u nodes\n", (distinct_symbols - 1));
-	*output_size = (distinct_symbols - 1);
-	*output_table = huffman;
-}
-
-static void codes_inner(char** codes,
-			unsigned int const * const huffman_table,
-			unsigned int const num_symbols,
-			unsigned int node,
-			char * prefix) {
-//	printf("Processing node %u with prefix [%s]\n", node + num_symbols, prefix);
-	char * prefix1 = strdup(prefix);
-	prefix1 = realloc(prefix1, strlen(prefix1) + 2);
-	strcat(prefix1, "0");
-	if (huffman_table[2 * node] >= num_symbols) {
-		codes_inner(codes, huffman_table, num_symbols, huffman_table[2 * node] - num_symbols, prefix1);
-	} else {
-//		printf("Outputing code %s for symbol %u\n", prefix1, huffman_table[2 * node]);
-		codes[huffman_table[2 * node]] = prefix1;
+void huffman_write_symbol(
+		struct bit_writer * const writer,
+		struct huffman_table const * const table,
+		unsigned int const symbol) {
+	bits_write(writer, table->codes[symbol], table->code_lengths[symbol]);
+}
+
+unsigned int huffman_read_symbol(
+		struct bit_reader * const reader,
+		struct huffman_table const * const table) {
+
+	if (table->distinct_symbols < 2) {
+		if (table->num_symbols == 0) {
+			reader->overrun = 1;
+			return 0;
+		}
+		return table->num_symbols - 1;
 	}
-	prefix = realloc(prefix, strlen(prefix) + 2);
-	strcat(prefix, "1");
-	if (huffman_table[2 * node + 1] >= num_symbols) {
-		codes_inner(codes, huffman_table, num_symbols, huffman_table[2 * node + 1] - num_symbols, prefix);
-	} else {
-//		printf("Outputing code %s for symbol %u\n", prefix, huffman_table[2 * node + 1]);
-		codes[huffman_table[2 * node + 1]] = prefix;
+
+	if (table->lookup) {
+		unsigned int const entry = table->lookup[bits_peek(reader, HUFFMAN_LOOKUP_BITS)];
+		if (entry) {
+			bits_skip(reader, entry & 31);
+			return entry >> 5;
+		}
+	}
+
+	// Codes of each length are consecutive and start right after the
+	// shorter ones, shifted left: compare against each range in turn.
+	unsigned int code = 0;
+	unsigned int first = 0;
+	unsigned int index = 0;
+	for (unsigned int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+		code |= bits_read(reader, 1);
+		unsigned int const count = table->length_counts[length];
+		if (code - first < count) {
+			return table->sorted_symbols[index + code - first];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
 	}
+
+	reader->overrun = 1;
+	return 0;
 }
 
-char** generate_huffman_codes(unsigned int const * const huffman_table, unsigned int num_symbols) {
-	printf("Generating Huffman codes for %u symbols\n", num_symbols);
-	char** codes = malloc(num_symbols * sizeof(char**));
-	memset(codes, 0, num_symbols * sizeof(char**));
-	codes_inner(codes, huffman_table, num_symbols, 0, strdup(""));
-	return codes;
+static enum pxq_status _prepare_canonical(struct huffman_table * const table) {
+
+	unsigned int const num_symbols = table->num_symbols;
+
+	memset(table->length_counts, 0, sizeof(table->length_counts));
+	table->distinct_symbols = 0;
+	for (unsigned int s = 0; s < num_symbols; s++) {
+		if (table->code_lengths[s]) {
+			table->length_counts[table->code_lengths[s]]++;
+			table->distinct_symbols++;
+		}
+	}
+
+	table->codes = calloc(num_symbols + 1, sizeof(unsigned int));
+	table->sorted_symbols = malloc((table->distinct_symbols + 1) * sizeof(unsigned int));
+	if (!table->codes || !table->sorted_symbols) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	// Without codes, the range only holds the single symbol
+	if (table->distinct_symbols == 0) {
+		table->distinct_symbols = num_symbols ? 1 : 0;
+		return PXQ_OK;
+	}
+
+	// First code and first sorted position of each length, checking
+	// that no length is over-subscribed
+	unsigned int next_code[HUFFMAN_MAX_LENGTH + 1];
+	unsigned int next_index[HUFFMAN_MAX_LENGTH + 1];
+	unsigned int code = 0;
+	unsigned int index = 0;
+	for (unsigned int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+		next_code[length] = code;
+		next_index[length] = index;
+		code += table->length_counts[length];
+		index += table->length_counts[length];
+		if (code > (1U << length)) {
+			return PXQ_ERROR_FORMAT;
+		}
+		code <<= 1;
+	}
+
+	for (unsigned int s = 0; s < num_symbols; s++) {
+		unsigned int const length = table->code_lengths[s];
+		if (length) {
+			table->codes[s] = next_code[length]++;
+			table->sorted_symbols[next_index[length]++] = s;
+		}
+	}
+
+	return PXQ_OK;
+}
+
+static enum pxq_status _prepare_lookup(struct huffman_table * const table) {
+
+	table->lookup = calloc(1U << HUFFMAN_LOOKUP_BITS, sizeof(unsigned int));
+	if (!table->lookup) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	// A short code fills every entry whose leading bits it matches
+	for (unsigned int s = 0; s < table->num_symbols; s++) {
+		unsigned int const length = table->code_lengths[s];
+		if (length == 0 || length > HUFFMAN_LOOKUP_BITS) {
+			continue;
+		}
+		unsigned int const first = table->codes[s] << (HUFFMAN_LOOKUP_BITS - length);
+		unsigned int const last = first + (1U << (HUFFMAN_LOOKUP_BITS - length));
+		for (unsigned int i = first; i < last; i++) {
+			table->lookup[i] = (s << 5) | length;
+		}
+	}
+
+	return PXQ_OK;
+}
+
+static int _compare_leaves(void const * const v1, void const * const v2) {
+	struct _huffman_leaf const * const l1 = (struct _huffman_leaf const *)v1;
+	struct _huffman_leaf const * const l2 = (struct _huffman_leaf const *)v2;
+	if (l1->weight != l2->weight) {
+		return l1->weight < l2->weight ? -1 : 1;
+	}
+	return (l1->symbol > l2->symbol) - (l1->symbol < l2->symbol);
+}
+
+static unsigned int _width(unsigned int const value) {
+	unsigned int bits = 0;
+	while (bits < 32 && value >= (1U << bits)) {
+		bits++;
+	}
+	return bits;
+}
+
+static unsigned int _header_bits(
+		unsigned int const num_symbols,
+		unsigned int const distinct_symbols) {
+	return 5 + _width(num_symbols) + 1 + (distinct_symbols > 1 ? 5 : 0);
+}
+
+static unsigned int _symbol_bits(
+		unsigned int const symbol,
+		unsigned int const length,
+		unsigned int * const current,
+		unsigned int * const next_symbol) {
+
+	unsigned int bits = 1;
+	if (symbol > *next_symbol) {
+		bits += 3 + universal_bits(PXQ_CODER_GAMMA, 0, symbol - *next_symbol - 1);
+	}
+	if (length > *current) {
+		bits += 2 * (length - *current);
+	} else {
+		bits += 3 * (*current - length);
+	}
+	*current = length;
+	*next_symbol = symbol + 1;
+	return bits;
 }
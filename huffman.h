@@ -17,14 +17,110 @@
 
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-void generate_huffman_table(
-		unsigned int const ** const output_table,
-		unsigned int * const output_size,
-		unsigned int * const num_symbols,
-		unsigned int const * const input,
-		unsigned int const input_pitch,
-		unsigned int const input_size);
-
-char** generate_huffman_codes(
-		unsigned int const * const huffman_table,
-		unsigned int num_symbols);
+#ifndef __HUFFMAN_H__
+#define __HUFFMAN_H__
+
+#include "bits.h"
+#include "pxqueeze.h"
+
+/*
+ * Longest code the encoder produces. Decoders on the target only need
+ * one count per length, so this bounds their table size too.
+ */
+#define HUFFMAN_MAX_LENGTH 24
+
+/*
+ * Codes up to this length decode with a single lookup of the next bits,
+ * longer ones go through the length counts
+ */
+#define HUFFMAN_LOOKUP_BITS 9
+
+/*
+ * Canonical Huffman table. Symbols are numbered 0 to num_symbols - 1,
+ * codes of a given length are consecutive, in symbol order. A single
+ * distinct symbol has no code at all, and is the last symbol of the
+ * range.
+ *
+ * The decoder side only keeps the number of codes of each length and
+ * the symbols sorted by code, which is all a canonical decoder needs.
+ * Tables that are read also get a lookup table, indexed by the next
+ * HUFFMAN_LOOKUP_BITS bits, of the symbol in the upper bits and the
+ * code length in the lower 5 bits, 0 for longer codes. It only speeds
+ * up decoding here, decoders on the target can do without.
+ */
+struct huffman_table {
+	unsigned int num_symbols;
+	unsigned int distinct_symbols;
+	unsigned int * codes;
+	unsigned char * code_lengths;
+	unsigned int length_counts[HUFFMAN_MAX_LENGTH + 1];
+	unsigned int * sorted_symbols;
+	unsigned int * lookup;
+};
+
+/*
+ * Builds the table for a frequency array. The symbol range is trimmed
+ * to the largest symbol that actually occurs.
+ */
+enum pxq_status huffman_build_table(
+		struct huffman_table * const table,
+		unsigned int const * const frequencies,
+		unsigned int const num_frequencies);
+
+void huffman_free_table(struct huffman_table * const table);
+
+/*
+ * Computes Huffman code lengths, limited to HUFFMAN_MAX_LENGTH, for an
+ * array of frequencies (0 for zero frequencies), and the number of
+ * payload bits they produce.
+ */
+enum pxq_status huffman_code_lengths(
+		unsigned char * const lengths,
+		unsigned int * const outBits,
+		unsigned int const * const frequencies,
+		unsigned int const num_frequencies);
+
+/*
+ * Size in bits of a serialized table, from the symbols that occur (in
+ * increasing order) and their code lengths.
+ */
+unsigned int huffman_table_bits(
+		unsigned int const * const symbols,
+		unsigned char const * const lengths,
+		unsigned int const count);
+
+/*
+ * Same as huffman_table_bits, for a table that was already built.
+ */
+unsigned int huffman_serialized_bits(struct huffman_table const * const table);
+
+/*
+ * RAM that a decoder on the target needs for the table, in bytes: two
+ * per length count, and one per sorted symbol, or two beyond 256
+ * symbols.
+ */
+unsigned int huffman_decoder_bytes(struct huffman_table const * const table);
+
+void huffman_write_table(
+		struct bit_writer * const writer,
+		struct huffman_table const * const table);
+
+enum pxq_status huffman_read_table(
+		struct huffman_table * const table,
+		struct bit_reader * const reader);
+
+void huffman_write_symbol(
+		struct bit_writer * const writer,
+		struct huffman_table const * const table,
+		unsigned int const symbol);
+
+/*
+ * Decodes one symbol with the lookup table, or with the canonical
+ * length counts for longer codes. Malformed data sets the reader's
+ * overrun flag.
+ */
+unsigned int huffman_read_symbol(
+		struct bit_reader * const reader,
+		struct huffman_table const * const table);
+
+#endif
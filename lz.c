@@ -0,0 +1,521 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+#include "universal.h"
+
+/*
+ * Match finder: chains of the earlier positions with the same hash of
+ * their first LZ_MIN_MATCH symbols, searched nearest first
+ */
+#define LZ_HASH_BITS 16
+#define LZ_MAX_CHAIN 32
+
+/*
+ * Parses priced by the coders of the previous one
+ */
+#define LZ_PASSES 3
+
+/*
+* Cheapest way found to reach a position: the last token, and the recent
+* distances after it
+*/
+struct _lz_node {
+	unsigned long long price;
+	unsigned int length;
+	unsigned int distance;
+	unsigned int token;
+	unsigned int reps[LZ_REPS];
+};
+
+/*
+* Estimated sizes of the symbols that the parse prices the most often
+*/
+struct _lz_prices {
+	unsigned int tokens[LZ_TOKEN_COUNT];
+	unsigned int lengths[LZ_MAX_MATCH - LZ_MIN_MATCH + 1];
+	unsigned int * literals;
+};
+
+/*
+* Helper function: estimated size of a symbol in a stream, from the
+* coders of the previous parse if there is one
+*/
+static unsigned int _price(
+		struct lz_parse const * const previous,
+		enum lz_stream const stream,
+		unsigned int const symbol,
+		unsigned int const literal_bits);
+
+/*
+* Helper function: keep a way to reach a position if it's the cheapest
+*/
+static void _relax(
+		struct _lz_node * const node,
+		unsigned long long const price,
+		unsigned int const token,
+		unsigned int const length,
+		unsigned int const distance,
+		unsigned int const * const reps);
+
+/*
+* Helper function: one optimal parse for a set of prices, with coders
+* set up for it
+*/
+static enum pxq_status _parse_once(
+		struct lz_parse * const parse,
+		struct lz_parse const * const previous,
+		struct _lz_node * const nodes,
+		unsigned int * const chains,
+		unsigned int * const literal_prices,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		unsigned int const inNumSymbols,
+		unsigned int const inWindow);
+
+/*
+* Helper function: length of the match at a distance, up to a maximum
+*/
+static inline unsigned int _match_length(
+		unsigned int const * const symbols,
+		unsigned int const position,
+		unsigned int const distance,
+		unsigned int const max_length) {
+	unsigned int const * const current = symbols + position;
+	unsigned int const * const earlier = current - distance;
+	unsigned int length = 0;
+	while (length < max_length && current[length] == earlier[length]) {
+		length++;
+	}
+	return length;
+}
+
+/*
+* Helper function: hash of the first LZ_MIN_MATCH symbols at a position
+*/
+static inline unsigned int _hash(
+		unsigned int const * const symbols,
+		unsigned int const position) {
+	unsigned int const key = (symbols[position] << 16) ^ symbols[position + 1];
+	return (key * 0x9E3779B1u) >> (32 - LZ_HASH_BITS);
+}
+
+enum pxq_status lz_parse(
+		struct lz_parse * const parse,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		unsigned int const inNumSymbols,
+		unsigned int const inWindow) {
+
+	memset(parse, 0, sizeof(struct lz_parse));
+	if (inSize == 0 || inNumSymbols == 0 || inWindow == 0 || inWindow > PXQ_MAX_SYMBOLS) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	struct _lz_node * nodes = malloc(((size_t)inSize + 1) * sizeof(struct _lz_node));
+	unsigned int * chains = malloc(((size_t)inSize + (1U << LZ_HASH_BITS)) * sizeof(unsigned int));
+	unsigned int * literal_prices = malloc(inNumSymbols * sizeof(unsigned int));
+	if (!nodes || !chains || !literal_prices) {
+		free(nodes);
+		free(chains);
+		free(literal_prices);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	// The first parse uses rough estimates, then each one is priced by
+	// the coders of the one before, and the cheapest one is kept
+	struct lz_parse passes[LZ_PASSES];
+	memset(passes, 0, sizeof(passes));
+	enum pxq_status status = PXQ_OK;
+	unsigned int best = 0;
+	for (unsigned int p = 0; p < LZ_PASSES && status == PXQ_OK; p++) {
+		status = _parse_once(&passes[p], p > 0 ? &passes[p - 1] : NULL, nodes, chains,
+					literal_prices, inSymbols, inSize, inNumSymbols, inWindow);
+		if (status == PXQ_OK && passes[p].total_bits < passes[best].total_bits) {
+			best = p;
+		}
+	}
+	for (unsigned int p = 0; p < LZ_PASSES; p++) {
+		if (p != best || status != PXQ_OK) {
+			lz_free(&passes[p]);
+		}
+	}
+	if (status == PXQ_OK) {
+		*parse = passes[best];
+	}
+
+	free(nodes);
+	free(chains);
+	free(literal_prices);
+	return status;
+}
+
+unsigned int lz_decoder_bytes(struct lz_parse const * const parse) {
+	// Distances go up to PXQ_MAX_SYMBOLS, one more than 16 bits hold
+	unsigned int bytes = LZ_REPS * 4;
+	for (int s = 0; s < LZ_STREAM_COUNT; s++) {
+		bytes += coder_decoder_bytes(&parse->coders[s]);
+	}
+	return bytes;
+}
+
+void lz_write(
+		struct bit_writer * const writer,
+		struct lz_parse const * const parse) {
+
+	// Streams other than the tokens may be empty, and then have no coder
+	coder_write_header(writer, &parse->coders[LZ_TOKENS]);
+	for (int s = LZ_LITERALS; s < LZ_STREAM_COUNT; s++) {
+		bits_write(writer, parse->sizes[s] > 0, 1);
+		if (parse->sizes[s]) {
+			coder_write_header(writer, &parse->coders[s]);
+		}
+	}
+
+	unsigned int next[LZ_STREAM_COUNT];
+	memset(next, 0, sizeof(next));
+	for (unsigned int t = 0; t < parse->sizes[LZ_TOKENS]; t++) {
+		unsigned int const token = parse->streams[LZ_TOKENS][t];
+		coder_write_symbol(writer, &parse->coders[LZ_TOKENS], token);
+		if (token == LZ_LITERAL) {
+			coder_write_symbol(writer, &parse->coders[LZ_LITERALS],
+						parse->streams[LZ_LITERALS][next[LZ_LITERALS]++]);
+		} else if (token != LZ_SHORT_REP) {
+			coder_write_symbol(writer, &parse->coders[LZ_LENGTHS],
+						parse->streams[LZ_LENGTHS][next[LZ_LENGTHS]++]);
+		}
+		if (token == LZ_MATCH) {
+			coder_write_symbol(writer, &parse->coders[LZ_DISTANCES],
+						parse->streams[LZ_DISTANCES][next[LZ_DISTANCES]++]);
+		}
+	}
+}
+
+enum pxq_status lz_read(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const outSize) {
+
+	struct stream_coder coders[LZ_STREAM_COUNT];
+	int present[LZ_STREAM_COUNT];
+	memset(coders, 0, sizeof(coders));
+	memset(present, 0, sizeof(present));
+
+	enum pxq_status status = coder_read_header(&coders[LZ_TOKENS], reader);
+	present[LZ_TOKENS] = 1;
+	for (int s = LZ_LITERALS; s < LZ_STREAM_COUNT && status == PXQ_OK; s++) {
+		present[s] = bits_read(reader, 1);
+		if (present[s]) {
+			status = coder_read_header(&coders[s], reader);
+		}
+	}
+
+	unsigned int reps[LZ_REPS] = { 1, 2, 3, 4 };
+	unsigned int position = 0;
+	while (position < outSize && status == PXQ_OK) {
+		unsigned int const token = coder_read_symbol(reader, &coders[LZ_TOKENS]);
+		if (reader->overrun || token >= LZ_TOKEN_COUNT) {
+			status = PXQ_ERROR_FORMAT;
+			break;
+		}
+		if (token == LZ_LITERAL) {
+			if (!present[LZ_LITERALS]) {
+				status = PXQ_ERROR_FORMAT;
+				break;
+			}
+			outSymbols[position++] = coder_read_symbol(reader, &coders[LZ_LITERALS]);
+			continue;
+		}
+
+		unsigned int length = 1;
+		if (token != LZ_SHORT_REP) {
+			if (!present[LZ_LENGTHS]) {
+				status = PXQ_ERROR_FORMAT;
+				break;
+			}
+			length = coder_read_symbol(reader, &coders[LZ_LENGTHS]) + LZ_MIN_MATCH;
+		}
+		unsigned int distance = reps[0];
+		if (token == LZ_MATCH) {
+			if (!present[LZ_DISTANCES]) {
+				status = PXQ_ERROR_FORMAT;
+				break;
+			}
+			distance = coder_read_symbol(reader, &coders[LZ_DISTANCES]) + 1;
+			memmove(reps + 1, reps, (LZ_REPS - 1) * sizeof(unsigned int));
+			reps[0] = distance;
+		} else if (token >= LZ_REP) {
+			unsigned int const index = token - LZ_REP;
+			distance = reps[index];
+			memmove(reps + 1, reps, index * sizeof(unsigned int));
+			reps[0] = distance;
+		}
+
+		if (reader->overrun || length > LZ_MAX_MATCH || length > outSize - position
+					|| distance == 0 || distance > position) {
+			status = PXQ_ERROR_FORMAT;
+			break;
+		}
+		for (unsigned int i = 0; i < length; i++, position++) {
+			outSymbols[position] = outSymbols[position - distance];
+		}
+	}
+
+	for (int s = 0; s < LZ_STREAM_COUNT; s++) {
+		coder_free(&coders[s]);
+	}
+	return status;
+}
+
+void lz_free(struct lz_parse * const parse) {
+	for (int s = 0; s < LZ_STREAM_COUNT; s++) {
+		free(parse->streams[s]);
+		coder_free(&parse->coders[s]);
+	}
+	memset(parse, 0, sizeof(struct lz_parse));
+}
+
+static unsigned int _price(
+		struct lz_parse const * const previous,
+		enum lz_stream const stream,
+		unsigned int const symbol,
+		unsigned int const literal_bits) {
+	if (previous && previous->coders[stream].coder != PXQ_CODER_AUTO) {
+		unsigned int const bits = coder_symbol_bits(&previous->coders[stream], symbol);
+		if (bits != ~0U) {
+			return bits;
+		}
+	}
+
+	// Symbols that the previous parse didn't use are priced as rare
+	unsigned int const unseen = previous ? 8 : 0;
+	switch (stream) {
+		case LZ_TOKENS:
+			return 2 + unseen;
+		case LZ_LITERALS:
+			return literal_bits + unseen;
+		case LZ_LENGTHS:
+		case LZ_DISTANCES:
+		case LZ_STREAM_COUNT:
+			break;
+	}
+	return universal_bits(PXQ_CODER_GAMMA, 0, symbol) + unseen;
+}
+
+static void _relax(
+		struct _lz_node * const node,
+		unsigned long long const price,
+		unsigned int const token,
+		unsigned int const length,
+		unsigned int const distance,
+		unsigned int const * const reps) {
+	if (price < node->price) {
+		node->price = price;
+		node->token = token;
+		node->length = length;
+		node->distance = distance;
+		memcpy(node->reps, reps, sizeof(node->reps));
+	}
+}
+
+static enum pxq_status _parse_once(
+		struct lz_parse * const parse,
+		struct lz_parse const * const previous,
+		struct _lz_node * const nodes,
+		unsigned int * const chains,
+		unsigned int * const literal_prices,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		unsigned int const inNumSymbols,
+		unsigned int const inWindow) {
+
+	memset(parse, 0, sizeof(struct lz_parse));
+
+	unsigned int literal_bits = 1;
+	while ((1U << literal_bits) < inNumSymbols && literal_bits < 16) {
+		literal_bits++;
+	}
+	struct _lz_prices prices;
+	for (unsigned int t = 0; t < LZ_TOKEN_COUNT; t++) {
+		prices.tokens[t] = _price(previous, LZ_TOKENS, t, literal_bits);
+	}
+	for (unsigned int l = 0; l <= LZ_MAX_MATCH - LZ_MIN_MATCH; l++) {
+		prices.lengths[l] = _price(previous, LZ_LENGTHS, l, literal_bits);
+	}
+	prices.literals = literal_prices;
+	for (unsigned int v = 0; v < inNumSymbols; v++) {
+		prices.literals[v] = _price(previous, LZ_LITERALS, v, literal_bits);
+	}
+
+	// Chain links for each position, then the hash heads, both holding
+	// positions plus one, zero ending a chain
+	unsigned int * const links = chains;
+	unsigned int * const heads = chains + inSize;
+	memset(heads, 0, (1U << LZ_HASH_BITS) * sizeof(unsigned int));
+
+	for (unsigned int i = 0; i <= inSize; i++) {
+		nodes[i].price = ~0ULL;
+	}
+	nodes[0].price = 0;
+	for (unsigned int r = 0; r < LZ_REPS; r++) {
+		nodes[0].reps[r] = r + 1;
+	}
+
+	for (unsigned int i = 0; i < inSize; i++) {
+		struct _lz_node const * const node = &nodes[i];
+		unsigned long long const base = node->price;
+		unsigned int const * const reps = node->reps;
+		unsigned int const max_length = inSize - i < LZ_MAX_MATCH ? inSize - i : LZ_MAX_MATCH;
+		unsigned int moved[LZ_REPS];
+
+		_relax(&nodes[i + 1], base + prices.tokens[LZ_LITERAL] + prices.literals[inSymbols[i]],
+					LZ_LITERAL, 1, 0, reps);
+		if (reps[0] <= i && inSymbols[i] == inSymbols[i - reps[0]]) {
+			_relax(&nodes[i + 1], base + prices.tokens[LZ_SHORT_REP], LZ_SHORT_REP, 1, 0, reps);
+		}
+
+		// Rep matches, priced for the recent distances of the path that
+		// reaches this position
+		for (unsigned int r = 0; r < LZ_REPS && max_length >= LZ_MIN_MATCH; r++) {
+			unsigned int const distance = reps[r];
+			int duplicate = 0;
+			for (unsigned int q = 0; q < r; q++) {
+				duplicate |= reps[q] == distance;
+			}
+			if (duplicate || distance > i || distance > inWindow) {
+				continue;
+			}
+			unsigned int const length = _match_length(inSymbols, i, distance, max_length);
+			if (length < LZ_MIN_MATCH) {
+				continue;
+			}
+			moved[0] = distance;
+			memcpy(moved + 1, reps, r * sizeof(unsigned int));
+			memcpy(moved + r + 1, reps + r + 1, (LZ_REPS - 1 - r) * sizeof(unsigned int));
+			unsigned long long const price = base + prices.tokens[LZ_REP + r];
+			for (unsigned int l = LZ_MIN_MATCH; l <= length; l++) {
+				_relax(&nodes[i + l], price + prices.lengths[l - LZ_MIN_MATCH], LZ_REP + r, l, distance, moved);
+			}
+		}
+
+		// New distances, nearest first: each length is only tried at
+		// the nearest distance that reaches it
+		if (max_length >= LZ_MIN_MATCH) {
+			unsigned int const hash = _hash(inSymbols, i);
+			unsigned int best = LZ_MIN_MATCH - 1;
+			unsigned int candidate = heads[hash];
+			for (unsigned int c = 0; candidate && c < LZ_MAX_CHAIN && best < max_length; c++) {
+				unsigned int const distance = i - (candidate - 1);
+				if (distance > inWindow) {
+					break;
+				}
+				candidate = links[candidate - 1];
+				int is_rep = 0;
+				for (unsigned int r = 0; r < LZ_REPS; r++) {
+					is_rep |= reps[r] == distance;
+				}
+				if (is_rep) {
+					continue;
+				}
+				unsigned int const length = _match_length(inSymbols, i, distance, max_length);
+				if (length <= best) {
+					continue;
+				}
+				moved[0] = distance;
+				memcpy(moved + 1, reps, (LZ_REPS - 1) * sizeof(unsigned int));
+				unsigned long long const price = base + prices.tokens[LZ_MATCH]
+							+ _price(previous, LZ_DISTANCES, distance - 1, literal_bits);
+				for (unsigned int l = best + 1; l <= length; l++) {
+					_relax(&nodes[i + l], price + prices.lengths[l - LZ_MIN_MATCH], LZ_MATCH, l, distance, moved);
+				}
+				best = length;
+			}
+			links[i] = heads[hash];
+			heads[hash] = i + 1;
+		}
+	}
+
+	// Walk the cheapest path back from the end, noting where each token
+	// ends, then list the tokens forward
+	unsigned int num_tokens = 0;
+	for (unsigned int i = inSize; i > 0; i -= nodes[i].length) {
+		num_tokens++;
+	}
+	for (int s = 0; s < LZ_STREAM_COUNT; s++) {
+		parse->streams[s] = malloc((num_tokens + 1) * sizeof(unsigned int));
+		if (!parse->streams[s]) {
+			return PXQ_ERROR_MEMORY;
+		}
+	}
+	unsigned int * const tokens = parse->streams[LZ_TOKENS];
+	unsigned int t = num_tokens;
+	for (unsigned int i = inSize; i > 0; i -= nodes[i].length) {
+		tokens[--t] = i;
+	}
+	for (t = 0; t < num_tokens; t++) {
+		struct _lz_node const * const node = &nodes[tokens[t]];
+		unsigned int const start = tokens[t] - node->length;
+		tokens[t] = node->token;
+		parse->token_counts[node->token]++;
+		if (node->token == LZ_LITERAL) {
+			parse->streams[LZ_LITERALS][parse->sizes[LZ_LITERALS]++] = inSymbols[start];
+		} else if (node->token != LZ_SHORT_REP) {
+			parse->streams[LZ_LENGTHS][parse->sizes[LZ_LENGTHS]++] = node->length - LZ_MIN_MATCH;
+		}
+		if (node->token == LZ_MATCH) {
+			parse->streams[LZ_DISTANCES][parse->sizes[LZ_DISTANCES]++] = node->distance - 1;
+		}
+	}
+	parse->sizes[LZ_TOKENS] = num_tokens;
+
+	// Then the coders, plus a bit for each stream that may be empty
+	unsigned int const alphabets[LZ_STREAM_COUNT] = {
+		LZ_TOKEN_COUNT,
+		inNumSymbols,
+		LZ_MAX_MATCH - LZ_MIN_MATCH + 1,
+		inWindow < inSize ? inWindow : inSize,
+	};
+	unsigned long long total = LZ_STREAM_COUNT - 1;
+	for (int s = 0; s < LZ_STREAM_COUNT; s++) {
+		if (parse->sizes[s] == 0) {
+			continue;
+		}
+		unsigned int * const frequencies = calloc(alphabets[s], sizeof(unsigned int));
+		if (!frequencies) {
+			return PXQ_ERROR_MEMORY;
+		}
+		for (unsigned int i = 0; i < parse->sizes[s]; i++) {
+			frequencies[parse->streams[s][i]]++;
+		}
+		unsigned int costs[PXQ_CODER_COUNT];
+		enum pxq_status const status = coder_choose(&parse->coders[s], costs,
+					frequencies, alphabets[s], PXQ_CODER_AUTO);
+		free(frequencies);
+		if (status != PXQ_OK) {
+			return status;
+		}
+		parse->bits[s] = costs[parse->coders[s].coder];
+		total += parse->bits[s];
+	}
+	parse->total_bits = total < ~0U ? (unsigned int)total : ~0U;
+	return PXQ_OK;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __LZ_H__
+#define __LZ_H__
+
+#include "bits.h"
+#include "coder.h"
+#include "pxqueeze.h"
+
+/*
+ * Shortest and longest matches
+ */
+#define LZ_MIN_MATCH 2
+#define LZ_MAX_MATCH 256
+
+/*
+ * Most recent match distances that rep tokens can refer to. Decoders
+ * keep them in a fixed array, most recent first, which starts out as
+ * 1, 2, 3 and 4.
+ */
+#define LZ_REPS 4
+
+/*
+ * Tokens, as in LZMA. A match moves its distance to the front of the
+ * recent distances, a rep with a given index re-uses that distance and
+ * moves it to the front. A short rep is one symbol at the most recent
+ * distance, and leaves the distances alone.
+ */
+enum lz_token {
+	LZ_LITERAL = 0,
+	LZ_MATCH,
+	LZ_SHORT_REP,
+	LZ_REP,		// LZ_REP + index, up to LZ_REP + LZ_REPS - 1
+	LZ_TOKEN_COUNT = LZ_REP + LZ_REPS,
+};
+
+/*
+ * Each kind of information in the tokens goes to its own stream, with
+ * its own coder. Lengths are coded minus LZ_MIN_MATCH, distances minus
+ * one.
+ */
+enum lz_stream {
+	LZ_TOKENS = 0,
+	LZ_LITERALS,
+	LZ_LENGTHS,
+	LZ_DISTANCES,
+	LZ_STREAM_COUNT,
+};
+
+struct lz_parse {
+	unsigned int * streams[LZ_STREAM_COUNT];
+	unsigned int sizes[LZ_STREAM_COUNT];
+	struct stream_coder coders[LZ_STREAM_COUNT];
+	unsigned int bits[LZ_STREAM_COUNT];	// stream header included
+	unsigned int token_counts[LZ_TOKEN_COUNT];
+	unsigned int total_bits;
+};
+
+/*
+ * Parses symbols into tokens, with matches no further back than the
+ * window, which can't be over PXQ_MAX_SYMBOLS since distances are
+ * coded as symbols, and sets up the coders. The parse is optimal for the prices
+ * it's given, which are the code lengths of the coders of a previous
+ * parse, starting from rough estimates: each node of the parse keeps
+ * the recent distances of the path that reaches it the cheapest, so
+ * that rep tokens are priced for what the decoder will actually have.
+ */
+enum pxq_status lz_parse(
+		struct lz_parse * const parse,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		unsigned int const inNumSymbols,
+		unsigned int const inWindow);
+
+/*
+ * RAM that a decoder on the target needs for the coders and the recent
+ * distances, 4 bytes each, in bytes.
+ */
+unsigned int lz_decoder_bytes(struct lz_parse const * const parse);
+
+void lz_write(
+		struct bit_writer * const writer,
+		struct lz_parse const * const parse);
+
+/*
+ * Decodes tokens until exactly outSize symbols have been produced.
+ */
+enum pxq_status lz_read(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const outSize);
+
+void lz_free(struct lz_parse * const parse);
+
+#endif
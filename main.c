@@ -0,0 +1,570 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pxqueeze.h"
+#include "server.h"
+#include "tga.h"
+
+static void _usage(char const * const name) {
+	fprintf(stderr, "Usage: %s [-r max_run] [-l coder] [-v coder] [-m model] [-s tile_size] [-f] [-p predictor] [-b block_size] [-j threads] [-z window] [--ram-budget bytes] [-e] [-t] [-o output] input.tga...\n", name);
+	fprintf(stderr, "       %s -d [-a] [-o output.tga] input\n", name);
+	fprintf(stderr, "       %s [-j workers] --server socket\n", name);
+	fprintf(stderr, "  Several inputs are compressed as a sequence of animation frames,\n");
+	fprintf(stderr, "  which -e, -s, -f, -p, -b and -z don't apply to\n");
+	fprintf(stderr, "  -r max_run  cap RLE runs (default: search for the best cap)\n");
+	fprintf(stderr, "  -l coder    coder for run lengths (default: cheapest)\n");
+	fprintf(stderr, "  -v coder    coder for run values (default: cheapest)\n");
+	fprintf(stderr, "              huffman, gamma, delta, expgolomb or golomb\n");
+	fprintf(stderr, "  -m model    how runs are coded (default: cheapest)\n");
+	fprintf(stderr, "              independent, pairs of a length and a value,\n");
+	fprintf(stderr, "              or context of the previous value\n");
+	fprintf(stderr, "  -s size     cut single images into tiles of 8, 16 or 32 pixels,\n");
+	fprintf(stderr, "              1 for no tiles (default: search for the best size)\n");
+	fprintf(stderr, "  -f          match flipped tiles\n");
+	fprintf(stderr, "  -p pred     predict pixels from their neighbors, in every row\n");
+	fprintf(stderr, "              (default: search, and pick a predictor per row)\n");
+	fprintf(stderr, "              none, left, up, upleft, average or paeth\n");
+	fprintf(stderr, "  -b size     try the BWT, in blocks of up to size pixels\n");
+	fprintf(stderr, "  -j threads  threads for the BWT, or server workers\n");
+	fprintf(stderr, "              (default: one per processor)\n");
+	fprintf(stderr, "  -z window   try LZ, with matches up to window pixels back (at most 65536)\n");
+	fprintf(stderr, "  --ram-budget bytes\n");
+	fprintf(stderr, "              limit the decoder's working RAM, in bytes or with a k suffix\n");
+	fprintf(stderr, "  -e          estimate only, don't produce output\n");
+	fprintf(stderr, "  -t          decompress and verify after compressing\n");
+	fprintf(stderr, "  -o output   write the compressed data to a file\n");
+	fprintf(stderr, "  -d          decompress the input, and write it as a grayscale TGA\n");
+	fprintf(stderr, "  -a          the input to decompress is a sequence, whose frames\n");
+	fprintf(stderr, "              are written one under the other\n");
+	fprintf(stderr, "  --server socket\n");
+	fprintf(stderr, "              serve jobs on a Unix socket, with a worker per thread,\n");
+	fprintf(stderr, "              until SIGINT or SIGTERM\n");
+}
+
+static int _parse_coder(enum pxq_coder * const coder, char const * const name) {
+	static char const * const names[PXQ_CODER_COUNT] = {
+		"auto", "huffman", "gamma", "delta", "expgolomb", "golomb"
+	};
+	for (int c = 0; c < PXQ_CODER_COUNT; c++) {
+		if (!strcmp(name, names[c])) {
+			*coder = (enum pxq_coder)c;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int _parse_bytes(unsigned int * const bytes, char const * const text) {
+	char * end;
+	unsigned long const value = strtoul(text, &end, 0);
+	if (end == text || value == 0 || value > 0x3FFFFF) {
+		return 0;
+	}
+	if (!strcmp(end, "k") || !strcmp(end, "K")) {
+		*bytes = (unsigned int)value * 1024;
+		return 1;
+	}
+	*bytes = (unsigned int)value;
+	return !*end;
+}
+
+static int _parse_model(enum pxq_model * const model, char const * const name) {
+	static char const * const names[PXQ_MODEL_COUNT] = {
+		"auto", "independent", "pairs", "context"
+	};
+	for (int m = 0; m < PXQ_MODEL_COUNT; m++) {
+		if (!strcmp(name, names[m])) {
+			*model = (enum pxq_model)m;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int _parse_predictor(enum pxq_predictor * const predictor, char const * const name) {
+	static char const * const names[PXQ_PREDICTOR_COUNT] = {
+		"auto", "none", "left", "up", "upleft", "average", "paeth"
+	};
+	for (int p = 0; p < PXQ_PREDICTOR_COUNT; p++) {
+		if (!strcmp(name, names[p])) {
+			*predictor = (enum pxq_predictor)p;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void _print_costs(char const * const stream, unsigned int const * const costs) {
+	printf("%s costs:", stream);
+	for (int c = PXQ_CODER_HUFFMAN; c < PXQ_CODER_COUNT; c++) {
+		printf(" %s %u", pxq_coder_string(c), costs[c]);
+	}
+	printf("\n");
+}
+
+static void _print_stream_stats(
+		char const * const stream,
+		struct pxq_stream_stats const * const stats) {
+	printf("%s: RLE cap %u, %u runs, %u bits\n",
+				stream, stats->max_rle_run, stats->num_runs, stats->total_bits);
+	_print_costs("Length", stats->lengths_costs);
+	_print_costs("Value", stats->values_costs);
+	printf("Model costs:");
+	for (int m = PXQ_MODEL_INDEPENDENT; m < PXQ_MODEL_COUNT; m++) {
+		if (stats->model_costs[m] != ~0U) {
+			printf(" %s %u", pxq_model_string(m), stats->model_costs[m]);
+		}
+	}
+	printf("\n");
+	if (stats->model == PXQ_MODEL_PAIRS) {
+		printf("Model: %u pairs, %u escapes, header %u bits, payload %u bits\n",
+					stats->model_symbols, stats->escapes,
+					stats->model_table_bits, stats->model_bits);
+	} else if (stats->model == PXQ_MODEL_CONTEXT) {
+		printf("Model: %u contexts, header %u bits, payload %u bits\n",
+					stats->model_symbols, stats->model_table_bits, stats->model_bits);
+	} else {
+		printf("Model: %s\n", pxq_model_string(stats->model));
+	}
+	// Without escapes, pairs leave no runs to the lengths and values
+	if (stats->model != PXQ_MODEL_PAIRS || stats->escapes) {
+		printf("Lengths: %s, header %u bits, payload %u bits\n",
+					pxq_coder_string(stats->lengths_coder),
+					stats->lengths_table_bits, stats->lengths_bits);
+		printf("Values: %s, header %u bits, payload %u bits\n",
+					pxq_coder_string(stats->values_coder),
+					stats->values_table_bits, stats->values_bits);
+	}
+}
+
+static void _print_stats(struct pxq_stats const * const stats) {
+	printf("Image %ux%u\n", stats->width, stats->height);
+	if (stats->tile_size) {
+		printf("Tiles %ux%u%s, %u unique out of %u\n",
+					stats->tile_size, stats->tile_size,
+					stats->tile_flips ? " with flips" : "",
+					stats->unique_tiles, stats->num_tiles);
+		_print_stream_stats("Tile map", &stats->map);
+	}
+	if (stats->palette_size) {
+		printf("Prediction modulo %u, rows:", stats->palette_size);
+		for (int p = PXQ_PREDICTOR_NONE; p < PXQ_PREDICTOR_COUNT; p++) {
+			printf(" %s %u", pxq_predictor_string(p), stats->predictor_rows[p]);
+		}
+		printf("\n");
+	}
+	if (stats->bwt_blocks) {
+		printf("BWT in %u blocks, largest %u\n", stats->bwt_blocks, stats->bwt_largest_block);
+	}
+	if (stats->lz.window) {
+		struct pxq_lz_stats const * const lz = &stats->lz;
+		printf("%s: LZ window %u, %u bits\n", stats->tile_size ? "Unique tiles" : "Pixels",
+					lz->window, stats->pixels.total_bits);
+		printf("Tokens: %u literals, %u matches, %u short reps, reps %u %u %u %u\n",
+					lz->literals, lz->matches, lz->short_reps,
+					lz->reps[0], lz->reps[1], lz->reps[2], lz->reps[3]);
+		printf("Streams: tokens %u bits, literals %u bits, lengths %u bits, distances %u bits\n",
+					lz->tokens_bits, lz->literals_bits, lz->lengths_bits, lz->distances_bits);
+	} else {
+		_print_stream_stats(stats->tile_size ? "Unique tiles" : "Pixels", &stats->pixels);
+	}
+	printf("Decoder RAM %u bytes: tables %u, tile map %u, tile dictionary %u,"
+				" predictors %u, BWT block %u, move-to-front %u, LZ window %u\n",
+				stats->ram.peak, stats->ram.tables, stats->ram.tile_map,
+				stats->ram.tile_dictionary, stats->ram.predictors,
+				stats->ram.bwt_block, stats->ram.mtf, stats->ram.lz_window);
+	printf("Total output size %u bits (= %u bytes)\n",
+				stats->total_bits, (stats->total_bits + 7) / 8);
+}
+
+static void _print_sequence_stats(
+		struct pxq_stats const * const stats,
+		unsigned int const num_frames) {
+	unsigned int total = 0;
+	for (unsigned int k = 0; k < num_frames; k++) {
+		// Without escapes, pairs leave no runs to the lengths and values
+		struct pxq_stream_stats const * const pixels = &stats[k].pixels;
+		int const coded = pixels->model != PXQ_MODEL_PAIRS || pixels->escapes;
+		printf("Frame %u: RLE cap %u, %u runs, %s, lengths %s, values %s%s, RAM %u bytes, %u bits\n",
+					k, pixels->max_rle_run, pixels->num_runs,
+					pxq_model_string(pixels->model),
+					coded ? pxq_coder_string(pixels->lengths_coder) : "none",
+					coded ? pxq_coder_string(pixels->values_coder) : "none",
+					stats[k].reused_coders ? " (reused)" : "",
+					stats[k].ram.peak,
+					stats[k].total_bits);
+		total += stats[k].total_bits;
+	}
+	printf("Total output size %u bits (= %u bytes)\n", total, (total + 7) / 8);
+}
+
+/*
+ * Reads a whole file into a buffer allocated with malloc
+ */
+static enum pxq_status _read_file(
+		unsigned char ** const outDataP,
+		size_t * const outSizeP,
+		char const * const path) {
+
+	FILE* inputfile = fopen(path, "rb");
+	if (!inputfile) {
+		return PXQ_ERROR_IO;
+	}
+
+	fseek(inputfile, 0, SEEK_END);
+	long const size = ftell(inputfile);
+	fseek(inputfile, 0, SEEK_SET);
+	if (size < 0) {
+		fclose(inputfile);
+		return PXQ_ERROR_IO;
+	}
+
+	unsigned char * data = malloc(size + 1);
+	if (!data) {
+		fclose(inputfile);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	size_t const read = fread(data, 1, size, inputfile);
+	fclose(inputfile);
+	if (read != (size_t)size) {
+		free(data);
+		return PXQ_ERROR_IO;
+	}
+
+	*outDataP = data;
+	*outSizeP = (size_t)size;
+	return PXQ_OK;
+}
+
+/*
+ * Decompresses an image or a sequence, optionally writing it as a TGA
+ * image, with the frames of a sequence one under the other
+ */
+static enum pxq_status _decompress(
+		struct pxq_context * const context,
+		char const * const input_path,
+		char const * const output_path,
+		int const sequence) {
+
+	unsigned char * data;
+	size_t size;
+	enum pxq_status status = _read_file(&data, &size, input_path);
+	if (status != PXQ_OK) {
+		fprintf(stderr, "%s: %s\n", input_path, pxq_status_string(status));
+		return status;
+	}
+
+	unsigned int * pixels;
+	unsigned int num_frames = 1;
+	unsigned int width;
+	unsigned int height;
+	if (sequence) {
+		status = pxq_decompress_sequence(context, &pixels, &num_frames,
+					&width, &height, data, size);
+	} else {
+		status = pxq_decompress(context, &pixels, &width, &height, data, size);
+	}
+	free(data);
+	if (status != PXQ_OK) {
+		fprintf(stderr, "Decompression failed: %s\n", pxq_status_string(status));
+		return status;
+	}
+
+	if (sequence) {
+		printf("Sequence of %u frames %ux%u, from %zu bytes\n", num_frames, width, height, size);
+	} else {
+		printf("Image %ux%u, from %zu bytes\n", width, height, size);
+	}
+	if (output_path) {
+		status = tga_write(output_path, pixels, width, height * num_frames);
+		if (status != PXQ_OK) {
+			fprintf(stderr, "%s: %s\n", output_path, pxq_status_string(status));
+		}
+	}
+	free(pixels);
+	return status;
+}
+
+/*
+ * Compresses frames as a sequence, optionally checking the round trip
+ */
+static enum pxq_status _compress_sequence(
+		struct pxq_context * const context,
+		unsigned char ** const outDataP,
+		size_t * const outSizeP,
+		unsigned int const * const * const frames,
+		unsigned int const num_frames,
+		unsigned int const width,
+		unsigned int const height,
+		struct params const * const params,
+		int const verify) {
+
+	struct pxq_stats * stats = malloc(num_frames * sizeof(struct pxq_stats));
+	if (!stats) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	enum pxq_status status = pxq_compress_sequence(context, outDataP, outSizeP, stats,
+				frames, num_frames, width, height, params);
+	if (status != PXQ_OK) {
+		fprintf(stderr, "Compression failed: %s\n", pxq_status_string(status));
+		free(stats);
+		return status;
+	}
+	_print_sequence_stats(stats, num_frames);
+	free(stats);
+
+	if (!verify) {
+		return PXQ_OK;
+	}
+
+	unsigned int * decompressed;
+	unsigned int decompressed_frames;
+	unsigned int decompressed_width;
+	unsigned int decompressed_height;
+	status = pxq_decompress_sequence(context, &decompressed, &decompressed_frames,
+				&decompressed_width, &decompressed_height, *outDataP, *outSizeP);
+	if (status != PXQ_OK) {
+		fprintf(stderr, "Decompression failed: %s\n", pxq_status_string(status));
+		return status;
+	}
+	if (decompressed_frames != num_frames
+				|| decompressed_width != width || decompressed_height != height) {
+		status = PXQ_ERROR_FORMAT;
+	}
+	for (unsigned int k = 0; k < num_frames && status == PXQ_OK; k++) {
+		if (memcmp(decompressed + (size_t)k * width * height, frames[k],
+					width * height * sizeof(unsigned int))) {
+			status = PXQ_ERROR_FORMAT;
+		}
+	}
+	if (status != PXQ_OK) {
+		fprintf(stderr, "Decompressed sequence doesn't match\n");
+	} else {
+		printf("Decompressed sequence matches\n");
+	}
+	free(decompressed);
+	return status;
+}
+
+int main(int argc, char* argv[]) {
+	struct params params;
+	char const ** input_paths = malloc(argc * sizeof(char const *));
+	unsigned int num_inputs = 0;
+	char const * output_path = NULL;
+	char const * server_path = NULL;
+	int estimate_only = 0;
+	int image_stages = 0;
+	int decompress = 0;
+	int sequence = 0;
+	int verify = 0;
+
+	memset(&params, 0, sizeof(params));
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			params.max_rle_run = (unsigned int)strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-l") && i + 1 < argc
+					&& _parse_coder(&params.lengths_coder, argv[i + 1])) {
+			i++;
+		} else if (!strcmp(argv[i], "-v") && i + 1 < argc
+					&& _parse_coder(&params.values_coder, argv[i + 1])) {
+			i++;
+		} else if (!strcmp(argv[i], "-m") && i + 1 < argc
+					&& _parse_model(&params.model, argv[i + 1])) {
+			i++;
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			params.tile_size = (unsigned int)strtoul(argv[++i], NULL, 0);
+			image_stages = 1;
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc
+					&& _parse_predictor(&params.predictor, argv[i + 1])) {
+			i++;
+			image_stages = 1;
+		} else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			params.bwt_block_size = (unsigned int)strtoul(argv[++i], NULL, 0);
+			image_stages = 1;
+		} else if (!strcmp(argv[i], "-z") && i + 1 < argc) {
+			params.lz_window = (unsigned int)strtoul(argv[++i], NULL, 0);
+			image_stages = 1;
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			params.num_threads = (unsigned int)strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--ram-budget") && i + 1 < argc
+					&& _parse_bytes(&params.ram_budget, argv[i + 1])) {
+			i++;
+		} else if (!strcmp(argv[i], "--server") && i + 1 < argc) {
+			server_path = argv[++i];
+		} else if (!strcmp(argv[i], "-f")) {
+			params.tile_flips = 1;
+			image_stages = 1;
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			output_path = argv[++i];
+		} else if (!strcmp(argv[i], "-d")) {
+			decompress = 1;
+		} else if (!strcmp(argv[i], "-a")) {
+			sequence = 1;
+		} else if (!strcmp(argv[i], "-e")) {
+			estimate_only = 1;
+		} else if (!strcmp(argv[i], "-t")) {
+			verify = 1;
+		} else if (argv[i][0] != '-' && input_paths) {
+			input_paths[num_inputs++] = argv[i];
+		} else {
+			_usage(argv[0]);
+			free(input_paths);
+			return 1;
+		}
+	}
+
+	if (server_path && num_inputs == 0) {
+		free(input_paths);
+		enum pxq_status const status = server_run(server_path, params.num_threads);
+		if (status != PXQ_OK) {
+			fprintf(stderr, "%s: %s\n", server_path, pxq_status_string(status));
+		}
+		return status == PXQ_OK ? 0 : 1;
+	}
+
+	// Sequences are only compressed, with none of the single image stages
+	if (num_inputs == 0 || server_path || (decompress && num_inputs != 1)
+				|| (sequence && !decompress)
+				|| (num_inputs > 1 && (estimate_only || image_stages))) {
+		_usage(argv[0]);
+		free(input_paths);
+		return 1;
+	}
+
+	if (decompress) {
+		struct pxq_context * const context = pxq_create_context();
+		enum pxq_status status = PXQ_ERROR_MEMORY;
+		if (context) {
+			status = _decompress(context, input_paths[0], output_path, sequence);
+		} else {
+			fprintf(stderr, "%s\n", pxq_status_string(status));
+		}
+		pxq_destroy_context(context);
+		free(input_paths);
+		return status == PXQ_OK ? 0 : 1;
+	}
+
+	unsigned int ** frames = calloc(num_inputs, sizeof(unsigned int *));
+	unsigned int width = 0;
+	unsigned int height = 0;
+	enum pxq_status status = frames ? PXQ_OK : PXQ_ERROR_MEMORY;
+	for (unsigned int k = 0; k < num_inputs && status == PXQ_OK; k++) {
+		unsigned int frame_width;
+		unsigned int frame_height;
+		status = tga_read(&frames[k], &frame_width, &frame_height, input_paths[k]);
+		if (status == PXQ_OK && k > 0 && (frame_width != width || frame_height != height)) {
+			status = PXQ_ERROR_PARAMS;
+		}
+		if (status != PXQ_OK) {
+			fprintf(stderr, "%s: %s\n", input_paths[k], pxq_status_string(status));
+		}
+		width = frame_width;
+		height = frame_height;
+	}
+
+	struct pxq_context * context = NULL;
+	if (status == PXQ_OK) {
+		context = pxq_create_context();
+		if (!context) {
+			status = PXQ_ERROR_MEMORY;
+			fprintf(stderr, "%s\n", pxq_status_string(status));
+		}
+	}
+
+	unsigned int * const pixels = frames ? frames[0] : NULL;
+	struct pxq_stats stats;
+	unsigned char * compressed = NULL;
+	size_t compressed_size = 0;
+
+	if (status != PXQ_OK) {
+		goto done;
+	}
+
+	if (num_inputs > 1) {
+		status = _compress_sequence(context, &compressed, &compressed_size,
+					(unsigned int const * const *)frames, num_inputs,
+					width, height, &params, verify);
+		if (status != PXQ_OK) {
+			goto done;
+		}
+	} else if (estimate_only) {
+		status = pxq_estimate(context, &stats, pixels, width, height, &params);
+	} else {
+		status = pxq_compress(context, &compressed, &compressed_size, &stats,
+					pixels, width, height, &params);
+	}
+	if (status != PXQ_OK) {
+		fprintf(stderr, "Compression failed: %s\n", pxq_status_string(status));
+		goto done;
+	}
+
+	if (num_inputs == 1) {
+		_print_stats(&stats);
+	}
+
+	if (verify && compressed && num_inputs == 1) {
+		unsigned int * decompressed;
+		unsigned int decompressed_width;
+		unsigned int decompressed_height;
+		status = pxq_decompress(context, &decompressed,
+					&decompressed_width, &decompressed_height,
+					compressed, compressed_size);
+		if (status != PXQ_OK) {
+			fprintf(stderr, "Decompression failed: %s\n", pxq_status_string(status));
+			goto done;
+		}
+		if (decompressed_width != width || decompressed_height != height
+					|| memcmp(decompressed, pixels, width * height * sizeof(unsigned int))) {
+			fprintf(stderr, "Decompressed image doesn't match\n");
+			status = PXQ_ERROR_FORMAT;
+		} else {
+			printf("Decompressed image matches\n");
+		}
+		free(decompressed);
+	}
+
+	if (output_path && compressed && !estimate_only) {
+		FILE* outputfile = fopen(output_path, "wb");
+		if (!outputfile
+					|| fwrite(compressed, 1, compressed_size, outputfile) != compressed_size) {
+			fprintf(stderr, "%s: %s\n", output_path, pxq_status_string(PXQ_ERROR_IO));
+			status = PXQ_ERROR_IO;
+		}
+		if (outputfile && fclose(outputfile)) {
+			status = PXQ_ERROR_IO;
+		}
+	}
+
+done:
+	free(compressed);
+	for (unsigned int k = 0; frames && k < num_inputs; k++) {
+		free(frames[k]);
+	}
+	free(frames);
+	free(input_paths);
+	pxq_destroy_context(context);
+	return status == PXQ_OK ? 0 : 1;
+}
@@ -0,0 +1,1024 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "model.h"
+#include "universal.h"
+
+/*
+ * Every stream header starts with the model, minus one, in 2 bits
+ */
+#define MODEL_TYPE_BITS 2
+
+/*
+ * Histogram key for two symbols, e.g. a length and a value, or a
+ * previous value and a value. Both are below PXQ_MAX_SYMBOLS.
+ */
+#define MODEL_KEY(high, low) (((high) << 16) | (low))
+
+/*
+ * Previous values that are tried for a context of their own, the most
+ * frequent ones first
+ */
+#define MODEL_MAX_CANDIDATES 64
+
+/*
+* A histogram key with its count
+*/
+struct _model_entry {
+	unsigned int key;
+	unsigned int count;
+};
+
+/*
+* Scratch space for the costs, sized for the distinct keys of a stream
+*/
+struct _model_scratch {
+	unsigned int * keys;
+	unsigned int * counts;
+	unsigned int * symbols;
+	unsigned int * frequencies;
+	unsigned char * lengths;
+	struct _model_entry * entries;
+};
+
+/*
+* Helper function: allocate scratch space for a number of keys
+*/
+static enum pxq_status _alloc_scratch(
+		struct _model_scratch * const scratch,
+		unsigned int const size);
+
+static void _free_scratch(struct _model_scratch * const scratch);
+
+/*
+* Helper function: cost of the cheapest coder (or the forced one) for
+* the keys of a histogram
+*/
+static enum pxq_status _histogram_cost(
+		unsigned int * const outCost,
+		struct histogram const * const histogram,
+		struct _model_scratch * const scratch,
+		enum pxq_coder const forced);
+
+/*
+* Helper function: set up the cheapest coder (or the forced one) for
+* sorted keys and their counts, and return its cost
+*/
+static enum pxq_status _build_coder(
+		struct stream_coder * const coder,
+		unsigned int * const outCost,
+		unsigned int const * const keys,
+		unsigned int const * const counts,
+		unsigned int const count,
+		enum pxq_coder const forced);
+
+/*
+* Helper function: cost of the pairs model with the k most frequent
+* pairs, out of all the entries sorted by decreasing count
+*/
+static enum pxq_status _pairs_cost(
+		unsigned int * const outCost,
+		struct _model_entry const * const entries,
+		unsigned int const k,
+		unsigned int const num_entries,
+		struct _model_scratch * const scratch,
+		struct histogram * const escaped_lengths,
+		struct histogram * const escaped_values,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder);
+
+/*
+* Helper function: set up the cheapest pairs model, with the coders for
+* the escapes, and return its cost
+*/
+static enum pxq_status _build_pairs(
+		struct run_model * const model,
+		struct stream_coder * const lengths,
+		struct stream_coder * const values,
+		unsigned int * const outCost,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder);
+
+/*
+* Helper function: set up the contexts model, with the values coder for
+* the merged contexts, and return the cost of the values
+*/
+static enum pxq_status _build_contexts(
+		struct run_model * const model,
+		struct stream_coder * const values,
+		unsigned int * const outCost,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns,
+		enum pxq_coder const values_coder);
+
+/*
+* Helper function: size of the pairs table in a stream header
+*/
+static unsigned int _pairs_table_bits(
+		unsigned int const * const lengths,
+		unsigned int const * const values,
+		unsigned int const count);
+
+/*
+* Helper function: size of the context values in a stream header
+*/
+static unsigned int _contexts_table_bits(
+		unsigned int const * const values,
+		unsigned int const count);
+
+/*
+* Helper function: symbol of a pair in the pairs coder, which is the
+* escape for pairs that aren't in the table
+*/
+static unsigned int _find_pair(
+		struct run_model const * const model,
+		unsigned int const length,
+		unsigned int const value);
+
+/*
+* Helper function: coder of the values that follow a value
+*/
+static struct stream_coder const * _find_context(
+		struct run_model const * const model,
+		struct stream_coder const * const values,
+		unsigned int const previous);
+
+static unsigned int _saturate(unsigned long long const bits);
+
+static int _compare_counts(void const * const v1, void const * const v2);
+
+static int _compare_entries(void const * const v1, void const * const v2);
+
+static int _compare_keys(void const * const v1, void const * const v2);
+
+enum pxq_status model_choose(
+		struct run_model * const model,
+		struct stream_coder * const lengths,
+		struct stream_coder * const values,
+		unsigned int * const outCosts,
+		unsigned int const lengths_bits,
+		unsigned int const values_bits,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns,
+		enum pxq_model const forced,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder) {
+
+	memset(model, 0, sizeof(struct run_model));
+	model->model = PXQ_MODEL_INDEPENDENT;
+
+	unsigned int costs[PXQ_MODEL_COUNT];
+	costs[PXQ_MODEL_AUTO] = ~0U;
+	costs[PXQ_MODEL_INDEPENDENT] = _saturate((unsigned long long)MODEL_TYPE_BITS
+				+ lengths_bits + values_bits);
+	costs[PXQ_MODEL_PAIRS] = ~0U;
+	costs[PXQ_MODEL_CONTEXT] = ~0U;
+
+	struct run_model pairs;
+	struct stream_coder pairs_lengths;
+	struct stream_coder pairs_values;
+	struct run_model contexts;
+	struct stream_coder contexts_values;
+	memset(&pairs, 0, sizeof(pairs));
+	memset(&pairs_lengths, 0, sizeof(pairs_lengths));
+	memset(&pairs_values, 0, sizeof(pairs_values));
+	memset(&contexts, 0, sizeof(contexts));
+	memset(&contexts_values, 0, sizeof(contexts_values));
+
+	enum pxq_status status = PXQ_OK;
+	if (forced == PXQ_MODEL_AUTO || forced == PXQ_MODEL_PAIRS) {
+		status = _build_pairs(&pairs, &pairs_lengths, &pairs_values, &costs[PXQ_MODEL_PAIRS],
+					inLengths, inValues, inNumRuns, lengths_coder, values_coder);
+	}
+	if (status == PXQ_OK && (forced == PXQ_MODEL_AUTO || forced == PXQ_MODEL_CONTEXT)) {
+		unsigned int context_bits = ~0U;
+		status = _build_contexts(&contexts, &contexts_values, &context_bits,
+					inValues, inNumRuns, values_coder);
+		costs[PXQ_MODEL_CONTEXT] = _saturate((unsigned long long)MODEL_TYPE_BITS
+					+ lengths_bits + context_bits);
+	}
+
+	if (status == PXQ_OK) {
+		// On a tie, prefer the simpler models
+		enum pxq_model best = forced;
+		if (best == PXQ_MODEL_AUTO) {
+			best = PXQ_MODEL_INDEPENDENT;
+			for (enum pxq_model m = PXQ_MODEL_PAIRS; m < PXQ_MODEL_COUNT; m++) {
+				if (costs[m] < costs[best]) {
+					best = m;
+				}
+			}
+		}
+		if (best == PXQ_MODEL_PAIRS) {
+			coder_free(lengths);
+			coder_free(values);
+			*model = pairs;
+			*lengths = pairs_lengths;
+			*values = pairs_values;
+			memset(&pairs, 0, sizeof(pairs));
+			memset(&pairs_lengths, 0, sizeof(pairs_lengths));
+			memset(&pairs_values, 0, sizeof(pairs_values));
+		} else if (best == PXQ_MODEL_CONTEXT) {
+			coder_free(values);
+			*model = contexts;
+			*values = contexts_values;
+			memset(&contexts, 0, sizeof(contexts));
+			memset(&contexts_values, 0, sizeof(contexts_values));
+		}
+		if (outCosts) {
+			memcpy(outCosts, costs, sizeof(costs));
+		}
+	}
+
+	model_free(&pairs);
+	coder_free(&pairs_lengths);
+	coder_free(&pairs_values);
+	model_free(&contexts);
+	coder_free(&contexts_values);
+	return status;
+}
+
+unsigned int model_header_bits(struct run_model const * const model) {
+	unsigned long long bits = MODEL_TYPE_BITS;
+	if (model->model == PXQ_MODEL_PAIRS) {
+		bits += _pairs_table_bits(model->pair_lengths, model->pair_values, model->num_pairs)
+					+ coder_header_bits(&model->pairs) + 1;
+	} else if (model->model == PXQ_MODEL_CONTEXT) {
+		bits += _contexts_table_bits(model->context_values, model->num_contexts);
+		for (unsigned int c = 0; c < model->num_contexts; c++) {
+			bits += coder_header_bits(&model->contexts[c]);
+		}
+	}
+	return _saturate(bits);
+}
+
+void model_payload_bits(
+		unsigned int * const outLengthsBits,
+		unsigned int * const outValuesBits,
+		unsigned int * const outModelBits,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns) {
+
+	unsigned long long lengths_bits = 0;
+	unsigned long long values_bits = 0;
+	unsigned long long model_bits = 0;
+	for (unsigned int i = 0; i < inNumRuns; i++) {
+		if (model->model == PXQ_MODEL_PAIRS) {
+			unsigned int const pair = _find_pair(model, inLengths[i], inValues[i]);
+			model_bits += coder_symbol_bits(&model->pairs, pair);
+			if (pair < model->num_pairs) {
+				continue;
+			}
+		}
+		lengths_bits += coder_symbol_bits(lengths, inLengths[i]);
+		struct stream_coder const * const coder = i > 0
+					? _find_context(model, values, inValues[i - 1]) : values;
+		if (coder == values) {
+			values_bits += coder_symbol_bits(values, inValues[i]);
+		} else {
+			model_bits += coder_symbol_bits(coder, inValues[i]);
+		}
+	}
+
+	*outLengthsBits = _saturate(lengths_bits);
+	*outValuesBits = _saturate(values_bits);
+	*outModelBits = _saturate(model_bits);
+}
+
+unsigned int model_decoder_bytes(
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values) {
+	unsigned int bytes = coder_decoder_bytes(lengths) + coder_decoder_bytes(values);
+	if (model->model == PXQ_MODEL_PAIRS) {
+		unsigned int longest = 0;
+		unsigned int largest = 0;
+		for (unsigned int p = 0; p < model->num_pairs; p++) {
+			longest = model->pair_lengths[p] > longest ? model->pair_lengths[p] : longest;
+			largest = model->pair_values[p] > largest ? model->pair_values[p] : largest;
+		}
+		bytes += coder_decoder_bytes(&model->pairs)
+					+ model->num_pairs * ((longest > 255 ? 2 : 1) + (largest > 255 ? 2 : 1));
+	} else if (model->model == PXQ_MODEL_CONTEXT) {
+		for (unsigned int c = 0; c < model->num_contexts; c++) {
+			bytes += coder_decoder_bytes(&model->contexts[c])
+						+ (model->context_values[c] > 255 ? 2 : 1);
+		}
+	}
+	return bytes;
+}
+
+void model_write_header(
+		struct bit_writer * const writer,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values) {
+	bits_write(writer, model->model - 1, MODEL_TYPE_BITS);
+
+	if (model->model == PXQ_MODEL_PAIRS) {
+		universal_write(writer, PXQ_CODER_GAMMA, 0, model->num_pairs - 1);
+		for (unsigned int p = 0; p < model->num_pairs; p++) {
+			// Lengths go up, values go up for a given length
+			unsigned int const length = model->pair_lengths[p];
+			unsigned int const value = model->pair_values[p];
+			unsigned int const previous = p > 0 ? model->pair_lengths[p - 1] : 0;
+			universal_write(writer, PXQ_CODER_GAMMA, 0, length - previous);
+			universal_write(writer, PXQ_CODER_GAMMA, 0, length == previous
+						? value - model->pair_values[p - 1] - 1 : value);
+		}
+		coder_write_header(writer, &model->pairs);
+		bits_write(writer, model->escapes > 0, 1);
+		if (!model->escapes) {
+			return;
+		}
+	}
+
+	coder_write_header(writer, lengths);
+	coder_write_header(writer, values);
+
+	if (model->model == PXQ_MODEL_CONTEXT) {
+		universal_write(writer, PXQ_CODER_GAMMA, 0, model->num_contexts);
+		for (unsigned int c = 0; c < model->num_contexts; c++) {
+			universal_write(writer, PXQ_CODER_GAMMA, 0, c > 0
+						? model->context_values[c] - model->context_values[c - 1] - 1
+						: model->context_values[c]);
+			coder_write_header(writer, &model->contexts[c]);
+		}
+	}
+}
+
+enum pxq_status model_read_header(
+		struct run_model * const model,
+		struct stream_coder * const lengths,
+		struct stream_coder * const values,
+		struct bit_reader * const reader) {
+
+	memset(model, 0, sizeof(struct run_model));
+	memset(lengths, 0, sizeof(struct stream_coder));
+	memset(values, 0, sizeof(struct stream_coder));
+
+	model->model = bits_read(reader, MODEL_TYPE_BITS) + 1;
+	if (reader->overrun || model->model >= PXQ_MODEL_COUNT) {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	if (model->model == PXQ_MODEL_PAIRS) {
+		unsigned int const num_pairs = universal_read(reader, PXQ_CODER_GAMMA, 0) + 1;
+		if (reader->overrun || num_pairs > MODEL_MAX_PAIRS) {
+			return PXQ_ERROR_FORMAT;
+		}
+		model->pair_lengths = malloc(num_pairs * sizeof(unsigned int));
+		model->pair_values = malloc(num_pairs * sizeof(unsigned int));
+		if (!model->pair_lengths || !model->pair_values) {
+			return PXQ_ERROR_MEMORY;
+		}
+		model->num_pairs = num_pairs;
+		for (unsigned int p = 0; p < num_pairs; p++) {
+			unsigned int const previous = p > 0 ? model->pair_lengths[p - 1] : 0;
+			unsigned long long const length = (unsigned long long)previous
+						+ universal_read(reader, PXQ_CODER_GAMMA, 0);
+			unsigned long long value = universal_read(reader, PXQ_CODER_GAMMA, 0);
+			if (p > 0 && length == previous) {
+				value += model->pair_values[p - 1] + 1ULL;
+			}
+			if (reader->overrun || length == 0 || length >= PXQ_MAX_SYMBOLS
+						|| value >= PXQ_MAX_SYMBOLS) {
+				return PXQ_ERROR_FORMAT;
+			}
+			model->pair_lengths[p] = (unsigned int)length;
+			model->pair_values[p] = (unsigned int)value;
+		}
+		enum pxq_status const status = coder_read_header(&model->pairs, reader);
+		if (status != PXQ_OK) {
+			return status;
+		}
+		model->escapes = bits_read(reader, 1);
+		if (reader->overrun) {
+			return PXQ_ERROR_FORMAT;
+		}
+		if (!model->escapes) {
+			return PXQ_OK;
+		}
+	}
+
+	enum pxq_status status = coder_read_header(lengths, reader);
+	if (status == PXQ_OK) {
+		status = coder_read_header(values, reader);
+	}
+	if (status != PXQ_OK || model->model != PXQ_MODEL_CONTEXT) {
+		return status;
+	}
+
+	unsigned int const num_contexts = universal_read(reader, PXQ_CODER_GAMMA, 0);
+	if (reader->overrun || num_contexts > MODEL_MAX_CONTEXTS) {
+		return PXQ_ERROR_FORMAT;
+	}
+	model->context_values = malloc((num_contexts + 1) * sizeof(unsigned int));
+	model->contexts = calloc(num_contexts + 1, sizeof(struct stream_coder));
+	if (!model->context_values || !model->contexts) {
+		return PXQ_ERROR_MEMORY;
+	}
+	model->num_contexts = num_contexts;
+	for (unsigned int c = 0; c < num_contexts; c++) {
+		unsigned long long value = universal_read(reader, PXQ_CODER_GAMMA, 0);
+		if (c > 0) {
+			value += model->context_values[c - 1] + 1ULL;
+		}
+		if (reader->overrun || value >= PXQ_MAX_SYMBOLS) {
+			return PXQ_ERROR_FORMAT;
+		}
+		model->context_values[c] = (unsigned int)value;
+		status = coder_read_header(&model->contexts[c], reader);
+		if (status != PXQ_OK) {
+			return status;
+		}
+	}
+	return PXQ_OK;
+}
+
+void model_write_runs(
+		struct bit_writer * const writer,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns) {
+	for (unsigned int i = 0; i < inNumRuns; i++) {
+		if (model->model == PXQ_MODEL_PAIRS) {
+			unsigned int const pair = _find_pair(model, inLengths[i], inValues[i]);
+			coder_write_symbol(writer, &model->pairs, pair);
+			if (pair < model->num_pairs) {
+				continue;
+			}
+		}
+		coder_write_symbol(writer, lengths, inLengths[i]);
+		coder_write_symbol(writer, i > 0 ? _find_context(model, values, inValues[i - 1]) : values,
+					inValues[i]);
+	}
+}
+
+enum pxq_status model_read_runs(
+		struct bit_reader * const reader,
+		unsigned int * const outData,
+		unsigned int const outSize,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values) {
+	struct stream_coder const * coder = values;
+	unsigned int write_offset = 0;
+	while (write_offset < outSize) {
+		unsigned int length;
+		unsigned int symbol;
+		unsigned int const pair = model->model == PXQ_MODEL_PAIRS
+					? coder_read_symbol(reader, &model->pairs) : model->num_pairs;
+		if (pair < model->num_pairs) {
+			length = model->pair_lengths[pair];
+			symbol = model->pair_values[pair];
+		} else if (pair > model->num_pairs || (model->model == PXQ_MODEL_PAIRS && !model->escapes)) {
+			return PXQ_ERROR_FORMAT;
+		} else {
+			length = coder_read_symbol(reader, lengths);
+			symbol = coder_read_symbol(reader, coder);
+		}
+		if (reader->overrun || length == 0 || length > outSize - write_offset) {
+			return PXQ_ERROR_FORMAT;
+		}
+		for (unsigned int i = 0; i < length; i++) {
+			outData[write_offset++] = symbol;
+		}
+		coder = _find_context(model, values, symbol);
+	}
+	return PXQ_OK;
+}
+
+void model_free(struct run_model * const model) {
+	free(model->pair_lengths);
+	free(model->pair_values);
+	coder_free(&model->pairs);
+	if (model->contexts) {
+		for (unsigned int c = 0; c < model->num_contexts; c++) {
+			coder_free(&model->contexts[c]);
+		}
+	}
+	free(model->context_values);
+	free(model->contexts);
+	memset(model, 0, sizeof(struct run_model));
+}
+
+static enum pxq_status _alloc_scratch(
+		struct _model_scratch * const scratch,
+		unsigned int const size) {
+	scratch->keys = malloc((size + 1) * sizeof(unsigned int));
+	scratch->counts = malloc((size + 1) * sizeof(unsigned int));
+	scratch->symbols = malloc((size + 1) * sizeof(unsigned int));
+	scratch->frequencies = malloc((size + 1) * sizeof(unsigned int));
+	scratch->lengths = malloc(size + 1);
+	scratch->entries = malloc((size + 1) * sizeof(struct _model_entry));
+	if (!scratch->keys || !scratch->counts || !scratch->symbols || !scratch->frequencies
+				|| !scratch->lengths || !scratch->entries) {
+		return PXQ_ERROR_MEMORY;
+	}
+	return PXQ_OK;
+}
+
+static void _free_scratch(struct _model_scratch * const scratch) {
+	free(scratch->keys);
+	free(scratch->counts);
+	free(scratch->symbols);
+	free(scratch->frequencies);
+	free(scratch->lengths);
+	free(scratch->entries);
+	memset(scratch, 0, sizeof(struct _model_scratch));
+}
+
+static enum pxq_status _histogram_cost(
+		unsigned int * const outCost,
+		struct histogram const * const histogram,
+		struct _model_scratch * const scratch,
+		enum pxq_coder const forced) {
+	unsigned int const count = histogram_sorted(histogram, scratch->keys, scratch->counts);
+	return coder_sparse_cost(outCost, scratch->keys, scratch->counts, count,
+				scratch->lengths, forced);
+}
+
+static enum pxq_status _build_coder(
+		struct stream_coder * const coder,
+		unsigned int * const outCost,
+		unsigned int const * const keys,
+		unsigned int const * const counts,
+		unsigned int const count,
+		enum pxq_coder const forced) {
+	unsigned int const num_frequencies = count > 0 ? keys[count - 1] + 1 : 1;
+	unsigned int * const frequencies = calloc(num_frequencies, sizeof(unsigned int));
+	if (!frequencies) {
+		return PXQ_ERROR_MEMORY;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		frequencies[keys[i]] = counts[i];
+	}
+
+	unsigned int costs[PXQ_CODER_COUNT];
+	enum pxq_status const status = coder_choose(coder, costs, frequencies, num_frequencies, forced);
+	if (status == PXQ_OK) {
+		*outCost = costs[coder->coder];
+	}
+	free(frequencies);
+	return status;
+}
+
+static enum pxq_status _pairs_cost(
+		unsigned int * const outCost,
+		struct _model_entry const * const entries,
+		unsigned int const k,
+		unsigned int const num_entries,
+		struct _model_scratch * const scratch,
+		struct histogram * const escaped_lengths,
+		struct histogram * const escaped_values,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder) {
+
+	// The table lists the kept pairs in key order, which is the order
+	// of their symbols
+	struct _model_entry * const kept = scratch->entries;
+	memcpy(kept, entries, k * sizeof(struct _model_entry));
+	qsort(kept, k, sizeof(struct _model_entry), _compare_entries);
+	for (unsigned int p = 0; p < k; p++) {
+		scratch->symbols[p] = p;
+		scratch->frequencies[p] = kept[p].count;
+		scratch->keys[p] = kept[p].key >> 16;
+		scratch->counts[p] = kept[p].key & 0xFFFF;
+	}
+	unsigned long long cost = MODEL_TYPE_BITS + 1
+				+ _pairs_table_bits(scratch->keys, scratch->counts, k);
+
+	histogram_clear(escaped_lengths);
+	histogram_clear(escaped_values);
+	enum pxq_status status = PXQ_OK;
+	unsigned int escapes = 0;
+	for (unsigned int e = k; e < num_entries && status == PXQ_OK; e++) {
+		escapes += entries[e].count;
+		status = histogram_add(escaped_lengths, entries[e].key >> 16, entries[e].count);
+		if (status == PXQ_OK) {
+			status = histogram_add(escaped_values, entries[e].key & 0xFFFF, entries[e].count);
+		}
+	}
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	unsigned int symbols = k;
+	if (escapes) {
+		scratch->symbols[k] = k;
+		scratch->frequencies[k] = escapes;
+		symbols++;
+	}
+	unsigned int bits;
+	status = coder_sparse_cost(&bits, scratch->symbols, scratch->frequencies, symbols,
+				scratch->lengths, PXQ_CODER_AUTO);
+	cost += bits;
+
+	if (status == PXQ_OK && escapes) {
+		status = _histogram_cost(&bits, escaped_lengths, scratch, lengths_coder);
+		cost += bits;
+		if (status == PXQ_OK) {
+			status = _histogram_cost(&bits, escaped_values, scratch, values_coder);
+			cost += bits;
+		}
+	}
+
+	*outCost = _saturate(cost);
+	return status;
+}
+
+static enum pxq_status _build_pairs(
+		struct run_model * const model,
+		struct stream_coder * const lengths,
+		struct stream_coder * const values,
+		unsigned int * const outCost,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder) {
+
+	memset(model, 0, sizeof(struct run_model));
+	memset(lengths, 0, sizeof(struct stream_coder));
+	memset(values, 0, sizeof(struct stream_coder));
+	model->model = PXQ_MODEL_PAIRS;
+
+	struct histogram pairs;
+	struct histogram escaped_lengths;
+	struct histogram escaped_values;
+	struct _model_scratch scratch;
+	histogram_init(&pairs);
+	histogram_init(&escaped_lengths);
+	histogram_init(&escaped_values);
+	memset(&scratch, 0, sizeof(scratch));
+	struct _model_entry * entries = NULL;
+
+	enum pxq_status status = PXQ_OK;
+	for (unsigned int i = 0; i < inNumRuns && status == PXQ_OK; i++) {
+		status = histogram_add(&pairs, MODEL_KEY(inLengths[i], inValues[i]), 1);
+	}
+	unsigned int const size = pairs.num_entries;
+	if (status == PXQ_OK) {
+		status = _alloc_scratch(&scratch, size);
+	}
+	if (status == PXQ_OK) {
+		entries = malloc((size + 1) * sizeof(struct _model_entry));
+		status = entries ? PXQ_OK : PXQ_ERROR_MEMORY;
+	}
+
+	unsigned int best_cost = ~0U;
+	unsigned int best_k = 0;
+	if (status == PXQ_OK) {
+		histogram_sorted(&pairs, scratch.keys, scratch.counts);
+		for (unsigned int e = 0; e < size; e++) {
+			entries[e].key = scratch.keys[e];
+			entries[e].count = scratch.counts[e];
+		}
+		qsort(entries, size, sizeof(struct _model_entry), _compare_counts);
+
+		// Prune the alphabet to the most frequent pairs: try tables of
+		// 1, 2, 4... pairs, and of all of them if they fit
+		unsigned int const most = size < MODEL_MAX_PAIRS ? size : MODEL_MAX_PAIRS;
+		for (unsigned int k = 1; status == PXQ_OK; k = k * 2 < most ? k * 2 : most) {
+			unsigned int cost = ~0U;
+			status = _pairs_cost(&cost, entries, k, size, &scratch,
+						&escaped_lengths, &escaped_values, lengths_coder, values_coder);
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_k = k;
+			}
+			if (k == most) {
+				break;
+			}
+		}
+	}
+
+	if (status == PXQ_OK) {
+		model->pair_lengths = malloc(best_k * sizeof(unsigned int));
+		model->pair_values = malloc(best_k * sizeof(unsigned int));
+		status = model->pair_lengths && model->pair_values ? PXQ_OK : PXQ_ERROR_MEMORY;
+	}
+	if (status == PXQ_OK) {
+		struct _model_entry * const kept = scratch.entries;
+		memcpy(kept, entries, best_k * sizeof(struct _model_entry));
+		qsort(kept, best_k, sizeof(struct _model_entry), _compare_entries);
+		model->num_pairs = best_k;
+		unsigned int escapes = 0;
+		for (unsigned int e = best_k; e < size; e++) {
+			escapes += entries[e].count;
+		}
+		for (unsigned int p = 0; p < best_k; p++) {
+			model->pair_lengths[p] = kept[p].key >> 16;
+			model->pair_values[p] = kept[p].key & 0xFFFF;
+			scratch.symbols[p] = p;
+			scratch.frequencies[p] = kept[p].count;
+		}
+		scratch.symbols[best_k] = best_k;
+		scratch.frequencies[best_k] = escapes;
+		model->escapes = escapes;
+
+		unsigned int bits;
+		status = _build_coder(&model->pairs, &bits, scratch.symbols, scratch.frequencies,
+					escapes ? best_k + 1 : best_k, PXQ_CODER_AUTO);
+		if (status == PXQ_OK && escapes) {
+			histogram_clear(&escaped_lengths);
+			histogram_clear(&escaped_values);
+			for (unsigned int e = best_k; e < size && status == PXQ_OK; e++) {
+				status = histogram_add(&escaped_lengths, entries[e].key >> 16, entries[e].count);
+				if (status == PXQ_OK) {
+					status = histogram_add(&escaped_values, entries[e].key & 0xFFFF,
+								entries[e].count);
+				}
+			}
+			if (status == PXQ_OK) {
+				unsigned int const count = histogram_sorted(&escaped_lengths,
+							scratch.keys, scratch.counts);
+				status = _build_coder(lengths, &bits, scratch.keys, scratch.counts, count,
+							lengths_coder);
+			}
+			if (status == PXQ_OK) {
+				unsigned int const count = histogram_sorted(&escaped_values,
+							scratch.keys, scratch.counts);
+				status = _build_coder(values, &bits, scratch.keys, scratch.counts, count,
+							values_coder);
+			}
+		}
+		*outCost = best_cost;
+	}
+
+	histogram_free(&pairs);
+	histogram_free(&escaped_lengths);
+	histogram_free(&escaped_values);
+	_free_scratch(&scratch);
+	free(entries);
+	return status;
+}
+
+static enum pxq_status _build_contexts(
+		struct run_model * const model,
+		struct stream_coder * const values,
+		unsigned int * const outCost,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns,
+		enum pxq_coder const values_coder) {
+
+	memset(model, 0, sizeof(struct run_model));
+	memset(values, 0, sizeof(struct stream_coder));
+	model->model = PXQ_MODEL_CONTEXT;
+
+	// Values following each previous value, the previous values on
+	// their own, and all the values, which the merged contexts share
+	struct histogram joint;
+	struct histogram previous;
+	struct histogram shared;
+	struct _model_scratch scratch;
+	histogram_init(&joint);
+	histogram_init(&previous);
+	histogram_init(&shared);
+	memset(&scratch, 0, sizeof(scratch));
+	unsigned int * joint_keys = NULL;
+	unsigned int * joint_counts = NULL;
+
+	enum pxq_status status = PXQ_OK;
+	for (unsigned int i = 0; i < inNumRuns && status == PXQ_OK; i++) {
+		status = histogram_add(&shared, inValues[i], 1);
+		if (status == PXQ_OK && i > 0) {
+			status = histogram_add(&joint, MODEL_KEY(inValues[i - 1], inValues[i]), 1);
+		}
+		if (status == PXQ_OK && i > 0) {
+			status = histogram_add(&previous, inValues[i - 1], 1);
+		}
+	}
+	unsigned int const size = joint.num_entries > shared.num_entries
+				? joint.num_entries : shared.num_entries;
+	if (status == PXQ_OK) {
+		status = _alloc_scratch(&scratch, size);
+	}
+	if (status == PXQ_OK) {
+		joint_keys = malloc((joint.num_entries + 1) * sizeof(unsigned int));
+		joint_counts = malloc((joint.num_entries + 1) * sizeof(unsigned int));
+		status = joint_keys && joint_counts ? PXQ_OK : PXQ_ERROR_MEMORY;
+	}
+
+	unsigned int accepted[MODEL_MAX_CONTEXTS];
+	unsigned int num_accepted = 0;
+	unsigned int shared_cost = 0;
+	if (status == PXQ_OK) {
+		unsigned int const num_joint = histogram_sorted(&joint, joint_keys, joint_counts);
+		unsigned int const num_previous = histogram_sorted(&previous, scratch.keys, scratch.counts);
+		struct _model_entry * const candidates = scratch.entries;
+		for (unsigned int c = 0; c < num_previous; c++) {
+			candidates[c].key = scratch.keys[c];
+			candidates[c].count = scratch.counts[c];
+		}
+		qsort(candidates, num_previous, sizeof(struct _model_entry), _compare_counts);
+		unsigned int const num_candidates = num_previous < MODEL_MAX_CANDIDATES
+					? num_previous : MODEL_MAX_CANDIDATES;
+		status = _histogram_cost(&shared_cost, &shared, &scratch, values_coder);
+
+		// Greedy merging: every context starts merged into the shared
+		// coder, and only gets split out if its own coder pays for
+		// itself in what the shared coder saves
+		for (unsigned int c = 0; c < num_candidates && num_accepted < MODEL_MAX_CONTEXTS
+					&& status == PXQ_OK; c++) {
+			unsigned int const value = candidates[c].key;
+			unsigned int low = 0;
+			unsigned int high = num_joint;
+			while (low < high) {
+				unsigned int const middle = low + (high - low) / 2;
+				if (joint_keys[middle] < MODEL_KEY(value, 0)) {
+					low = middle + 1;
+				} else {
+					high = middle;
+				}
+			}
+			unsigned int count = 0;
+			for (unsigned int j = low; j < num_joint && joint_keys[j] >> 16 == value; j++) {
+				scratch.symbols[count] = joint_keys[j] & 0xFFFF;
+				scratch.frequencies[count] = joint_counts[j];
+				histogram_subtract(&shared, scratch.symbols[count], scratch.frequencies[count]);
+				count++;
+			}
+
+			unsigned int own_cost;
+			unsigned int split_cost;
+			status = coder_sparse_cost(&own_cost, scratch.symbols, scratch.frequencies, count,
+						scratch.lengths, values_coder);
+			if (status == PXQ_OK) {
+				status = _histogram_cost(&split_cost, &shared, &scratch, values_coder);
+			}
+			unsigned long long const cost = (unsigned long long)split_cost + own_cost
+						+ universal_bits(PXQ_CODER_GAMMA, 0, value);
+			if (status == PXQ_OK && cost < shared_cost) {
+				accepted[num_accepted++] = value;
+				shared_cost = split_cost;
+				continue;
+			}
+
+			// Not worth it, merge it back. The subtracted symbols were
+			// in the shared histogram, adding them back can't fail.
+			for (unsigned int j = 0; j < count; j++) {
+				histogram_add(&shared, scratch.symbols[j], scratch.frequencies[j]);
+			}
+		}
+	}
+
+	if (status == PXQ_OK) {
+		qsort(accepted, num_accepted, sizeof(unsigned int), _compare_keys);
+		model->context_values = malloc((num_accepted + 1) * sizeof(unsigned int));
+		model->contexts = calloc(num_accepted + 1, sizeof(struct stream_coder));
+		status = model->context_values && model->contexts ? PXQ_OK : PXQ_ERROR_MEMORY;
+	}
+	if (status == PXQ_OK) {
+		unsigned long long cost = _contexts_table_bits(accepted, num_accepted);
+		unsigned int const num_joint = histogram_sorted(&joint, joint_keys, joint_counts);
+		for (unsigned int c = 0; c < num_accepted && status == PXQ_OK; c++) {
+			unsigned int count = 0;
+			for (unsigned int j = 0; j < num_joint; j++) {
+				if (joint_keys[j] >> 16 == accepted[c]) {
+					scratch.symbols[count] = joint_keys[j] & 0xFFFF;
+					scratch.frequencies[count] = joint_counts[j];
+					count++;
+				}
+			}
+			unsigned int bits;
+			model->context_values[c] = accepted[c];
+			model->num_contexts++;
+			status = _build_coder(&model->contexts[c], &bits, scratch.symbols,
+						scratch.frequencies, count, values_coder);
+			cost += bits;
+		}
+		if (status == PXQ_OK) {
+			unsigned int bits;
+			unsigned int const count = histogram_sorted(&shared, scratch.keys, scratch.counts);
+			status = _build_coder(values, &bits, scratch.keys, scratch.counts, count, values_coder);
+			cost += bits;
+		}
+		*outCost = _saturate(cost);
+	}
+
+	histogram_free(&joint);
+	histogram_free(&previous);
+	histogram_free(&shared);
+	_free_scratch(&scratch);
+	free(joint_keys);
+	free(joint_counts);
+	return status;
+}
+
+static unsigned int _pairs_table_bits(
+		unsigned int const * const lengths,
+		unsigned int const * const values,
+		unsigned int const count) {
+	unsigned long long bits = universal_bits(PXQ_CODER_GAMMA, 0, count - 1);
+	for (unsigned int p = 0; p < count; p++) {
+		unsigned int const previous = p > 0 ? lengths[p - 1] : 0;
+		bits += universal_bits(PXQ_CODER_GAMMA, 0, lengths[p] - previous);
+		bits += universal_bits(PXQ_CODER_GAMMA, 0, lengths[p] == previous
+					? values[p] - values[p - 1] - 1 : values[p]);
+	}
+	return _saturate(bits);
+}
+
+static unsigned int _contexts_table_bits(
+		unsigned int const * const values,
+		unsigned int const count) {
+	unsigned long long bits = universal_bits(PXQ_CODER_GAMMA, 0, count);
+	for (unsigned int c = 0; c < count; c++) {
+		bits += universal_bits(PXQ_CODER_GAMMA, 0, c > 0
+					? values[c] - values[c - 1] - 1 : values[c]);
+	}
+	return _saturate(bits);
+}
+
+static unsigned int _find_pair(
+		struct run_model const * const model,
+		unsigned int const length,
+		unsigned int const value) {
+	unsigned int const key = MODEL_KEY(length, value);
+	unsigned int low = 0;
+	unsigned int high = model->num_pairs;
+	while (low < high) {
+		unsigned int const middle = low + (high - low) / 2;
+		unsigned int const pair = MODEL_KEY(model->pair_lengths[middle],
+					model->pair_values[middle]);
+		if (pair == key) {
+			return middle;
+		}
+		if (pair < key) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return model->num_pairs;
+}
+
+static struct stream_coder const * _find_context(
+		struct run_model const * const model,
+		struct stream_coder const * const values,
+		unsigned int const previous) {
+	for (unsigned int c = 0; c < model->num_contexts; c++) {
+		if (model->context_values[c] == previous) {
+			return &model->contexts[c];
+		}
+	}
+	return values;
+}
+
+static unsigned int _saturate(unsigned long long const bits) {
+	return bits >= ~0U ? ~0U : (unsigned int)bits;
+}
+
+static int _compare_counts(void const * const v1, void const * const v2) {
+	struct _model_entry const * const e1 = (struct _model_entry const *)v1;
+	struct _model_entry const * const e2 = (struct _model_entry const *)v2;
+	if (e1->count != e2->count) {
+		return e1->count > e2->count ? -1 : 1;
+	}
+	return (e1->key > e2->key) - (e1->key < e2->key);
+}
+
+static int _compare_entries(void const * const v1, void const * const v2) {
+	struct _model_entry const * const e1 = (struct _model_entry const *)v1;
+	struct _model_entry const * const e2 = (struct _model_entry const *)v2;
+	return (e1->key > e2->key) - (e1->key < e2->key);
+}
+
+static int _compare_keys(void const * const v1, void const * const v2) {
+	unsigned int const k1 = *(unsigned int const *)v1;
+	unsigned int const k2 = *(unsigned int const *)v2;
+	return (k1 > k2) - (k1 < k2);
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __MODEL_H__
+#define __MODEL_H__
+
+#include "bits.h"
+#include "coder.h"
+#include "pxqueeze.h"
+
+/*
+ * Most pairs in a pairs table, which bounds the decoder's table
+ */
+#define MODEL_MAX_PAIRS 256
+
+/*
+ * Most previous values with a coder of their own
+ */
+#define MODEL_MAX_CONTEXTS 16
+
+/*
+ * How the runs of a stream use its lengths and values coders.
+ *
+ * Pairs code the most frequent combinations of a length and a value as
+ * one symbol, numbered in the order of the table. The symbol after the
+ * last pair is an escape, followed by the length and the value with
+ * their own coders, which only exist if some run escapes.
+ *
+ * Contexts code each value with a coder picked by the value of the
+ * previous run. Frequent previous values get their own coder, all the
+ * others are merged into the values coder, which also codes the first
+ * run.
+ */
+struct run_model {
+	enum pxq_model model;
+	unsigned int num_pairs;
+	unsigned int * pair_lengths;	// sorted by length, then by value
+	unsigned int * pair_values;
+	unsigned int escapes;		// runs that escape, or whether any does once read
+	struct stream_coder pairs;
+	unsigned int num_contexts;
+	unsigned int * context_values;	// sorted
+	struct stream_coder * contexts;
+};
+
+/*
+ * Cost of every model for a stream of runs, given the cost of coding
+ * the lengths and the values independently (stream headers included),
+ * which is what PXQ_MODEL_INDEPENDENT costs. The cheapest model (or the forced one,
+ * unless it's PXQ_MODEL_AUTO) is set up, and the lengths and values
+ * coders are replaced with the ones it uses. Costs include the model
+ * header, and outCosts, indexed by enum pxq_model, may be NULL.
+ */
+enum pxq_status model_choose(
+		struct run_model * const model,
+		struct stream_coder * const lengths,
+		struct stream_coder * const values,
+		unsigned int * const outCosts,
+		unsigned int const lengths_bits,
+		unsigned int const values_bits,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns,
+		enum pxq_model const forced,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder);
+
+/*
+ * Size of the model in a stream header, tables of the pairs and of the
+ * contexts included, not counting the lengths and values coders.
+ */
+unsigned int model_header_bits(struct run_model const * const model);
+
+/*
+ * Payload of the runs, split between the lengths coder, the values
+ * coder, and the pairs or context coders of the model.
+ */
+void model_payload_bits(
+		unsigned int * const outLengthsBits,
+		unsigned int * const outValuesBits,
+		unsigned int * const outModelBits,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns);
+
+/*
+ * RAM that a decoder on the target needs for the model, lengths and
+ * values coders included, in bytes.
+ */
+unsigned int model_decoder_bytes(
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values);
+
+/*
+ * Writes the model and the coders that it uses, then the runs.
+ */
+void model_write_header(
+		struct bit_writer * const writer,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values);
+
+enum pxq_status model_read_header(
+		struct run_model * const model,
+		struct stream_coder * const lengths,
+		struct stream_coder * const values,
+		struct bit_reader * const reader);
+
+void model_write_runs(
+		struct bit_writer * const writer,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values,
+		unsigned int const * const inLengths,
+		unsigned int const * const inValues,
+		unsigned int const inNumRuns);
+
+/*
+ * Decodes runs until exactly outSize symbols have been produced.
+ */
+enum pxq_status model_read_runs(
+		struct bit_reader * const reader,
+		unsigned int * const outData,
+		unsigned int const outSize,
+		struct run_model const * const model,
+		struct stream_coder const * const lengths,
+		struct stream_coder const * const values);
+
+void model_free(struct run_model * const model);
+
+#endif
@@ -17,67 +17,74 @@
 
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-#include <stdio.h>
 #include <stdlib.h>
 
-unsigned int pixmod[64000];
+#include "mtf.h"
 
-unsigned int pixback[64000];
+enum pxq_status mtf_encode(
+		unsigned int * const output,
+		unsigned int const * const input,
+		unsigned int const size,
+		unsigned int const num_symbols) {
 
-void move_to_front(unsigned int* pix) {
-	int maxpix = 0;
-	for (int i = 0; i < 64000; i++) {
-		if (pix[i] > maxpix) {
-			maxpix = pix[i];
-		}
+	unsigned int* values = malloc((num_symbols + 1) * sizeof(unsigned int));
+	if (!values) {
+		return PXQ_ERROR_MEMORY;
 	}
-	printf("Max pixel value: %d\n", maxpix);
-
-	int* values = malloc((maxpix + 1) * sizeof(int));
-	for (int v = 0; v <= maxpix ; v++) {
+	for (unsigned int v = 0; v < num_symbols; v++) {
 		values[v] = v;
 	}
 
-	for (int i = 0; i < 64000; i++) {
-		int c = 0;
-		for (int v = 0 ; v <= maxpix ; v++) {
-			if (pix[i] == values[v]) {
-				if (v > 0) {
-					values[0] = values[v];
-					values[v] = c;
-				}
-				pixmod[i] = v;
-				break;
-			}
-			int cc = values[v];
+	for (unsigned int i = 0; i < size; i++) {
+		unsigned int c = input[i];
+		if (c >= num_symbols) {
+			free(values);
+			return PXQ_ERROR_PARAMS;
+		}
+		// Shift every entry down until the symbol is found
+		unsigned int v = 0;
+		while (values[v] != input[i]) {
+			unsigned int const cc = values[v];
 			values[v] = c;
 			c = cc;
+			v++;
 		}
+		values[v] = c;
+		values[0] = input[i];
+		output[i] = v;
 	}
+
+	free(values);
+	return PXQ_OK;
 }
 
-void back_from_front() {
-	int maxpix = 0;
-	for (int i = 0; i < 64000; i++) {
-		if (pixmod[i] > maxpix) {
-			maxpix = pixmod[i];
-		}
-	}
-	printf("Max offset value: %d\n", maxpix);
+enum pxq_status mtf_decode(
+		unsigned int * const output,
+		unsigned int const * const input,
+		unsigned int const size,
+		unsigned int const num_symbols) {
 
-	int* values = malloc((maxpix + 1) * sizeof(int));
-	for (int v = 0; v <= maxpix ; v++) {
+	unsigned int* values = malloc((num_symbols + 1) * sizeof(unsigned int));
+	if (!values) {
+		return PXQ_ERROR_MEMORY;
+	}
+	for (unsigned int v = 0; v < num_symbols; v++) {
 		values[v] = v;
 	}
 
-	for (int i = 0; i < 64000; i++) {
-		pixback[i] = values[pixmod[i]];
-		if (pixmod[i] > 0) {
-			int c = values[pixmod[i]];
-			for (int v = pixmod[i] - 1; v >= 0; v--) {
-				values[v + 1] = values[v];
-			}
-			values[0] = c;
+	for (unsigned int i = 0; i < size; i++) {
+		if (input[i] >= num_symbols) {
+			free(values);
+			return PXQ_ERROR_FORMAT;
 		}
+		unsigned int const c = values[input[i]];
+		for (unsigned int v = input[i]; v > 0; v--) {
+			values[v] = values[v - 1];
+		}
+		values[0] = c;
+		output[i] = c;
 	}
+
+	free(values);
+	return PXQ_OK;
 }
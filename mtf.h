@@ -0,0 +1,41 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __MTF_H__
+#define __MTF_H__
+
+#include "pxqueeze.h"
+
+/*
+ * Move-to-front transform over symbols 0 to num_symbols - 1. The output
+ * may not alias the input.
+ */
+enum pxq_status mtf_encode(
+	unsigned int * const output,
+	unsigned int const * const input,
+	unsigned int const size,
+	unsigned int const num_symbols);
+
+enum pxq_status mtf_decode(
+	unsigned int * const output,
+	unsigned int const * const input,
+	unsigned int const size,
+	unsigned int const num_symbols);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "predict.h"
+
+/*
+* Helper function: Paeth predictor, the neighbor closest to left + up
+* - up-left
+*/
+static inline unsigned int _paeth(
+		unsigned int const left,
+		unsigned int const up,
+		unsigned int const up_left) {
+	int const estimate = (int)left + (int)up - (int)up_left;
+	int const distance_left = abs(estimate - (int)left);
+	int const distance_up = abs(estimate - (int)up);
+	int const distance_up_left = abs(estimate - (int)up_left);
+	if (distance_left <= distance_up && distance_left <= distance_up_left) {
+		return left;
+	}
+	return distance_up <= distance_up_left ? up : up_left;
+}
+
+/*
+* Helper function: prediction of one pixel
+*/
+static inline unsigned int _predict(
+		unsigned char const predictor,
+		unsigned int const left,
+		unsigned int const up,
+		unsigned int const up_left) {
+	switch (predictor) {
+		case PXQ_PREDICTOR_LEFT:
+			return left;
+		case PXQ_PREDICTOR_UP:
+			return up;
+		case PXQ_PREDICTOR_UP_LEFT:
+			return up_left;
+		case PXQ_PREDICTOR_AVERAGE:
+			return (left + up) / 2;
+		case PXQ_PREDICTOR_PAETH:
+			return _paeth(left, up, up_left);
+	}
+	return 0;
+}
+
+/*
+* Helper function: residuals of one row, given the row above it
+*/
+static void _encode_row(
+		unsigned int * const out,
+		unsigned int const * const row,
+		unsigned int const * const up,
+		unsigned int const width,
+		unsigned int const num_symbols,
+		unsigned char const predictor);
+
+/*
+* Helper function: pixels of one row, given the row above it
+*/
+static void _decode_row(
+		unsigned int * const out,
+		unsigned int const * const residuals,
+		unsigned int const * const up,
+		unsigned int const width,
+		unsigned int const num_symbols,
+		unsigned char const predictor);
+
+enum pxq_status predict_choose(
+		unsigned char * const outPredictors,
+		unsigned int const * const inSymbols,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inNumSymbols) {
+
+	unsigned int * zeroes = calloc(inWidth, sizeof(unsigned int));
+	unsigned int * residuals = malloc(inWidth * sizeof(unsigned int));
+	if (!zeroes || !residuals) {
+		free(zeroes);
+		free(residuals);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	for (unsigned int y = 0; y < inHeight; y++) {
+		unsigned int const * const row = inSymbols + (size_t)y * inWidth;
+		unsigned int const * const up = y ? row - inWidth : zeroes;
+		unsigned long long best_cost = ~0ULL;
+		for (unsigned char p = PXQ_PREDICTOR_NONE; p < PXQ_PREDICTOR_COUNT; p++) {
+			_encode_row(residuals, row, up, inWidth, inNumSymbols, p);
+			// A residual close to the symbol range is a small negative
+			unsigned long long cost = 0;
+			for (unsigned int x = 0; x < inWidth; x++) {
+				unsigned int const r = residuals[x];
+				cost += r < inNumSymbols - r ? r : inNumSymbols - r;
+			}
+			if (cost < best_cost) {
+				best_cost = cost;
+				outPredictors[y] = p;
+			}
+		}
+	}
+
+	free(zeroes);
+	free(residuals);
+	return PXQ_OK;
+}
+
+enum pxq_status predict_encode(
+		unsigned int * const outResiduals,
+		unsigned int const * const inSymbols,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inNumSymbols,
+		unsigned char const * const inPredictors) {
+
+	unsigned int * zeroes = calloc(inWidth, sizeof(unsigned int));
+	if (!zeroes) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	for (unsigned int y = 0; y < inHeight; y++) {
+		unsigned int const * const row = inSymbols + (size_t)y * inWidth;
+		_encode_row(outResiduals + (size_t)y * inWidth, row, y ? row - inWidth : zeroes,
+					inWidth, inNumSymbols, inPredictors[y]);
+	}
+
+	free(zeroes);
+	return PXQ_OK;
+}
+
+enum pxq_status predict_decode(
+		unsigned int * const outSymbols,
+		unsigned int const * const inResiduals,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inNumSymbols,
+		unsigned char const * const inPredictors) {
+
+	unsigned int * zeroes = calloc(inWidth, sizeof(unsigned int));
+	if (!zeroes) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	for (unsigned int y = 0; y < inHeight; y++) {
+		unsigned int * const row = outSymbols + (size_t)y * inWidth;
+		_decode_row(row, inResiduals + (size_t)y * inWidth, y ? row - inWidth : zeroes,
+					inWidth, inNumSymbols, inPredictors[y]);
+	}
+
+	free(zeroes);
+	return PXQ_OK;
+}
+
+static void _encode_row(
+		unsigned int * const out,
+		unsigned int const * const row,
+		unsigned int const * const up,
+		unsigned int const width,
+		unsigned int const num_symbols,
+		unsigned char const predictor) {
+
+	// The whole row is known, such that each predictor is a separate
+	// loop without dependencies between pixels, which vectorizes. The
+	// subtraction modulo the symbol range is a compare and select.
+	unsigned int const first = _predict(predictor, 0, up[0], 0);
+	out[0] = row[0] - first + (row[0] < first ? num_symbols : 0);
+
+	switch (predictor) {
+		case PXQ_PREDICTOR_NONE:
+			memcpy(out + 1, row + 1, (width - 1) * sizeof(unsigned int));
+			break;
+		case PXQ_PREDICTOR_LEFT:
+			for (unsigned int x = 1; x < width; x++) {
+				unsigned int const p = row[x - 1];
+				out[x] = row[x] - p + (row[x] < p ? num_symbols : 0);
+			}
+			break;
+		case PXQ_PREDICTOR_UP:
+			for (unsigned int x = 1; x < width; x++) {
+				unsigned int const p = up[x];
+				out[x] = row[x] - p + (row[x] < p ? num_symbols : 0);
+			}
+			break;
+		case PXQ_PREDICTOR_UP_LEFT:
+			for (unsigned int x = 1; x < width; x++) {
+				unsigned int const p = up[x - 1];
+				out[x] = row[x] - p + (row[x] < p ? num_symbols : 0);
+			}
+			break;
+		case PXQ_PREDICTOR_AVERAGE:
+			for (unsigned int x = 1; x < width; x++) {
+				unsigned int const p = (row[x - 1] + up[x]) / 2;
+				out[x] = row[x] - p + (row[x] < p ? num_symbols : 0);
+			}
+			break;
+		case PXQ_PREDICTOR_PAETH:
+			for (unsigned int x = 1; x < width; x++) {
+				unsigned int const p = _paeth(row[x - 1], up[x], up[x - 1]);
+				out[x] = row[x] - p + (row[x] < p ? num_symbols : 0);
+			}
+			break;
+	}
+}
+
+static void _decode_row(
+		unsigned int * const out,
+		unsigned int const * const residuals,
+		unsigned int const * const up,
+		unsigned int const width,
+		unsigned int const num_symbols,
+		unsigned char const predictor) {
+
+	// Rows that don't depend on pixels to their left vectorize, the
+	// others go one pixel at a time
+	switch (predictor) {
+		case PXQ_PREDICTOR_NONE:
+			memcpy(out, residuals, width * sizeof(unsigned int));
+			return;
+		case PXQ_PREDICTOR_UP:
+			for (unsigned int x = 0; x < width; x++) {
+				unsigned int const sum = residuals[x] + up[x];
+				out[x] = sum - (sum >= num_symbols ? num_symbols : 0);
+			}
+			return;
+		case PXQ_PREDICTOR_UP_LEFT:
+			out[0] = residuals[0];
+			for (unsigned int x = 1; x < width; x++) {
+				unsigned int const sum = residuals[x] + up[x - 1];
+				out[x] = sum - (sum >= num_symbols ? num_symbols : 0);
+			}
+			return;
+	}
+
+	unsigned int left = 0;
+	unsigned int up_left = 0;
+	for (unsigned int x = 0; x < width; x++) {
+		unsigned int const sum = residuals[x] + _predict(predictor, left, up[x], up_left);
+		out[x] = sum - (sum >= num_symbols ? num_symbols : 0);
+		left = out[x];
+		up_left = up[x];
+	}
+}
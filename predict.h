@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __PREDICT_H__
+#define __PREDICT_H__
+
+#include "pxqueeze.h"
+
+/*
+ * The prediction stage turns gradients and dithering into repeated
+ * residuals, which RLE and the entropy coders handle well. Residuals
+ * are differences with the prediction modulo the number of symbols,
+ * such that they stay in the same range as the symbols. Each row has
+ * its own predictor, stored as an enum pxq_predictor.
+ */
+
+/*
+ * Bits to store a predictor, from PXQ_PREDICTOR_NONE
+ */
+#define PREDICT_BITS 3
+
+/*
+ * Picks a predictor for each row, the one with the smallest sum of
+ * absolute residuals.
+ */
+enum pxq_status predict_choose(
+	unsigned char * const outPredictors,
+	unsigned int const * const inSymbols,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	unsigned int const inNumSymbols);
+
+enum pxq_status predict_encode(
+	unsigned int * const outResiduals,
+	unsigned int const * const inSymbols,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	unsigned int const inNumSymbols,
+	unsigned char const * const inPredictors);
+
+enum pxq_status predict_decode(
+	unsigned int * const outSymbols,
+	unsigned int const * const inResiduals,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	unsigned int const inNumSymbols,
+	unsigned char const * const inPredictors);
+
+#endif
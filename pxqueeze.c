@@ -17,32 +17,2124 @@
 
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-#include <stdio.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "bits.h"
+#include "bwt.h"
+#include "coder.h"
+#include "lz.h"
+#include "model.h"
+#include "mtf.h"
+#include "predict.h"
 #include "pxqueeze.h"
 #include "rle.h"
-#include "tga.h"
+#include "tile.h"
+#include "universal.h"
 
-int main(int argc, char* argv[]) {
-	unsigned int * pixels = tga_read();
+/*
+ * Most threads used to transform BWT blocks
+ */
+#define PXQ_MAX_THREADS 64
+
+/*
+ * Scratch buffers for one image or frame, grown as needed
+ */
+struct _pxq_buffers {
+	unsigned int * run_lengths;
+	unsigned int * run_values;
+	unsigned int * residuals;
+	unsigned int capacity;
+};
 
-	unsigned int const * rle_lengths;
-	unsigned int const * rle_values;
+struct pxq_context {
+	// Two sets of buffers, such that the next frame of a sequence can
+	// be analyzed while the current one is encoded
+	struct _pxq_buffers buffers[2];
+};
+
+/*
+ * Everything the encoder needs once the analysis is done
+ */
+struct _pxq_analysis {
+	unsigned int const * run_lengths;
+	unsigned int const * run_values;
 	unsigned int num_runs;
+	struct run_model model;
+	struct stream_coder lengths;
+	struct stream_coder values;
+};
+
+/*
+ * One block of the pixel stream for the BWT. While searching for the
+ * segmentation, blocks only keep their cost, in bits.
+ */
+struct _pxq_block {
+	unsigned int start;
+	unsigned int size;
+	unsigned int primary;
+	unsigned int bits;
+	struct _pxq_buffers buffers;
+	struct _pxq_analysis analysis;
+	struct pxq_stream_stats stats;
+	enum pxq_status status;
+};
+
+/*
+ * Blocks shared between worker threads, each of which transforms the
+ * next block left until there's none
+ */
+struct _pxq_block_pool {
+	pthread_mutex_t mutex;
+	struct _pxq_block * blocks;
+	unsigned int num_blocks;
+	unsigned int next_block;
+	unsigned int const * stream;
+	unsigned int num_symbols;
+	unsigned int max_block_size;
+	struct params const * params;
+	int keep;	// keep each block's runs and coders, to write them
+};
+
+/*
+ * A single image, either coded as one stream of pixels, or cut into
+ * tiles and coded as a stream of unique tiles plus a stream of tile
+ * references. The pixels can be replaced by prediction residuals, with
+ * a predictor per row, and can go through the BWT in blocks, or be LZ
+ * coded instead of run-length encoded.
+ */
+struct _pxq_image {
+	struct tile_index tiles;
+	unsigned char * predictors;
+	unsigned int num_rows;
+	struct _pxq_block * blocks;
+	unsigned int num_blocks;
+	unsigned int num_symbols;	// in the pixel stream
+	struct lz_parse lz;
+	struct _pxq_analysis pixels;
+	struct _pxq_analysis map;
+};
+
+/*
+ * One combination of the optional stages, as tried by the search
+ */
+struct _pxq_config {
+	unsigned int tile_size;		// 1 for no tiling
+	int flips;
+	enum pxq_predictor predictor;	// PXQ_PREDICTOR_AUTO for one per row
+	int bwt;
+	int lz;
+};
+
+/*
+ * One frame of a sequence, analyzed on its own thread
+ */
+struct _pxq_frame_job {
+	struct _pxq_buffers * buffers;
+	unsigned int const * previous;
+	unsigned int const * frame;
+	unsigned int width;
+	unsigned int height;
+	struct params const * params;
+	struct _pxq_analysis analysis;
+	struct pxq_stats stats;
+	enum pxq_status status;
+};
+
+/*
+* Helper function: check the parameters shared by all entry points
+*/
+static enum pxq_status _check_params(
+		struct pxq_context * const context,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct params const * const inParams);
+
+/*
+* Helper function: make sure a set of buffers can hold size symbols
+*/
+static enum pxq_status _reserve(
+		struct _pxq_buffers * const buffers,
+		unsigned int const size);
+
+/*
+* Helper function: release a set of buffers
+*/
+static void _free_buffers(struct _pxq_buffers * const buffers);
+
+/*
+* Helper function: find runs and entropy coders, fill in statistics
+*/
+static enum pxq_status _analyze(
+		struct _pxq_buffers * const buffers,
+		struct _pxq_analysis * const analysis,
+		struct pxq_stream_stats * const stats,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		struct params const * const inParams);
+
+/*
+* Helper function: analyze a stream again with independent lengths and
+* values and the cheapest table-free coders, unless others are forced,
+* for decoders that have no room for tables
+*/
+static enum pxq_status _analyze_table_free(
+		struct _pxq_buffers * const buffers,
+		struct _pxq_analysis * const analysis,
+		struct pxq_stream_stats * const stats,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		struct params const * const inParams);
+
+/*
+* Helper function: analyze an image, searching for the best
+* configuration if needed
+*/
+static enum pxq_status _analyze_image(
+		struct pxq_context * const context,
+		struct _pxq_image * const image,
+		struct pxq_stats * const stats,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct params const * const inParams);
+
+/*
+* Helper function: analyze an image in a given configuration
+*/
+static enum pxq_status _analyze_config(
+		struct pxq_context * const context,
+		struct _pxq_image * const image,
+		struct pxq_stats * const stats,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct _pxq_config const * const inConfig,
+		struct params const * const inParams);
+
+/*
+* Helper function: cut the pixel stream into BWT blocks, picking the
+* cheapest segmentation among candidate boundaries
+*/
+static enum pxq_status _analyze_blocks(
+		struct _pxq_image * const image,
+		struct pxq_stats * const stats,
+		unsigned int const * const inStream,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inNumSymbols,
+		struct params const * const inParams);
+
+/*
+* Helper function: transform the blocks of a pool on worker threads
+*/
+static enum pxq_status _run_block_pool(
+		struct _pxq_block_pool * const pool,
+		struct params const * const inParams);
+
+/*
+* Helper function: thread entry point, transform blocks from a pool
+*/
+static void * _transform_blocks(void * const pool);
+
+/*
+* Helper function: BWT, move-to-front and analysis of one block
+*/
+static enum pxq_status _transform_block(
+		struct _pxq_block * const block,
+		struct _pxq_buffers * const buffers,
+		unsigned int * const transformed,
+		struct _pxq_block_pool const * const pool);
+
+/*
+* Helper function: decoder RAM for the inverse BWT of a block
+*/
+static unsigned int _bwt_bytes(
+		unsigned int const size,
+		unsigned int const num_symbols);
+
+/*
+* Helper function: largest BWT block, up to a maximum, whose inverse
+* fits in the given RAM, 0 if none does
+*/
+static unsigned int _largest_bwt_block(
+		unsigned int const available,
+		unsigned int const num_symbols,
+		unsigned int const max_size);
+
+/*
+* Helper function: decoder RAM of an analyzed image, at its peak
+*/
+static void _ram_usage(
+		struct pxq_ram_stats * const ram,
+		struct _pxq_image const * const image,
+		struct pxq_stats const * const stats);
+
+/*
+* Helper function: size of the header of a BWT block
+*/
+static unsigned int _block_header_bits(unsigned int const size);
+
+/*
+* Helper function: bits to store an index below size
+*/
+static unsigned int _index_bits(unsigned int const size);
+
+/*
+* Helper function: release the coders of a stream analysis
+*/
+static void _free_analysis(struct _pxq_analysis * const analysis);
+
+/*
+* Helper function: release what an image analysis allocated
+*/
+static void _free_image(struct _pxq_image * const image);
+
+/*
+* Helper function: release the BWT blocks of an image analysis
+*/
+static void _free_blocks(struct _pxq_image * const image);
+
+/*
+* Helper function: size of the row predictors, each either a bit set if
+* it's the same as in the previous row, or a clear bit and the predictor
+*/
+static unsigned int _predictors_bits(
+		unsigned char const * const predictors,
+		unsigned int const num_rows);
+
+/*
+* Helper function: write the row predictors
+*/
+static void _write_predictors(
+		struct bit_writer * const writer,
+		unsigned char const * const predictors,
+		unsigned int const num_rows);
+
+/*
+* Helper function: read the row predictors
+*/
+static enum pxq_status _read_predictors(
+		struct bit_reader * const reader,
+		unsigned char * const predictors,
+		unsigned int const num_rows);
+
+/*
+* Helper function: write the stream headers and the runs of a stream
+*/
+static void _write_stream(
+		struct bit_writer * const writer,
+		struct _pxq_analysis const * const analysis);
+
+/*
+* Helper function: read the stream headers and the runs of a stream
+*/
+static enum pxq_status _read_stream(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const inSize);
+
+/*
+* Helper function: read a tile map, count the unique tiles
+*/
+static enum pxq_status _read_map(
+		struct bit_reader * const reader,
+		struct tile_index * const tiles,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inTileSize);
+
+/*
+* Helper function: read BWT blocks, undo the transforms
+*/
+static enum pxq_status _read_blocks(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const inSize);
+
+/*
+* Helper function: read a stream of symbols in whichever form it was
+* written, BWT blocks, LZ tokens or runs
+*/
+static enum pxq_status _read_symbols(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const inSize);
+
+/*
+* Helper function: read the pixel stream, and undo the prediction
+*/
+static enum pxq_status _read_pixels(
+		struct pxq_context * const context,
+		struct bit_reader * const reader,
+		unsigned int * const outPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight);
+
+/*
+* Helper function: choose the coder for a stream of symbols
+*/
+static enum pxq_status _choose_coder(
+		struct stream_coder * const coder,
+		unsigned int * const outBits,
+		unsigned int * const outCosts,
+		unsigned int const * const symbols,
+		unsigned int const size,
+		unsigned int const num_symbols,
+		enum pxq_coder const forced);
+
+/*
+* Helper function: thread entry point, XOR a frame with the previous one
+* and analyze the result
+*/
+static void * _analyze_frame(void * const job);
+
+/*
+* Helper function: payload of a stream with an existing coder, ~0U if
+* that coder can't represent every symbol
+*/
+static unsigned int _payload_bits(
+		struct stream_coder const * const coder,
+		unsigned int const * const symbols,
+		unsigned int const size);
+
+struct pxq_context * pxq_create_context(void) {
+	return calloc(1, sizeof(struct pxq_context));
+}
+
+void pxq_destroy_context(struct pxq_context * const context) {
+	if (context) {
+		for (int i = 0; i < 2; i++) {
+			_free_buffers(&context->buffers[i]);
+		}
+		free(context);
+	}
+}
+
+char const * pxq_status_string(enum pxq_status const status) {
+	switch (status) {
+		case PXQ_OK:
+			return "success";
+		case PXQ_ERROR_MEMORY:
+			return "out of memory";
+		case PXQ_ERROR_PARAMS:
+			return "invalid parameters";
+		case PXQ_ERROR_FORMAT:
+			return "invalid data format";
+		case PXQ_ERROR_IO:
+			return "input/output error";
+		case PXQ_ERROR_BUDGET:
+			return "over the decoder RAM budget";
+	}
+	return "unknown error";
+}
+
+char const * pxq_coder_string(enum pxq_coder const coder) {
+	switch (coder) {
+		case PXQ_CODER_AUTO:
+			return "auto";
+		case PXQ_CODER_HUFFMAN:
+			return "Huffman";
+		case PXQ_CODER_GAMMA:
+			return "Elias gamma";
+		case PXQ_CODER_DELTA:
+			return "Elias delta";
+		case PXQ_CODER_EXP_GOLOMB:
+			return "Exp-Golomb";
+		case PXQ_CODER_GOLOMB:
+			return "Golomb";
+		case PXQ_CODER_COUNT:
+			break;
+	}
+	return "unknown";
+}
+
+char const * pxq_model_string(enum pxq_model const model) {
+	switch (model) {
+		case PXQ_MODEL_AUTO:
+			return "auto";
+		case PXQ_MODEL_INDEPENDENT:
+			return "independent";
+		case PXQ_MODEL_PAIRS:
+			return "pairs";
+		case PXQ_MODEL_CONTEXT:
+			return "order-1 context";
+		case PXQ_MODEL_COUNT:
+			break;
+	}
+	return "unknown";
+}
+
+char const * pxq_predictor_string(enum pxq_predictor const predictor) {
+	switch (predictor) {
+		case PXQ_PREDICTOR_AUTO:
+			return "auto";
+		case PXQ_PREDICTOR_NONE:
+			return "none";
+		case PXQ_PREDICTOR_LEFT:
+			return "left";
+		case PXQ_PREDICTOR_UP:
+			return "up";
+		case PXQ_PREDICTOR_UP_LEFT:
+			return "up-left";
+		case PXQ_PREDICTOR_AVERAGE:
+			return "average";
+		case PXQ_PREDICTOR_PAETH:
+			return "Paeth";
+		case PXQ_PREDICTOR_COUNT:
+			break;
+	}
+	return "unknown";
+}
+
+enum pxq_status pxq_estimate(
+		struct pxq_context * const context,
+		struct pxq_stats * const outStats,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct params const * const inParams) {
+
+	struct _pxq_image image;
+	struct pxq_stats stats;
+
+	if (!outStats) {
+		return PXQ_ERROR_PARAMS;
+	}
+	enum pxq_status status = _check_params(context, inPixels, inWidth, inHeight, inParams);
+	if (status != PXQ_OK) {
+		return status;
+	}
+	status = _analyze_image(context, &image, &stats, inPixels, inWidth, inHeight, inParams);
+	_free_image(&image);
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	*outStats = stats;
+	return PXQ_OK;
+}
+
+/*
+ * Format: width and height in 16 bits each, then the tiling in 2 bits:
+ * 0 for none, then 1 to 3 for tiles of 8, 16 or 32 pixels square.
+ * With tiling, a bit set if tiles can be flipped, then the stream of
+ * tile references in row order. Streams are made of the run model in
+ * 2 bits with its tables, the length and value stream headers, then
+ * the runs.
+ *
+ * The pixels follow, i.e. those of the image, or those of the unique
+ * tiles one after the other. They start with a bit set if they're
+ * predicted, in which case the palette size minus one follows in 16
+ * bits, then the predictor of each row, and the stream is made of
+ * residuals. Then a bit set if the stream goes through the BWT. If it
+ * does, the number of symbols minus one follows in 16 bits, then the
+ * number of blocks minus one as an Elias gamma code, then each block:
+ * its size minus one as an Elias gamma code, its primary index in as
+ * many bits as needed for an index in the block, then the stream of the
+ * move-to-front indices of the transformed block. Otherwise, a bit set
+ * if the pixels are LZ coded: the token stream header follows, then
+ * for the literal, length and distance streams a bit set if the stream
+ * isn't empty, followed by its header, then the tokens. Otherwise, the
+ * stream follows directly.
+ */
+enum pxq_status pxq_compress(
+		struct pxq_context * const context,
+		unsigned char ** const outDataP,
+		size_t * const outSizeP,
+		struct pxq_stats * const outStats,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct params const * const inParams) {
+
+	struct _pxq_image image;
+	struct pxq_stats stats;
+
+	enum pxq_status status = _check_params(context, inPixels, inWidth, inHeight, inParams);
+	if (status != PXQ_OK) {
+		return status;
+	}
+	status = _analyze_image(context, &image, &stats, inPixels, inWidth, inHeight, inParams);
+	if (status != PXQ_OK) {
+		_free_image(&image);
+		return status;
+	}
+
+	struct bit_writer writer;
+	bits_init_writer(&writer);
+
+	bits_write(&writer, inWidth, 16);
+	bits_write(&writer, inHeight, 16);
+	if (stats.tile_size) {
+		unsigned int tiling = 1;
+		while ((4U << tiling) < stats.tile_size) {
+			tiling++;
+		}
+		bits_write(&writer, tiling, 2);
+		bits_write(&writer, stats.tile_flips ? 1 : 0, 1);
+		_write_stream(&writer, &image.map);
+	} else {
+		bits_write(&writer, 0, 2);
+	}
+	bits_write(&writer, image.predictors ? 1 : 0, 1);
+	if (image.predictors) {
+		bits_write(&writer, stats.palette_size - 1, 16);
+		_write_predictors(&writer, image.predictors, image.num_rows);
+	}
+	bits_write(&writer, image.blocks ? 1 : 0, 1);
+	if (image.blocks) {
+		bits_write(&writer, image.num_symbols - 1, 16);
+		universal_write(&writer, PXQ_CODER_GAMMA, 0, image.num_blocks - 1);
+		for (unsigned int b = 0; b < image.num_blocks; b++) {
+			struct _pxq_block const * const block = &image.blocks[b];
+			universal_write(&writer, PXQ_CODER_GAMMA, 0, block->size - 1);
+			bits_write(&writer, block->primary, _index_bits(block->size));
+			_write_stream(&writer, &block->analysis);
+		}
+	} else {
+		bits_write(&writer, stats.lz.window ? 1 : 0, 1);
+		if (stats.lz.window) {
+			lz_write(&writer, &image.lz);
+		} else {
+			_write_stream(&writer, &image.pixels);
+		}
+	}
+
+	_free_image(&image);
+
+	if (writer.failed) {
+		bits_free_writer(&writer);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	*outDataP = writer.data;
+	*outSizeP = (writer.size + 7) / 8;
+	if (outStats) {
+		*outStats = stats;
+	}
+	return PXQ_OK;
+}
+
+enum pxq_status pxq_decompress(
+		struct pxq_context * const context,
+		unsigned int ** const outPixelsP,
+		unsigned int * const outWidth,
+		unsigned int * const outHeight,
+		unsigned char const * const inData,
+		size_t const inSize) {
+
+	if (!context || !inData) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	struct bit_reader reader;
+	bits_init_reader(&reader, inData, inSize);
+
+	unsigned int const width = bits_read(&reader, 16);
+	unsigned int const height = bits_read(&reader, 16);
+	if (reader.overrun || width == 0 || height == 0) {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	unsigned int const tiling = bits_read(&reader, 2);
+	if (reader.overrun) {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	// Tiles are read as an image one tile wide, then drawn
+	unsigned int const tile_size = tiling ? 4U << tiling : 1;
+	if (width % tile_size || height % tile_size) {
+		return PXQ_ERROR_FORMAT;
+	}
+	struct tile_index tiles;
+	memset(&tiles, 0, sizeof(tiles));
+	enum pxq_status status = PXQ_OK;
+	if (tiling) {
+		status = _read_map(&reader, &tiles, width, height, tile_size);
+	}
+
+	unsigned int const stream_width = tiling ? tile_size : width;
+	unsigned int const stream_height = tiling ? tiles.num_unique * tile_size : height;
+	unsigned int* stream = NULL;
+	if (status == PXQ_OK) {
+		stream = malloc((size_t)stream_width * stream_height * sizeof(unsigned int));
+		status = stream ? PXQ_OK : PXQ_ERROR_MEMORY;
+	}
+	if (status == PXQ_OK) {
+		status = _read_pixels(context, &reader, stream, stream_width, stream_height);
+	}
+
+	unsigned int* pixels = stream;
+	if (status == PXQ_OK && tiling) {
+		pixels = malloc((size_t)width * height * sizeof(unsigned int));
+		status = pixels ? tile_expand(pixels, width, height, tile_size, tiles.flips,
+					stream, tiles.num_unique, tiles.map) : PXQ_ERROR_MEMORY;
+		free(stream);
+	}
+	tile_free_index(&tiles);
+
+	if (status != PXQ_OK) {
+		free(pixels);
+		return status;
+	}
+
+	*outPixelsP = pixels;
+	*outWidth = width;
+	*outHeight = height;
+	return PXQ_OK;
+}
+
+/*
+ * Format: width, height and number of frames in 16 bits each, then for
+ * each frame the XOR of its symbols with the previous frame (the first
+ * frame with zeroes), coded like a single image. Every frame but the
+ * first starts with a bit set if it reuses the stream coders of the
+ * previous frame, in which case its stream headers are omitted.
+ *
+ * Frames go through a two-stage pipeline: frame k + 1 is analyzed on a
+ * separate thread while frame k is encoded.
+ */
+enum pxq_status pxq_compress_sequence(
+		struct pxq_context * const context,
+		unsigned char ** const outDataP,
+		size_t * const outSizeP,
+		struct pxq_stats * const outStats,
+		unsigned int const * const * const inFrames,
+		unsigned int const inNumFrames,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct params const * const inParams) {
+
+	if (!inFrames || inNumFrames == 0 || inNumFrames > 65535) {
+		return PXQ_ERROR_PARAMS;
+	}
+	for (unsigned int k = 0; k < inNumFrames; k++) {
+		enum pxq_status status = _check_params(context, inFrames[k], inWidth, inHeight, inParams);
+		if (status != PXQ_OK) {
+			return status;
+		}
+	}
+	// Frames are coded as runs of XOR residuals, which no other stage
+	// applies to
+	if (inParams->tile_size > 1 || inParams->predictor > PXQ_PREDICTOR_NONE
+				|| inParams->bwt_block_size || inParams->lz_window) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	struct _pxq_frame_job jobs[2];
+	memset(jobs, 0, sizeof(jobs));
+	for (int i = 0; i < 2; i++) {
+		jobs[i].buffers = &context->buffers[i];
+		jobs[i].width = inWidth;
+		jobs[i].height = inHeight;
+		jobs[i].params = inParams;
+	}
+
+	struct bit_writer writer;
+	bits_init_writer(&writer);
+	bits_write(&writer, inWidth, 16);
+	bits_write(&writer, inHeight, 16);
+	bits_write(&writer, inNumFrames, 16);
+
+	jobs[0].frame = inFrames[0];
+	_analyze_frame(&jobs[0]);
+	enum pxq_status status = jobs[0].status;
+
+	for (unsigned int k = 0; k < inNumFrames && status == PXQ_OK; k++) {
+		struct _pxq_frame_job * const current = &jobs[k & 1];
+		struct _pxq_frame_job * const next = &jobs[(k + 1) & 1];
+		struct pxq_stats * const stats = &current->stats;
+
+		// The other job still holds the coders of the previous frame:
+		// keep them if they code this frame for less than new headers.
+		// Only independent lengths and values carry over.
+		if (k == 0) {
+			stats->header_bits = 48;
+		} else {
+			stats->header_bits = 1;
+		}
+
+		// A frame over the budget falls back to table-free coders, like
+		// single images do, before it's compared with the coders of the
+		// previous frame, which fit
+		if (inParams->ram_budget && model_decoder_bytes(&current->analysis.model,
+					&current->analysis.lengths, &current->analysis.values)
+					> inParams->ram_budget) {
+			status = _analyze_table_free(current->buffers, &current->analysis, &stats->pixels,
+						current->buffers->residuals, inWidth * inHeight, inParams);
+			if (status != PXQ_OK) {
+				break;
+			}
+		}
+		if (k > 0 && next->analysis.model.model == PXQ_MODEL_INDEPENDENT) {
+			unsigned int const lengths_bits = _payload_bits(&next->analysis.lengths,
+						current->analysis.run_lengths, current->analysis.num_runs);
+			unsigned int const values_bits = _payload_bits(&next->analysis.values,
+						current->analysis.run_values, current->analysis.num_runs);
+			if (lengths_bits != ~0U && values_bits != ~0U
+						&& (unsigned long long)lengths_bits + values_bits
+							<= stats->pixels.total_bits) {
+				_free_analysis(&current->analysis);
+				current->analysis.model.model = PXQ_MODEL_INDEPENDENT;
+				current->analysis.lengths = next->analysis.lengths;
+				current->analysis.values = next->analysis.values;
+				memset(&next->analysis.lengths, 0, sizeof(struct stream_coder));
+				memset(&next->analysis.values, 0, sizeof(struct stream_coder));
+				stats->reused_coders = 1;
+				stats->pixels.lengths_coder = current->analysis.lengths.coder;
+				stats->pixels.values_coder = current->analysis.values.coder;
+				stats->pixels.lengths_table_bits = 0;
+				stats->pixels.values_table_bits = 0;
+				stats->pixels.model = PXQ_MODEL_INDEPENDENT;
+				stats->pixels.model_symbols = 0;
+				stats->pixels.escapes = 0;
+				stats->pixels.model_table_bits = 0;
+				stats->pixels.model_bits = 0;
+				stats->pixels.lengths_bits = lengths_bits;
+				stats->pixels.values_bits = values_bits;
+				stats->pixels.total_bits = lengths_bits + values_bits;
+			}
+		}
+		stats->total_bits = stats->header_bits + stats->pixels.total_bits;
+		_free_analysis(&next->analysis);
+
+		// Frames decode straight into the screen, over the previous one
+		stats->ram.tables = model_decoder_bytes(&current->analysis.model,
+					&current->analysis.lengths, &current->analysis.values);
+		stats->ram.peak = stats->ram.tables;
+		if (inParams->ram_budget && stats->ram.peak > inParams->ram_budget) {
+			status = PXQ_ERROR_BUDGET;
+			break;
+		}
+
+		// Start analyzing the next frame
+		pthread_t thread;
+		int threaded = 0;
+		if (k + 1 < inNumFrames) {
+			next->previous = inFrames[k];
+			next->frame = inFrames[k + 1];
+			threaded = !pthread_create(&thread, NULL, _analyze_frame, next);
+			if (!threaded) {
+				_analyze_frame(next);
+			}
+		}
+
+		// Encode the current frame meanwhile
+		if (k > 0) {
+			bits_write(&writer, stats->reused_coders, 1);
+		}
+		if (stats->reused_coders) {
+			rle_write_runs(&writer,
+						current->analysis.run_lengths,
+						current->analysis.run_values,
+						current->analysis.num_runs,
+						&current->analysis.lengths,
+						&current->analysis.values);
+		} else {
+			_write_stream(&writer, &current->analysis);
+		}
+		if (outStats) {
+			outStats[k] = *stats;
+		}
+
+		if (threaded) {
+			pthread_join(thread, NULL);
+		}
+		if (k + 1 < inNumFrames) {
+			status = next->status;
+		}
+	}
+
+	for (int i = 0; i < 2; i++) {
+		_free_analysis(&jobs[i].analysis);
+	}
+
+	if (status == PXQ_OK && writer.failed) {
+		status = PXQ_ERROR_MEMORY;
+	}
+	if (status != PXQ_OK) {
+		bits_free_writer(&writer);
+		return status;
+	}
+
+	*outDataP = writer.data;
+	*outSizeP = (writer.size + 7) / 8;
+	return PXQ_OK;
+}
+
+enum pxq_status pxq_decompress_sequence(
+		struct pxq_context * const context,
+		unsigned int ** const outFramesP,
+		unsigned int * const outNumFrames,
+		unsigned int * const outWidth,
+		unsigned int * const outHeight,
+		unsigned char const * const inData,
+		size_t const inSize) {
+
+	if (!context || !inData) {
+		return PXQ_ERROR_PARAMS;
+	}
 
-	rle_find_runs(&rle_lengths, &rle_values, &num_runs, pixels, 64000, 100);
+	struct bit_reader reader;
+	bits_init_reader(&reader, inData, inSize);
 
-	free((void*)pixels);
+	unsigned int const width = bits_read(&reader, 16);
+	unsigned int const height = bits_read(&reader, 16);
+	unsigned int const num_frames = bits_read(&reader, 16);
+	if (reader.overrun || width == 0 || height == 0 || num_frames == 0) {
+		return PXQ_ERROR_FORMAT;
+	}
 
-	char const * flat_bitstream;
-	rle_flat_table(&flat_bitstream, rle_lengths, rle_values, num_runs);
+	unsigned int const size = width * height;
+	unsigned int* frames = malloc((size_t)num_frames * size * sizeof(unsigned int));
+	enum pxq_status status = frames ? _reserve(&context->buffers[0], size) : PXQ_ERROR_MEMORY;
 
-	rle_naive_process_runs(rle_lengths, rle_values, num_runs);
+	struct run_model model;
+	struct stream_coder lengths;
+	struct stream_coder values;
+	memset(&model, 0, sizeof(model));
+	memset(&lengths, 0, sizeof(lengths));
+	memset(&values, 0, sizeof(values));
 
-	free((void*)rle_lengths);
-	free((void*)rle_values);
+	for (unsigned int k = 0; k < num_frames && status == PXQ_OK; k++) {
+		if (k == 0 || !bits_read(&reader, 1)) {
+			model_free(&model);
+			coder_free(&lengths);
+			coder_free(&values);
+			status = model_read_header(&model, &lengths, &values, &reader);
+			if (status != PXQ_OK) {
+				break;
+			}
+		}
+
+		unsigned int * const residuals = context->buffers[0].residuals;
+		status = model_read_runs(&reader, residuals, size, &model, &lengths, &values);
+
+		unsigned int * const frame = frames + (size_t)k * size;
+		if (k == 0) {
+			memcpy(frame, residuals, size * sizeof(unsigned int));
+		} else {
+			unsigned int const * const previous = frame - size;
+			for (unsigned int i = 0; i < size; i++) {
+				frame[i] = previous[i] ^ residuals[i];
+			}
+		}
+	}
+
+	model_free(&model);
+	coder_free(&lengths);
+	coder_free(&values);
+
+	if (status != PXQ_OK) {
+		free(frames);
+		return status;
+	}
+
+	*outFramesP = frames;
+	*outNumFrames = num_frames;
+	*outWidth = width;
+	*outHeight = height;
+	return PXQ_OK;
+}
+
+static enum pxq_status _check_params(
+		struct pxq_context * const context,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct params const * const inParams) {
+
+	if (!context || !inPixels || !inParams
+				|| inWidth == 0 || inWidth > 65535
+				|| inHeight == 0 || inHeight > 65535
+				|| inParams->lengths_coder >= PXQ_CODER_COUNT
+				|| inParams->values_coder >= PXQ_CODER_COUNT
+				|| inParams->model >= PXQ_MODEL_COUNT
+				|| inParams->predictor >= PXQ_PREDICTOR_COUNT) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	unsigned int const tile_size = inParams->tile_size;
+	if (tile_size > 1 && ((tile_size != 8 && tile_size != 16 && tile_size != 32)
+				|| inWidth % tile_size || inHeight % tile_size)) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	unsigned int const size = inWidth * inHeight;
+	for (unsigned int i = 0; i < size; i++) {
+		if (inPixels[i] >= PXQ_MAX_SYMBOLS) {
+			return PXQ_ERROR_PARAMS;
+		}
+	}
+
+	return PXQ_OK;
+}
+
+static enum pxq_status _reserve(
+		struct _pxq_buffers * const buffers,
+		unsigned int const size) {
+
+	if (size <= buffers->capacity) {
+		return PXQ_OK;
+	}
+
+	unsigned int ** const arrays[] = {
+		&buffers->run_lengths,
+		&buffers->run_values,
+		&buffers->residuals,
+	};
+	for (unsigned int i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+		unsigned int * array = realloc(*arrays[i], size * sizeof(unsigned int));
+		if (!array) {
+			return PXQ_ERROR_MEMORY;
+		}
+		*arrays[i] = array;
+	}
+
+	buffers->capacity = size;
+	return PXQ_OK;
+}
+
+static void _free_buffers(struct _pxq_buffers * const buffers) {
+	free(buffers->run_lengths);
+	free(buffers->run_values);
+	free(buffers->residuals);
+	memset(buffers, 0, sizeof(struct _pxq_buffers));
+}
+
+static enum pxq_status _analyze(
+		struct _pxq_buffers * const buffers,
+		struct _pxq_analysis * const analysis,
+		struct pxq_stream_stats * const stats,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		struct params const * const inParams) {
+
+	memset(analysis, 0, sizeof(struct _pxq_analysis));
+
+	// Runs can't be longer than the stream, nor than the symbol range
+	unsigned int max_run = inParams->max_rle_run;
+	unsigned int const limit = inSize < PXQ_MAX_SYMBOLS - 1 ? inSize : PXQ_MAX_SYMBOLS - 1;
+	if (max_run == 0) {
+		unsigned int cost;
+		enum pxq_status status = rle_find_best_max_run(&max_run, &cost, inSymbols, inSize, limit,
+					inParams->lengths_coder, inParams->values_coder);
+		if (status != PXQ_OK) {
+			return status;
+		}
+	} else if (max_run > limit) {
+		max_run = limit;
+	}
+
+	enum pxq_status status = _reserve(buffers, inSize);
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	memset(stats, 0, sizeof(struct pxq_stream_stats));
+	stats->max_rle_run = max_run;
+
+	analysis->run_lengths = buffers->run_lengths;
+	analysis->run_values = buffers->run_values;
+	analysis->num_runs = rle_find_runs(buffers->run_lengths, buffers->run_values,
+				inSymbols, inSize, max_run);
+	stats->num_runs = analysis->num_runs;
+
+	status = _choose_coder(&analysis->lengths, &stats->lengths_bits, stats->lengths_costs,
+				analysis->run_lengths, analysis->num_runs, max_run + 1,
+				inParams->lengths_coder);
+	if (status != PXQ_OK) {
+		coder_free(&analysis->lengths);
+		return status;
+	}
+	unsigned int num_values = 0;
+	for (unsigned int i = 0; i < analysis->num_runs; i++) {
+		if (analysis->run_values[i] >= num_values) {
+			num_values = analysis->run_values[i] + 1;
+		}
+	}
+	status = _choose_coder(&analysis->values, &stats->values_bits, stats->values_costs,
+				analysis->run_values, analysis->num_runs, num_values,
+				inParams->values_coder);
+	if (status != PXQ_OK) {
+		coder_free(&analysis->lengths);
+		coder_free(&analysis->values);
+		return status;
+	}
+
+	status = model_choose(&analysis->model, &analysis->lengths, &analysis->values,
+				stats->model_costs,
+				stats->lengths_costs[analysis->lengths.coder],
+				stats->values_costs[analysis->values.coder],
+				analysis->run_lengths, analysis->run_values, analysis->num_runs,
+				inParams->model, inParams->lengths_coder, inParams->values_coder);
+	if (status != PXQ_OK) {
+		_free_analysis(analysis);
+		return status;
+	}
+
+	struct run_model const * const model = &analysis->model;
+	stats->model = model->model;
+	stats->model_symbols = model->model == PXQ_MODEL_PAIRS ? model->num_pairs : model->num_contexts;
+	stats->model_table_bits = model_header_bits(model);
+	model_payload_bits(&stats->lengths_bits, &stats->values_bits, &stats->model_bits,
+				model, &analysis->lengths, &analysis->values,
+				analysis->run_lengths, analysis->run_values, analysis->num_runs);
+	stats->escapes = model->escapes;
+	stats->lengths_coder = analysis->lengths.coder;
+	stats->values_coder = analysis->values.coder;
+	stats->lengths_table_bits = coder_header_bits(&analysis->lengths);
+	stats->values_table_bits = coder_header_bits(&analysis->values);
+	stats->total_bits = stats->model_table_bits + stats->model_bits
+				+ stats->lengths_table_bits + stats->lengths_bits
+				+ stats->values_table_bits + stats->values_bits;
+
+	return PXQ_OK;
+}
+
+static enum pxq_status _analyze_table_free(
+		struct _pxq_buffers * const buffers,
+		struct _pxq_analysis * const analysis,
+		struct pxq_stream_stats * const stats,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		struct params const * const inParams) {
+
+	// The costs of the first analysis are those of independent lengths
+	// and values, with the cap it picked, which is close enough to pick
+	// the coders. The cap is searched again for them.
+	struct params table_free = *inParams;
+	table_free.model = PXQ_MODEL_INDEPENDENT;
+	for (int c = PXQ_CODER_GAMMA; c < PXQ_CODER_COUNT; c++) {
+		if (!inParams->lengths_coder && (table_free.lengths_coder == PXQ_CODER_AUTO
+					|| stats->lengths_costs[c] < stats->lengths_costs[table_free.lengths_coder])) {
+			table_free.lengths_coder = (enum pxq_coder)c;
+		}
+		if (!inParams->values_coder && (table_free.values_coder == PXQ_CODER_AUTO
+					|| stats->values_costs[c] < stats->values_costs[table_free.values_coder])) {
+			table_free.values_coder = (enum pxq_coder)c;
+		}
+	}
+
+	_free_analysis(analysis);
+	return _analyze(buffers, analysis, stats, inSymbols, inSize, &table_free);
+}
+
+static enum pxq_status _analyze_image(
+		struct pxq_context * const context,
+		struct _pxq_image * const image,
+		struct pxq_stats * const stats,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct params const * const inParams) {
+
+	// Every combination of tile sizes that divide the image, of flips
+	// when allowed, of prediction or not, and of BWT, LZ or neither
+	// when allowed. Flips make more tiles match, but spread the
+	// references over four times as many symbols, so they're only
+	// tried, not forced, and the same goes for the BWT and LZ.
+	static unsigned int const tile_sizes[] = { 1, 8, 16 };
+	static enum pxq_predictor const predictors[] = { PXQ_PREDICTOR_NONE, PXQ_PREDICTOR_AUTO };
+	struct _pxq_config candidates[36];
+	unsigned int num_candidates = 0;
+	for (unsigned int i = 0; i < sizeof(tile_sizes) / sizeof(tile_sizes[0]); i++) {
+		unsigned int const tile_size = inParams->tile_size ? inParams->tile_size : tile_sizes[i];
+		if (inWidth % tile_size || inHeight % tile_size) {
+			continue;
+		}
+		for (int flips = 0; flips <= (tile_size > 1 && inParams->tile_flips); flips++) {
+			for (unsigned int p = 0; p < sizeof(predictors) / sizeof(predictors[0]); p++) {
+				for (int transform = 0; transform < 3; transform++) {
+					if ((transform == 1 && !inParams->bwt_block_size)
+								|| (transform == 2 && !inParams->lz_window)) {
+						continue;
+					}
+					candidates[num_candidates].tile_size = tile_size;
+					candidates[num_candidates].flips = flips;
+					candidates[num_candidates].predictor = inParams->predictor
+								? inParams->predictor : predictors[p];
+					candidates[num_candidates].bwt = transform == 1;
+					candidates[num_candidates].lz = transform == 2;
+					num_candidates++;
+				}
+				if (inParams->predictor) {
+					break;
+				}
+			}
+		}
+		if (inParams->tile_size) {
+			break;
+		}
+	}
+
+	// Try them all, then redo the analysis of the cheapest one. When
+	// none fits, the budget is to blame if any was only over budget.
+	unsigned int best = 0;
+	unsigned int best_bits = ~0U;
+	enum pxq_status failure = PXQ_ERROR_PARAMS;
+	for (unsigned int c = 0; c < num_candidates && num_candidates > 1; c++) {
+		enum pxq_status status = _analyze_config(context, image, stats,
+					inPixels, inWidth, inHeight, &candidates[c], inParams);
+		_free_image(image);
+		if (status == PXQ_ERROR_PARAMS || status == PXQ_ERROR_BUDGET) {
+			if (status == PXQ_ERROR_BUDGET) {
+				failure = status;
+			}
+			continue;
+		}
+		if (status != PXQ_OK) {
+			return status;
+		}
+		if (stats->total_bits < best_bits) {
+			best_bits = stats->total_bits;
+			best = c;
+		}
+	}
+	if (num_candidates > 1 && best_bits == ~0U) {
+		memset(image, 0, sizeof(struct _pxq_image));
+		return failure;
+	}
+
+	return _analyze_config(context, image, stats,
+				inPixels, inWidth, inHeight, &candidates[best], inParams);
+}
+
+static enum pxq_status _analyze_config(
+		struct pxq_context * const context,
+		struct _pxq_image * const image,
+		struct pxq_stats * const stats,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		struct _pxq_config const * const inConfig,
+		struct params const * const inParams) {
+
+	memset(image, 0, sizeof(struct _pxq_image));
+	memset(stats, 0, sizeof(struct pxq_stats));
+	stats->width = inWidth;
+	stats->height = inHeight;
+	stats->header_bits = 36;
+
+	// The pixel stream, seen as an image for the prediction
+	unsigned int const * stream = inPixels;
+	unsigned int stream_width = inWidth;
+	unsigned int stream_height = inHeight;
+	enum pxq_status status;
+
+	if (inConfig->tile_size > 1) {
+		status = tile_build_index(&image->tiles, inPixels, inWidth, inHeight,
+					inConfig->tile_size, inConfig->flips);
+		if (status != PXQ_OK) {
+			return status;
+		}
+
+		// The references must fit in the symbol range, which fails on
+		// images with too little repetition to be worth tiling
+		unsigned int const num_unique = image->tiles.num_unique;
+		if ((inConfig->flips ? (unsigned long long)num_unique << TILE_FLIP_BITS : num_unique)
+					> PXQ_MAX_SYMBOLS) {
+			return PXQ_ERROR_PARAMS;
+		}
+
+		stats->header_bits++;
+		stats->tile_size = inConfig->tile_size;
+		stats->tile_flips = inConfig->flips;
+		stats->num_tiles = image->tiles.tiles_x * image->tiles.tiles_y;
+		stats->unique_tiles = num_unique;
+
+		// Both streams are alive at once, each in its own set of buffers
+		status = _analyze(&context->buffers[1], &image->map, &stats->map,
+					image->tiles.map, stats->num_tiles, inParams);
+		if (status != PXQ_OK) {
+			return status;
+		}
+
+		// Unique tiles are stored one after the other, each in row
+		// order, which is an image one tile wide
+		stream = image->tiles.unique;
+		stream_width = inConfig->tile_size;
+		stream_height = num_unique * inConfig->tile_size;
+	}
+
+	unsigned int const size = stream_width * stream_height;
+	unsigned int palette_size = 0;
+	for (unsigned int i = 0; i < size; i++) {
+		if (stream[i] >= palette_size) {
+			palette_size = stream[i] + 1;
+		}
+	}
+	image->num_symbols = palette_size;
+
+	if (inConfig->predictor != PXQ_PREDICTOR_NONE) {
+		image->predictors = malloc(stream_height);
+		status = image->predictors ? PXQ_OK : PXQ_ERROR_MEMORY;
+		if (status == PXQ_OK && inConfig->predictor == PXQ_PREDICTOR_AUTO) {
+			status = predict_choose(image->predictors, stream,
+						stream_width, stream_height, palette_size);
+		} else if (status == PXQ_OK) {
+			memset(image->predictors, inConfig->predictor, stream_height);
+		}
+		if (status == PXQ_OK) {
+			status = _reserve(&context->buffers[0], size);
+		}
+		if (status == PXQ_OK) {
+			status = predict_encode(context->buffers[0].residuals, stream,
+						stream_width, stream_height, palette_size, image->predictors);
+		}
+		if (status != PXQ_OK) {
+			return status;
+		}
+
+		stats->palette_size = palette_size;
+		stats->header_bits += 16 + _predictors_bits(image->predictors, stream_height);
+		for (unsigned int y = 0; y < stream_height; y++) {
+			stats->predictor_rows[image->predictors[y]]++;
+		}
+		image->num_rows = stream_height;
+		stream = context->buffers[0].residuals;
+	}
+
+	if (inConfig->bwt) {
+		// Within a RAM budget, blocks shrink to fit what the other
+		// stages leave. The entropy tables are only known once the
+		// blocks are analyzed: if they don't fit, blocks shrink some
+		// more and the analysis starts over.
+		struct params reshaped = *inParams;
+		unsigned int const header_bits = stats->header_bits;
+		unsigned int available = 0;
+		if (inParams->ram_budget) {
+			_ram_usage(&stats->ram, image, stats);
+			unsigned long long const used = (unsigned long long)stats->ram.peak
+						+ palette_size * (palette_size > 256 ? 2 : 1);
+			available = used < inParams->ram_budget ? inParams->ram_budget - used : 0;
+		}
+		for (int attempt = 0; ; attempt++) {
+			if (inParams->ram_budget) {
+				reshaped.bwt_block_size = _largest_bwt_block(available, palette_size,
+							inParams->bwt_block_size);
+				if (reshaped.bwt_block_size == 0 || attempt == 4) {
+					return PXQ_ERROR_BUDGET;
+				}
+			}
+			stats->header_bits = header_bits;
+			status = _analyze_blocks(image, stats, stream, stream_width, stream_height,
+						palette_size, &reshaped);
+			if (status != PXQ_OK || !inParams->ram_budget) {
+				break;
+			}
+			_ram_usage(&stats->ram, image, stats);
+			if (stats->ram.peak <= inParams->ram_budget) {
+				break;
+			}
+			available = available > stats->ram.tables ? available - stats->ram.tables : 0;
+			_free_blocks(image);
+		}
+	} else if (inConfig->lz) {
+		// Predicted pixels are decoded from the residuals, which the
+		// decoder has to keep as far back as matches go. Otherwise,
+		// matches copy straight from what's already decoded. Distances
+		// are symbols of their own coder, so the window can't go past
+		// the symbol range. Within a RAM budget, the window shrinks
+		// like BWT blocks do.
+		unsigned int const symbol_bytes = palette_size > 256 ? 2 : 1;
+		unsigned int window = inParams->lz_window < size ? inParams->lz_window : size;
+		if (window > PXQ_MAX_SYMBOLS) {
+			window = PXQ_MAX_SYMBOLS;
+		}
+		unsigned int available = ~0U;
+		if (inParams->ram_budget && image->predictors) {
+			_ram_usage(&stats->ram, image, stats);
+			available = stats->ram.peak < inParams->ram_budget
+						? (inParams->ram_budget - stats->ram.peak) / symbol_bytes : 0;
+		}
+		stats->header_bits++;
+		for (int attempt = 0; ; attempt++) {
+			window = window < available ? window : available;
+			if (window == 0 || attempt == 4) {
+				return PXQ_ERROR_BUDGET;
+			}
+			status = lz_parse(&image->lz, stream, size, palette_size, window);
+			if (status != PXQ_OK || !inParams->ram_budget) {
+				break;
+			}
+			stats->lz.window = window;
+			_ram_usage(&stats->ram, image, stats);
+			if (stats->ram.peak <= inParams->ram_budget) {
+				break;
+			}
+			unsigned int const overflow = (stats->ram.peak - inParams->ram_budget
+						+ symbol_bytes - 1) / symbol_bytes;
+			available = window > overflow ? window - overflow : 0;
+			lz_free(&image->lz);
+		}
+		if (status != PXQ_OK) {
+			return status;
+		}
+
+		struct lz_parse const * const lz = &image->lz;
+		stats->lz.window = window;
+		stats->lz.literals = lz->token_counts[LZ_LITERAL];
+		stats->lz.matches = lz->token_counts[LZ_MATCH];
+		stats->lz.short_reps = lz->token_counts[LZ_SHORT_REP];
+		for (unsigned int r = 0; r < LZ_REPS; r++) {
+			stats->lz.reps[r] = lz->token_counts[LZ_REP + r];
+		}
+		stats->lz.tokens_bits = lz->bits[LZ_TOKENS];
+		stats->lz.literals_bits = lz->bits[LZ_LITERALS];
+		stats->lz.lengths_bits = lz->bits[LZ_LENGTHS];
+		stats->lz.distances_bits = lz->bits[LZ_DISTANCES];
+		stats->pixels.total_bits = lz->total_bits;
+	} else {
+		stats->header_bits++;
+		status = _analyze(&context->buffers[0], &image->pixels, &stats->pixels,
+					stream, size, inParams);
+	}
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	// Run-length coded streams can do without tables, the pixels first
+	// since they're decoded last, then the tile map. What's still over
+	// the budget is rejected.
+	_ram_usage(&stats->ram, image, stats);
+	if (inParams->ram_budget && stats->ram.peak > inParams->ram_budget
+				&& !inConfig->bwt && !inConfig->lz) {
+		status = _analyze_table_free(&context->buffers[0], &image->pixels, &stats->pixels,
+					stream, size, inParams);
+		_ram_usage(&stats->ram, image, stats);
+		if (status == PXQ_OK && stats->ram.peak > inParams->ram_budget && stats->tile_size) {
+			status = _analyze_table_free(&context->buffers[1], &image->map, &stats->map,
+						image->tiles.map, stats->num_tiles, inParams);
+			_ram_usage(&stats->ram, image, stats);
+		}
+		if (status != PXQ_OK) {
+			return status;
+		}
+	}
+	if (inParams->ram_budget && stats->ram.peak > inParams->ram_budget) {
+		return PXQ_ERROR_BUDGET;
+	}
+
+	stats->total_bits = stats->header_bits + stats->map.total_bits + stats->pixels.total_bits;
+	return PXQ_OK;
+}
+
+static enum pxq_status _analyze_blocks(
+		struct _pxq_image * const image,
+		struct pxq_stats * const stats,
+		unsigned int const * const inStream,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inNumSymbols,
+		struct params const * const inParams) {
+
+	unsigned int const size = inWidth * inHeight;
+	unsigned int const num_symbols = inNumSymbols;
+	unsigned int const max_block_size = inParams->bwt_block_size < size
+				? inParams->bwt_block_size : size;
+
+	// Candidate boundaries: a grid of a quarter of the largest block,
+	// plus in each cell of the grid the row where the symbols in use
+	// change the most, which tends to be where screens switch from one
+	// region to another. Rows are summed up by the symbols they use,
+	// modulo 64.
+	unsigned int const cell = max_block_size / 4 ? max_block_size / 4 : 1;
+	unsigned int const num_cells = (size + cell - 1) / cell;
+	unsigned int * boundaries = malloc((2 * num_cells + 1) * sizeof(unsigned int));
+	unsigned long long * signatures = malloc(inHeight * sizeof(unsigned long long));
+	if (!boundaries || !signatures) {
+		free(boundaries);
+		free(signatures);
+		return PXQ_ERROR_MEMORY;
+	}
+	for (unsigned int y = 0; y < inHeight; y++) {
+		signatures[y] = 0;
+		for (unsigned int x = 0; x < inWidth; x++) {
+			signatures[y] |= 1ULL << (inStream[y * inWidth + x] & 63);
+		}
+	}
+
+	unsigned int num_boundaries = 0;
+	for (unsigned int c = 0; c < num_cells; c++) {
+		unsigned int const start = c * cell;
+		unsigned int const end = start + cell < size ? start + cell : size;
+		boundaries[num_boundaries++] = start;
+
+		unsigned int best_row = 0;
+		int best_change = 0;
+		for (unsigned int y = start / inWidth + 1; y < inHeight && y * inWidth < end; y++) {
+			if (y * inWidth <= start) {
+				continue;
+			}
+			int const change = __builtin_popcountll(signatures[y] ^ signatures[y - 1]);
+			if (2 * change > __builtin_popcountll(signatures[y] | signatures[y - 1])
+						&& change > best_change) {
+				best_change = change;
+				best_row = y;
+			}
+		}
+		if (best_change) {
+			boundaries[num_boundaries++] = best_row * inWidth;
+		}
+	}
+	boundaries[num_boundaries++] = size;
+	free(signatures);
+
+	// Every block between two boundaries that's small enough gets
+	// costed, then the cheapest path from the start to the end wins
+	unsigned int num_edges = 0;
+	for (unsigned int i = 0; i < num_boundaries; i++) {
+		for (unsigned int j = i + 1; j < num_boundaries
+					&& boundaries[j] - boundaries[i] <= max_block_size; j++) {
+			num_edges++;
+		}
+	}
+
+	// The RLE cap search and the search for a model would dominate the
+	// costing of that many blocks: blocks are costed with independent
+	// lengths and values, and both searches only run on the blocks
+	// that get picked
+	struct params costing = *inParams;
+	if (costing.max_rle_run == 0) {
+		costing.max_rle_run = max_block_size;
+	}
+	costing.model = PXQ_MODEL_INDEPENDENT;
+
+	struct _pxq_block_pool pool;
+	memset(&pool, 0, sizeof(pool));
+	pool.blocks = calloc(num_edges, sizeof(struct _pxq_block));
+	unsigned long long * costs = malloc(num_boundaries * sizeof(unsigned long long));
+	unsigned int * from = malloc(num_boundaries * sizeof(unsigned int));
+	if (!pool.blocks || !costs || !from) {
+		free(pool.blocks);
+		free(costs);
+		free(from);
+		free(boundaries);
+		return PXQ_ERROR_MEMORY;
+	}
+	pool.num_blocks = num_edges;
+	pool.stream = inStream;
+	pool.num_symbols = num_symbols;
+	pool.max_block_size = max_block_size;
+	pool.params = &costing;
+	unsigned int e = 0;
+	for (unsigned int i = 0; i < num_boundaries; i++) {
+		for (unsigned int j = i + 1; j < num_boundaries
+					&& boundaries[j] - boundaries[i] <= max_block_size; j++) {
+			pool.blocks[e].start = boundaries[i];
+			pool.blocks[e].size = boundaries[j] - boundaries[i];
+			e++;
+		}
+	}
+
+	enum pxq_status status = _run_block_pool(&pool, inParams);
+
+	// Blocks are listed by start, such that the cheapest way to reach
+	// a boundary is known before looking at the blocks that start there
+	costs[0] = 0;
+	for (unsigned int i = 1; i < num_boundaries; i++) {
+		costs[i] = ~0ULL;
+	}
+	e = 0;
+	for (unsigned int i = 0; i < num_boundaries && status == PXQ_OK; i++) {
+		for (unsigned int j = i + 1; j < num_boundaries
+					&& boundaries[j] - boundaries[i] <= max_block_size; j++) {
+			if (costs[i] + pool.blocks[e].bits < costs[j]) {
+				costs[j] = costs[i] + pool.blocks[e].bits;
+				from[j] = i;
+			}
+			e++;
+		}
+	}
+	free(pool.blocks);
+	free(costs);
+
+	// Walk back from the end, then transform the chosen blocks for good
+	unsigned int num_blocks = 0;
+	for (unsigned int j = num_boundaries - 1; j > 0 && status == PXQ_OK; j = from[j]) {
+		num_blocks++;
+	}
+	memset(&pool, 0, sizeof(pool));
+	pool.blocks = status == PXQ_OK ? calloc(num_blocks, sizeof(struct _pxq_block)) : NULL;
+	if (status == PXQ_OK && !pool.blocks) {
+		status = PXQ_ERROR_MEMORY;
+	}
+	if (status == PXQ_OK) {
+		unsigned int b = num_blocks;
+		for (unsigned int j = num_boundaries - 1; j > 0; j = from[j]) {
+			b--;
+			pool.blocks[b].start = boundaries[from[j]];
+			pool.blocks[b].size = boundaries[j] - boundaries[from[j]];
+		}
+		pool.num_blocks = num_blocks;
+		pool.stream = inStream;
+		pool.num_symbols = num_symbols;
+		pool.max_block_size = max_block_size;
+		pool.params = inParams;
+		pool.keep = 1;
+		image->blocks = pool.blocks;
+		image->num_blocks = num_blocks;
+		status = _run_block_pool(&pool, inParams);
+	}
+	free(from);
+	free(boundaries);
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	stats->header_bits += 16 + universal_bits(PXQ_CODER_GAMMA, 0, num_blocks - 1);
+	stats->bwt_blocks = num_blocks;
+	stats->bwt_largest_block = 0;
+	struct pxq_stream_stats * const pixels = &stats->pixels;
+	*pixels = image->blocks[0].stats;
+	for (unsigned int b = 0; b < num_blocks; b++) {
+		struct pxq_stream_stats const * const block = &image->blocks[b].stats;
+		stats->header_bits += _block_header_bits(image->blocks[b].size);
+		if (image->blocks[b].size > stats->bwt_largest_block) {
+			stats->bwt_largest_block = image->blocks[b].size;
+		}
+		if (b == 0) {
+			continue;
+		}
+		pixels->num_runs += block->num_runs;
+		pixels->lengths_table_bits += block->lengths_table_bits;
+		pixels->lengths_bits += block->lengths_bits;
+		pixels->values_table_bits += block->values_table_bits;
+		pixels->values_bits += block->values_bits;
+		for (int c = 0; c < PXQ_CODER_COUNT; c++) {
+			pixels->lengths_costs[c] += block->lengths_costs[c];
+			pixels->values_costs[c] += block->values_costs[c];
+		}
+		pixels->total_bits += block->total_bits;
+	}
+	return PXQ_OK;
+}
+
+static enum pxq_status _run_block_pool(
+		struct _pxq_block_pool * const pool,
+		struct params const * const inParams) {
+
+	unsigned int num_threads = inParams->num_threads;
+	if (num_threads == 0) {
+		long const processors = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = processors > 0 ? (unsigned int)processors : 1;
+	}
+	if (num_threads > PXQ_MAX_THREADS) {
+		num_threads = PXQ_MAX_THREADS;
+	}
+	if (num_threads > pool->num_blocks) {
+		num_threads = pool->num_blocks;
+	}
+
+	if (pthread_mutex_init(&pool->mutex, NULL)) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	// This thread works too, and does it all if no other can start
+	pthread_t threads[PXQ_MAX_THREADS];
+	unsigned int num_started = 0;
+	while (num_started + 1 < num_threads
+				&& !pthread_create(&threads[num_started], NULL, _transform_blocks, pool)) {
+		num_started++;
+	}
+	_transform_blocks(pool);
+	for (unsigned int t = 0; t < num_started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	pthread_mutex_destroy(&pool->mutex);
+
+	for (unsigned int b = 0; b < pool->num_blocks; b++) {
+		if (pool->blocks[b].status != PXQ_OK) {
+			return pool->blocks[b].status;
+		}
+	}
+	return PXQ_OK;
+}
+
+static void * _transform_blocks(void * const pool) {
+	struct _pxq_block_pool * const block_pool = (struct _pxq_block_pool *)pool;
+
+	// Blocks that are only costed share the buffers of their thread
+	struct _pxq_buffers scratch;
+	memset(&scratch, 0, sizeof(scratch));
+	unsigned int * transformed = malloc(block_pool->max_block_size * sizeof(unsigned int));
+
+	for (;;) {
+		pthread_mutex_lock(&block_pool->mutex);
+		unsigned int const b = block_pool->next_block;
+		if (b < block_pool->num_blocks) {
+			block_pool->next_block++;
+		}
+		pthread_mutex_unlock(&block_pool->mutex);
+		if (b >= block_pool->num_blocks) {
+			break;
+		}
+
+		struct _pxq_block * const block = &block_pool->blocks[b];
+		if (!transformed) {
+			block->status = PXQ_ERROR_MEMORY;
+			continue;
+		}
+		block->status = _transform_block(block,
+					block_pool->keep ? &block->buffers : &scratch,
+					transformed,
+					block_pool);
+	}
+
+	_free_buffers(&scratch);
+	free(transformed);
+	return NULL;
+}
+
+static enum pxq_status _transform_block(
+		struct _pxq_block * const block,
+		struct _pxq_buffers * const buffers,
+		unsigned int * const transformed,
+		struct _pxq_block_pool const * const pool) {
+
+	enum pxq_status status = _reserve(buffers, block->size);
+	if (status == PXQ_OK) {
+		status = bwt_encode(transformed, &block->primary,
+					pool->stream + block->start, block->size);
+	}
+	if (status == PXQ_OK) {
+		status = mtf_encode(buffers->residuals, transformed, block->size, pool->num_symbols);
+	}
+	if (status == PXQ_OK) {
+		status = _analyze(buffers, &block->analysis, &block->stats,
+					buffers->residuals, block->size, pool->params);
+	}
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	unsigned long long const bits = (unsigned long long)_block_header_bits(block->size)
+				+ block->stats.total_bits;
+	block->bits = bits < ~0U ? (unsigned int)bits : ~0U;
+	if (!pool->keep) {
+		_free_analysis(&block->analysis);
+	}
+	return PXQ_OK;
+}
+
+static unsigned int _bwt_bytes(
+		unsigned int const size,
+		unsigned int const num_symbols) {
+	// The transformed block, the row each symbol moves to, and the
+	// count of each symbol to build those
+	unsigned int const index_bytes = size > 65536 ? 4 : 2;
+	unsigned long long const bytes = (unsigned long long)size
+				* ((num_symbols > 256 ? 2 : 1) + index_bytes)
+				+ (unsigned long long)num_symbols * index_bytes;
+	return bytes < ~0U ? (unsigned int)bytes : ~0U;
+}
+
+static unsigned int _largest_bwt_block(
+		unsigned int const available,
+		unsigned int const num_symbols,
+		unsigned int const max_size) {
+	unsigned int low = 0;
+	unsigned int high = max_size;
+	while (low < high) {
+		unsigned int const middle = high - (high - low) / 2;
+		if (_bwt_bytes(middle, num_symbols) <= available) {
+			low = middle;
+		} else {
+			high = middle - 1;
+		}
+	}
+	return low;
+}
+
+static void _ram_usage(
+		struct pxq_ram_stats * const ram,
+		struct _pxq_image const * const image,
+		struct pxq_stats const * const stats) {
+
+	// The tile map is decoded first, then stays around while the pixels
+	// are decoded. Only the streams that are being decoded need their
+	// tables, and the model of a stream that wasn't analyzed yet is
+	// still unset.
+	struct pxq_ram_stats map;
+	memset(&map, 0, sizeof(map));
+	memset(ram, 0, sizeof(struct pxq_ram_stats));
+
+	unsigned int const symbol_bytes = image->num_symbols > 256 ? 2 : 1;
+	if (stats->tile_size) {
+		unsigned int const references = stats->tile_flips
+					? stats->unique_tiles << TILE_FLIP_BITS : stats->unique_tiles;
+		map.tile_map = stats->num_tiles * (references > 256 ? 2 : 1);
+		if (image->map.model.model) {
+			map.tables = model_decoder_bytes(&image->map.model,
+						&image->map.lengths, &image->map.values);
+		}
+		ram->tile_map = map.tile_map;
+		ram->tile_dictionary = stats->unique_tiles * stats->tile_size * stats->tile_size
+					* symbol_bytes;
+	}
+	if (image->predictors) {
+		ram->predictors = image->num_rows;
+	}
+	if (image->blocks) {
+		for (unsigned int b = 0; b < image->num_blocks; b++) {
+			struct _pxq_analysis const * const analysis = &image->blocks[b].analysis;
+			unsigned int const tables = model_decoder_bytes(&analysis->model,
+						&analysis->lengths, &analysis->values);
+			if (tables > ram->tables) {
+				ram->tables = tables;
+			}
+		}
+		ram->bwt_block = _bwt_bytes(stats->bwt_largest_block, image->num_symbols);
+		ram->mtf = image->num_symbols * symbol_bytes;
+	} else if (stats->lz.window) {
+		ram->tables = lz_decoder_bytes(&image->lz);
+		if (image->predictors) {
+			ram->lz_window = stats->lz.window * symbol_bytes;
+		}
+	} else if (image->pixels.model.model) {
+		ram->tables = model_decoder_bytes(&image->pixels.model,
+					&image->pixels.lengths, &image->pixels.values);
+	}
+
+	map.peak = map.tables + map.tile_map;
+	ram->peak = ram->tables + ram->tile_map + ram->tile_dictionary
+				+ ram->predictors + ram->bwt_block + ram->mtf + ram->lz_window;
+	if (map.peak > ram->peak) {
+		*ram = map;
+	}
+}
+
+static unsigned int _block_header_bits(unsigned int const size) {
+	return universal_bits(PXQ_CODER_GAMMA, 0, size - 1) + _index_bits(size);
+}
+
+static unsigned int _index_bits(unsigned int const size) {
+	unsigned int bits = 0;
+	while (bits < 32 && (1ULL << bits) < size) {
+		bits++;
+	}
+	return bits;
+}
+
+static void _free_analysis(struct _pxq_analysis * const analysis) {
+	model_free(&analysis->model);
+	coder_free(&analysis->lengths);
+	coder_free(&analysis->values);
+}
+
+static void _free_image(struct _pxq_image * const image) {
+	lz_free(&image->lz);
+	_free_analysis(&image->pixels);
+	_free_analysis(&image->map);
+	tile_free_index(&image->tiles);
+	free(image->predictors);
+	image->predictors = NULL;
+	_free_blocks(image);
+}
+
+static void _free_blocks(struct _pxq_image * const image) {
+	for (unsigned int b = 0; b < image->num_blocks; b++) {
+		_free_analysis(&image->blocks[b].analysis);
+		_free_buffers(&image->blocks[b].buffers);
+	}
+	free(image->blocks);
+	image->blocks = NULL;
+	image->num_blocks = 0;
+}
+
+static unsigned int _predictors_bits(
+		unsigned char const * const predictors,
+		unsigned int const num_rows) {
+	unsigned int bits = 0;
+	unsigned char previous = PXQ_PREDICTOR_NONE;
+	for (unsigned int y = 0; y < num_rows; y++) {
+		bits += predictors[y] == previous ? 1 : 1 + PREDICT_BITS;
+		previous = predictors[y];
+	}
+	return bits;
+}
+
+static void _write_predictors(
+		struct bit_writer * const writer,
+		unsigned char const * const predictors,
+		unsigned int const num_rows) {
+	unsigned char previous = PXQ_PREDICTOR_NONE;
+	for (unsigned int y = 0; y < num_rows; y++) {
+		bits_write(writer, predictors[y] == previous, 1);
+		if (predictors[y] != previous) {
+			bits_write(writer, predictors[y] - PXQ_PREDICTOR_NONE, PREDICT_BITS);
+		}
+		previous = predictors[y];
+	}
+}
+
+static enum pxq_status _read_predictors(
+		struct bit_reader * const reader,
+		unsigned char * const predictors,
+		unsigned int const num_rows) {
+	unsigned char previous = PXQ_PREDICTOR_NONE;
+	for (unsigned int y = 0; y < num_rows; y++) {
+		if (!bits_read(reader, 1)) {
+			unsigned int const predictor = bits_read(reader, PREDICT_BITS)
+						+ PXQ_PREDICTOR_NONE;
+			if (predictor >= PXQ_PREDICTOR_COUNT) {
+				return PXQ_ERROR_FORMAT;
+			}
+			previous = predictor;
+		}
+		predictors[y] = previous;
+	}
+	return reader->overrun ? PXQ_ERROR_FORMAT : PXQ_OK;
+}
+
+static void _write_stream(
+		struct bit_writer * const writer,
+		struct _pxq_analysis const * const analysis) {
+	model_write_header(writer, &analysis->model, &analysis->lengths, &analysis->values);
+	model_write_runs(writer,
+				&analysis->model,
+				&analysis->lengths,
+				&analysis->values,
+				analysis->run_lengths,
+				analysis->run_values,
+				analysis->num_runs);
+}
+
+static enum pxq_status _read_stream(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const inSize) {
+
+	struct run_model model;
+	struct stream_coder lengths;
+	struct stream_coder values;
+
+	enum pxq_status status = model_read_header(&model, &lengths, &values, reader);
+	if (status == PXQ_OK) {
+		status = model_read_runs(reader, outSymbols, inSize, &model, &lengths, &values);
+	}
+
+	model_free(&model);
+	coder_free(&lengths);
+	coder_free(&values);
+	return status;
+}
+
+static enum pxq_status _read_map(
+		struct bit_reader * const reader,
+		struct tile_index * const tiles,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inTileSize) {
+
+	tiles->tile_size = inTileSize;
+	tiles->flips = bits_read(reader, 1);
+	tiles->tiles_x = inWidth / inTileSize;
+	tiles->tiles_y = inHeight / inTileSize;
+	unsigned int const num_tiles = tiles->tiles_x * tiles->tiles_y;
+	tiles->map = malloc(num_tiles * sizeof(unsigned int));
+	if (!tiles->map) {
+		return PXQ_ERROR_MEMORY;
+	}
+	enum pxq_status status = _read_stream(reader, tiles->map, num_tiles);
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	// Unique tiles are numbered in order of first appearance, which
+	// also tells how many there are
+	for (unsigned int t = 0; t < num_tiles; t++) {
+		unsigned int const u = tiles->flips ? tiles->map[t] >> TILE_FLIP_BITS : tiles->map[t];
+		if (u > tiles->num_unique) {
+			return PXQ_ERROR_FORMAT;
+		}
+		if (u == tiles->num_unique) {
+			tiles->num_unique++;
+		}
+	}
+	return PXQ_OK;
+}
+
+static enum pxq_status _read_blocks(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const inSize) {
+
+	unsigned int const num_symbols = bits_read(reader, 16) + 1;
+	unsigned int const num_blocks = universal_read(reader, PXQ_CODER_GAMMA, 0) + 1;
+	if (reader->overrun || num_blocks > inSize) {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	unsigned int * indices = NULL;
+	unsigned int * transformed = NULL;
+	unsigned int capacity = 0;
+	unsigned int position = 0;
+	enum pxq_status status = PXQ_OK;
+	for (unsigned int b = 0; b < num_blocks && status == PXQ_OK; b++) {
+		unsigned int const size = universal_read(reader, PXQ_CODER_GAMMA, 0) + 1;
+		if (reader->overrun || size == 0 || size > inSize - position) {
+			status = PXQ_ERROR_FORMAT;
+			break;
+		}
+		unsigned int const primary = bits_read(reader, _index_bits(size));
+
+		if (size > capacity) {
+			free(indices);
+			free(transformed);
+			indices = malloc(size * sizeof(unsigned int));
+			transformed = malloc(size * sizeof(unsigned int));
+			capacity = size;
+			if (!indices || !transformed) {
+				status = PXQ_ERROR_MEMORY;
+				break;
+			}
+		}
+
+		status = _read_stream(reader, indices, size);
+		if (status == PXQ_OK) {
+			status = mtf_decode(transformed, indices, size, num_symbols);
+		}
+		if (status == PXQ_OK) {
+			status = bwt_decode(outSymbols + position, transformed, size, primary);
+		}
+		position += size;
+	}
+
+	free(indices);
+	free(transformed);
+	if (status == PXQ_OK && position != inSize) {
+		status = PXQ_ERROR_FORMAT;
+	}
+	return status;
+}
+
+static enum pxq_status _read_symbols(
+		struct bit_reader * const reader,
+		unsigned int * const outSymbols,
+		unsigned int const inSize) {
+	if (bits_read(reader, 1)) {
+		return _read_blocks(reader, outSymbols, inSize);
+	}
+	return bits_read(reader, 1) ? lz_read(reader, outSymbols, inSize)
+				: _read_stream(reader, outSymbols, inSize);
+}
+
+static enum pxq_status _read_pixels(
+		struct pxq_context * const context,
+		struct bit_reader * const reader,
+		unsigned int * const outPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight) {
+
+	unsigned int const size = inWidth * inHeight;
+	if (!bits_read(reader, 1)) {
+		return _read_symbols(reader, outPixels, size);
+	}
+
+	unsigned int const palette_size = bits_read(reader, 16) + 1;
+	unsigned char * predictors = malloc(inHeight);
+	if (!predictors) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	enum pxq_status status = _read_predictors(reader, predictors, inHeight);
+	if (status == PXQ_OK) {
+		status = _reserve(&context->buffers[0], size);
+	}
+	if (status == PXQ_OK) {
+		status = _read_symbols(reader, context->buffers[0].residuals, size);
+	}
+	unsigned int const * const residuals = context->buffers[0].residuals;
+	for (unsigned int i = 0; i < size && status == PXQ_OK; i++) {
+		if (residuals[i] >= palette_size) {
+			status = PXQ_ERROR_FORMAT;
+		}
+	}
+	if (status == PXQ_OK) {
+		status = predict_decode(outPixels, residuals, inWidth, inHeight,
+					palette_size, predictors);
+	}
+
+	free(predictors);
+	return status;
+}
+
+static enum pxq_status _choose_coder(
+		struct stream_coder * const coder,
+		unsigned int * const outBits,
+		unsigned int * const outCosts,
+		unsigned int const * const symbols,
+		unsigned int const size,
+		unsigned int const num_symbols,
+		enum pxq_coder const forced) {
+
+	unsigned int * frequencies = calloc(num_symbols, sizeof(unsigned int));
+	if (!frequencies) {
+		return PXQ_ERROR_MEMORY;
+	}
+	for (unsigned int i = 0; i < size; i++) {
+		frequencies[symbols[i]]++;
+	}
+
+	enum pxq_status status = coder_choose(coder, outCosts, frequencies, num_symbols, forced);
+	if (status == PXQ_OK) {
+		*outBits = outCosts[coder->coder] - coder_header_bits(coder);
+	}
+
+	free(frequencies);
+	return status;
+}
+
+static void * _analyze_frame(void * const job) {
+	struct _pxq_frame_job * const frame_job = (struct _pxq_frame_job *)job;
+	unsigned int const size = frame_job->width * frame_job->height;
+
+	frame_job->status = _reserve(frame_job->buffers, size);
+	if (frame_job->status != PXQ_OK) {
+		return NULL;
+	}
+
+	// Unchanged pixels become zeroes, which RLE turns into long runs
+	unsigned int * const residuals = frame_job->buffers->residuals;
+	if (frame_job->previous) {
+		for (unsigned int i = 0; i < size; i++) {
+			residuals[i] = frame_job->frame[i] ^ frame_job->previous[i];
+		}
+	} else {
+		memcpy(residuals, frame_job->frame, size * sizeof(unsigned int));
+	}
+
+	// Frames aren't tiled: the XOR with the previous frame already
+	// takes care of what repeats
+	memset(&frame_job->stats, 0, sizeof(struct pxq_stats));
+	frame_job->stats.width = frame_job->width;
+	frame_job->stats.height = frame_job->height;
+	frame_job->status = _analyze(frame_job->buffers,
+				&frame_job->analysis,
+				&frame_job->stats.pixels,
+				residuals,
+				size,
+				frame_job->params);
+	return NULL;
+}
 
-	return 0;
+static unsigned int _payload_bits(
+		struct stream_coder const * const coder,
+		unsigned int const * const symbols,
+		unsigned int const size) {
+	unsigned long long bits = 0;
+	for (unsigned int i = 0; i < size; i++) {
+		unsigned int const symbol_bits = coder_symbol_bits(coder, symbols[i]);
+		if (symbol_bits == ~0U) {
+			return ~0U;
+		}
+		bits += symbol_bits;
+	}
+	return bits >= ~0U ? ~0U : (unsigned int)bits;
 }
@@ -20,8 +20,262 @@
 #ifndef __PXQUEEZE_H__
 #define __PXQUEEZE_H__
 
+#include <stddef.h>
+
+/*
+ * Every library entry point returns one of these. Helpers never exit,
+ * they hand the status back up to the caller.
+ */
+enum pxq_status {
+	PXQ_OK = 0,
+	PXQ_ERROR_MEMORY,
+	PXQ_ERROR_PARAMS,
+	PXQ_ERROR_FORMAT,
+	PXQ_ERROR_IO,
+	PXQ_ERROR_BUDGET,	// no configuration fits the decoder RAM budget
+};
+
+/*
+ * Largest symbol range handled by the entropy stages
+ */
+#define PXQ_MAX_SYMBOLS 65536
+
+/*
+ * Entropy coders that each stream can use. Huffman comes with a table
+ * in the stream header, the others are table-free universal codes.
+ */
+enum pxq_coder {
+	PXQ_CODER_AUTO = 0,
+	PXQ_CODER_HUFFMAN,
+	PXQ_CODER_GAMMA,
+	PXQ_CODER_DELTA,
+	PXQ_CODER_EXP_GOLOMB,
+	PXQ_CODER_GOLOMB,
+	PXQ_CODER_COUNT,
+};
+
+/*
+ * Predictors of each pixel from its neighbors to the left, above, and
+ * above to the left, for the 2D prediction stage. Neighbors outside the
+ * image count as zeroes.
+ */
+enum pxq_predictor {
+	PXQ_PREDICTOR_AUTO = 0,
+	PXQ_PREDICTOR_NONE,
+	PXQ_PREDICTOR_LEFT,
+	PXQ_PREDICTOR_UP,
+	PXQ_PREDICTOR_UP_LEFT,
+	PXQ_PREDICTOR_AVERAGE,
+	PXQ_PREDICTOR_PAETH,
+	PXQ_PREDICTOR_COUNT,
+};
+
+/*
+ * How the runs of a stream are coded: lengths and values each with
+ * their own coder, the most frequent pairs of a length and a value as
+ * one symbol (others escape to the lengths and values coders), or the
+ * values with a coder picked by the value of the previous run.
+ */
+enum pxq_model {
+	PXQ_MODEL_AUTO = 0,
+	PXQ_MODEL_INDEPENDENT,
+	PXQ_MODEL_PAIRS,
+	PXQ_MODEL_CONTEXT,
+	PXQ_MODEL_COUNT,
+};
+
 struct params {
+	unsigned int max_rle_run;	// 0 to search for the best cap
+	enum pxq_coder lengths_coder;	// PXQ_CODER_AUTO to pick the cheapest
+	enum pxq_coder values_coder;
+	enum pxq_model model;		// PXQ_MODEL_AUTO to pick the cheapest
+	unsigned int tile_size;		// 0 to search, 1 for no tiling, or 8, 16 or 32
+	int tile_flips;			// also try matching mirrored and flipped tiles
+	enum pxq_predictor predictor;	// PXQ_PREDICTOR_AUTO to search, and pick one per row
+	unsigned int bwt_block_size;	// largest BWT block, 0 for no BWT
+	unsigned int num_threads;	// 0 for one per processor
+	unsigned int lz_window;		// farthest LZ match, 0 for no LZ, at most PXQ_MAX_SYMBOLS
+	unsigned int ram_budget;	// decoder working RAM in bytes, 0 for no limit
+};
+
+/*
+ * Sizes in bits of each part of a stream of symbols once run-length
+ * encoded. The per-coder costs include the stream header, and are
+ * indexed by enum pxq_coder. They are those of the independent
+ * lengths and values: other models re-use the coders for escaped
+ * runs, or for merged contexts, and code the rest with the pairs or
+ * context coders, which make up the model bits. The per-model costs
+ * are indexed by enum pxq_model.
+ */
+struct pxq_stream_stats {
 	unsigned int max_rle_run;
+	unsigned int num_runs;
+	enum pxq_coder lengths_coder;
+	unsigned int lengths_table_bits;
+	unsigned int lengths_bits;
+	unsigned int lengths_costs[PXQ_CODER_COUNT];
+	enum pxq_coder values_coder;
+	unsigned int values_table_bits;
+	unsigned int values_bits;
+	unsigned int values_costs[PXQ_CODER_COUNT];
+	enum pxq_model model;
+	unsigned int model_symbols;	// pairs in the table, or contexts with their own coder
+	unsigned int escapes;		// runs that aren't in the pairs table
+	unsigned int model_table_bits;
+	unsigned int model_bits;
+	unsigned int model_costs[PXQ_MODEL_COUNT];
+	unsigned int total_bits;
+};
+
+/*
+ * Working RAM that a decoder on the target needs besides the screen it
+ * decodes into, in bytes, broken down by stage at the point where it
+ * peaks. Symbols take one byte each when there are at most 256 of them,
+ * two otherwise.
+ */
+struct pxq_ram_stats {
+	unsigned int tables;		// entropy decoding tables
+	unsigned int tile_map;
+	unsigned int tile_dictionary;
+	unsigned int predictors;	// one byte per row
+	unsigned int bwt_block;		// largest block and its inverse mapping
+	unsigned int mtf;		// move-to-front list
+	unsigned int lz_window;		// recent residuals that matches copy from
+	unsigned int peak;
+};
+
+/*
+ * LZ tokens of the pixel stream by type, and the size of each of their
+ * streams in bits, stream headers included
+ */
+struct pxq_lz_stats {
+	unsigned int window;		// 0 if the pixels aren't LZ coded
+	unsigned int literals;
+	unsigned int matches;
+	unsigned int short_reps;
+	unsigned int reps[4];		// by index in the recent distances
+	unsigned int tokens_bits;
+	unsigned int literals_bits;
+	unsigned int lengths_bits;
+	unsigned int distances_bits;
+};
+
+/*
+ * Sizes in bits of each part of a compressed image. A tiled image is
+ * made of a stream of unique tiles, reported as pixels, and of a map
+ * of references to those tiles. Predicted pixels are residuals modulo
+ * the palette size, with a predictor per row. Transformed pixels are
+ * cut into BWT blocks with their own coders: the pixel statistics add
+ * up the blocks, and show the coders and RLE cap of the first one. LZ
+ * coded pixels only report their total in the pixel statistics.
+ */
+struct pxq_stats {
+	unsigned int width;
+	unsigned int height;
+	unsigned int header_bits;
+	unsigned int tile_size;		// 0 if the image isn't tiled
+	int tile_flips;
+	unsigned int num_tiles;
+	unsigned int unique_tiles;
+	unsigned int palette_size;	// 0 if the pixels aren't predicted
+	unsigned int predictor_rows[PXQ_PREDICTOR_COUNT];
+	unsigned int bwt_blocks;	// 0 if the pixels aren't transformed
+	unsigned int bwt_largest_block;
+	struct pxq_lz_stats lz;
+	struct pxq_stream_stats pixels;
+	struct pxq_stream_stats map;
+	struct pxq_ram_stats ram;
+	int reused_coders;	// sequences: coders carried over from the previous frame
+	unsigned int total_bits;
 };
 
-#endif
\ No newline at end of file
+/*
+ * A context holds the scratch buffers of one compression at a time.
+ * Contexts share nothing: use one per thread, and reuse it across
+ * calls to avoid re-allocating buffers.
+ */
+struct pxq_context;
+
+struct pxq_context * pxq_create_context(void);
+
+void pxq_destroy_context(struct pxq_context * const context);
+
+char const * pxq_status_string(enum pxq_status const status);
+
+char const * pxq_coder_string(enum pxq_coder const coder);
+
+char const * pxq_predictor_string(enum pxq_predictor const predictor);
+
+char const * pxq_model_string(enum pxq_model const model);
+
+/*
+ * Compresses width * height symbols into a buffer allocated with
+ * malloc, which the caller frees. outStats may be NULL.
+ */
+enum pxq_status pxq_compress(
+	struct pxq_context * const context,
+	unsigned char ** const outDataP,
+	size_t * const outSizeP,
+	struct pxq_stats * const outStats,
+	unsigned int const * const inPixels,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	struct params const * const inParams);
+
+/*
+ * Same analysis as pxq_compress, without producing the output. The
+ * statistics are all it returns, so outStats is required.
+ */
+enum pxq_status pxq_estimate(
+	struct pxq_context * const context,
+	struct pxq_stats * const outStats,
+	unsigned int const * const inPixels,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	struct params const * const inParams);
+
+/*
+ * Decompresses into a symbol buffer allocated with malloc, which the
+ * caller frees.
+ */
+enum pxq_status pxq_decompress(
+	struct pxq_context * const context,
+	unsigned int ** const outPixelsP,
+	unsigned int * const outWidth,
+	unsigned int * const outHeight,
+	unsigned char const * const inData,
+	size_t const inSize);
+
+/*
+ * Compresses a sequence of frames of identical sizes, each coded against
+ * the previous one. outStats may be NULL, otherwise it receives one
+ * entry per frame. Frames are neither tiled, predicted, nor go through
+ * the BWT or LZ: a tile_size above 1, a predictor other than
+ * PXQ_PREDICTOR_AUTO or PXQ_PREDICTOR_NONE, or a bwt_block_size or
+ * lz_window other than 0, is PXQ_ERROR_PARAMS.
+ */
+enum pxq_status pxq_compress_sequence(
+	struct pxq_context * const context,
+	unsigned char ** const outDataP,
+	size_t * const outSizeP,
+	struct pxq_stats * const outStats,
+	unsigned int const * const * const inFrames,
+	unsigned int const inNumFrames,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	struct params const * const inParams);
+
+/*
+ * Decompresses a sequence into one buffer allocated with malloc, which
+ * holds all the frames one after the other, and which the caller frees.
+ */
+enum pxq_status pxq_decompress_sequence(
+	struct pxq_context * const context,
+	unsigned int ** const outFramesP,
+	unsigned int * const outNumFrames,
+	unsigned int * const outWidth,
+	unsigned int * const outHeight,
+	unsigned char const * const inData,
+	size_t const inSize);
+
+#endif
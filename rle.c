@@ -17,50 +17,57 @@
 
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-#include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
-#include <string.h>
 
-#include "huffman.h"
 #include "rle.h"
 
 /*
-* Helper function: allocate two arrays of the same size, exit in case of error
+* Helper function: allocate two arrays of the same size, returns 0 on failure
 */
-static void _allocate_arrays(
+static int _allocate_arrays(
 		unsigned int ** const lengthArrayP,
 		unsigned int ** const symbolArrayP,
 		unsigned int const array_size);
 
 /*
-* Helper function: resize two arrays to the same size, exit in case of error
+* All uncapped runs of a given symbol and length
 */
-static void _resize_arrays(
-		unsigned int ** const lengthArrayP,
-		unsigned int ** const symbolArrayP,
-		unsigned int const array_size);
+struct _rle_pair {
+	unsigned int length;
+	unsigned int symbol;
+	unsigned int count;
+};
+
+static int _compare_pairs(void const * const v1, void const * const v2);
 
-void rle_find_runs(
-		unsigned int const ** const outLengthP,
-		unsigned int const ** const outSymbolP,
-		unsigned int * const outSize,
+static int _compare_keys(void const * const v1, void const * const v2);
+
+/*
+* Helper function: exact cost of the cheapest coder for the symbols
+* listed in keys (sorted in place)
+*/
+static enum pxq_status _sparse_cost(
+		unsigned int * const outCost,
+		unsigned int * const keys,
+		unsigned int const num_keys,
+		unsigned int const * const histogram,
+		unsigned int * const frequencies,
+		unsigned char * const code_lengths,
+		enum pxq_coder const forced);
+
+unsigned int rle_find_runs(
+		unsigned int * const outLengths,
+		unsigned int * const outSymbols,
 		unsigned int const * const inData,
 		unsigned int const inSize,
 		unsigned int const inMaxRunLength) {
 
-	printf("Looking for RLE runs from %u symbols\n", inSize);
-
 	unsigned int read_offset = 0;
 	unsigned int write_offset = 0;
 	unsigned int current_length;
 	unsigned int current_symbol;
 
-	unsigned int * lengths;
-	unsigned int * symbols;
-
-	// Allocate buffers at maximum theoretical size
-	_allocate_arrays(&lengths, &symbols, inSize);
-
 	// Core algorithm
 	while (read_offset < inSize) {
 		// Start a new run
@@ -74,210 +81,297 @@ void rle_find_runs(
 			current_length++;
 		}
 		// Store the run
-		lengths[write_offset] = current_length;
-		symbols[write_offset] = current_symbol;
+		outLengths[write_offset] = current_length;
+		outSymbols[write_offset] = current_symbol;
 		write_offset++;
 	}
 
-	printf("Found %u RLE runs\n", write_offset);
-
-	// Resize buffers to actual usage
-	_resize_arrays(&lengths, &symbols, write_offset);
-
-	// Store return values
-	*outLengthP = lengths;
-	*outSymbolP = symbols;
-	*outSize = write_offset;
+	return write_offset;
 }
 
-void rle_flat_table(
-		char const ** const outBitStreamP,
-		unsigned int const * const inLengthP,
-		unsigned int const * const inSymbolP,
-		unsigned int const inSize) {
-
-	unsigned int * buffer;
-	unsigned int huffman_bit_width;
-
-	unsigned int const * huffman_table;
-	unsigned int huffman_size;
-	unsigned int huffman_start;
-	char** huffman_codes;
-	unsigned int huffman_stream_length;
-
-	printf("Trying RLE strategy: single table\n");
+enum pxq_status rle_find_best_max_run(
+		unsigned int * const outMaxRunLength,
+		unsigned int * const outCost,
+		unsigned int const * const inData,
+		unsigned int const inSize,
+		unsigned int const inMaxRunLength,
+		enum pxq_coder const inLengthsCoder,
+		enum pxq_coder const inValuesCoder) {
 
-	buffer = malloc(2 * inSize * sizeof(unsigned int));
-	memcpy(buffer, inLengthP, inSize * sizeof(unsigned int));
-	memcpy(buffer + inSize, inSymbolP, inSize * sizeof(unsigned int));
+	unsigned int * rle_lengths;
+	unsigned int * rle_values;
 
-	generate_huffman_table(
-			&huffman_table,
-			&huffman_size,
-			&huffman_start,
-			buffer,
-			1,
-			2 * inSize);
+	if (!_allocate_arrays(&rle_lengths, &rle_values, inSize + 1)) {
+		return PXQ_ERROR_MEMORY;
+	}
 
-	huffman_codes = generate_huffman_codes(huffman_table, huffman_start);
+	// The only pass over the data: every run at its natural length
+	unsigned int const num_runs = rle_find_runs(rle_lengths, rle_values, inData, inSize, UINT_MAX);
 
-	huffman_bit_width = 0;
-	while (huffman_start + huffman_size > (1 << huffman_bit_width)) {
-		huffman_bit_width++;
+	// Aggregate identical runs, sorted by length
+	struct _rle_pair * pairs = malloc((num_runs + 1) * sizeof(struct _rle_pair));
+	if (!pairs) {
+		free(rle_lengths);
+		free(rle_values);
+		return PXQ_ERROR_MEMORY;
 	}
 
-	huffman_stream_length = 3 + (2 * huffman_size + 1) * huffman_bit_width;
-	for (unsigned i = 0; i < 2 * inSize; i++) {
-		huffman_stream_length += (unsigned int)strlen(huffman_codes[buffer[i]]);
+	unsigned int num_values = 0;
+	for (unsigned int i = 0; i < num_runs; i++) {
+		pairs[i].length = rle_lengths[i];
+		pairs[i].symbol = rle_values[i];
+		pairs[i].count = 1;
+		if (rle_values[i] >= num_values) {
+			num_values = rle_values[i] + 1;
+		}
 	}
 
-	printf("With single table: %u bits of Huffman data (= %u bytes)\n",
-			huffman_stream_length,
-			(huffman_stream_length + 7) / 8);
+	free(rle_lengths);
+	free(rle_values);
 
-	char* bitstream = malloc(huffman_stream_length + 1);
-	bitstream[huffman_stream_length - 1] = '\0';
-	unsigned int bit_write = 0;
+	qsort(pairs, num_runs, sizeof(struct _rle_pair), _compare_pairs);
 
-	bitstream[bit_write++] = ((huffman_bit_width - 2) & 4) ? '1':'0';
-	bitstream[bit_write++] = ((huffman_bit_width - 2) & 2) ? '1':'0';
-	bitstream[bit_write++] = ((huffman_bit_width - 2) & 1) ? '1':'0';
+	unsigned int num_pairs = 0;
+	for (unsigned int i = 0; i < num_runs; i++) {
+		if (num_pairs > 0
+					&& pairs[num_pairs - 1].length == pairs[i].length
+					&& pairs[num_pairs - 1].symbol == pairs[i].symbol) {
+			pairs[num_pairs - 1].count++;
+		} else {
+			pairs[num_pairs++] = pairs[i];
+		}
+	}
 
-	for (int i = 0; i < huffman_bit_width; i++) {
-		bitstream[bit_write++] = huffman_start & (1 << (huffman_bit_width - i - 1)) ? '1':'0';
+	// Caps beyond the longest run all produce the same runs
+	unsigned int cap_limit = inMaxRunLength;
+	if (num_pairs > 0 && cap_limit > pairs[num_pairs - 1].length) {
+		cap_limit = pairs[num_pairs - 1].length;
+	}
+	if (cap_limit < 2) {
+		cap_limit = 2;
 	}
 
-	for (int j = 0; j < huffman_size * 2; j++) {
-		for (int i = 0; i < huffman_bit_width; i++) {
-			bitstream[bit_write++] = huffman_table[j] & (1 << (huffman_bit_width - i - 1)) ? '1':'0';
+	// Room for the keys of either histogram
+	unsigned int const key_size = (num_values > cap_limit + 1 ? num_values : cap_limit + 1) + 1;
+	unsigned int * value_hist = calloc(num_values + 1, sizeof(unsigned int));
+	unsigned int * value_keys = calloc(num_values + 1, sizeof(unsigned int));
+	unsigned int * value_frequencies = calloc(num_values + 1, sizeof(unsigned int));
+	unsigned int * length_hist = calloc(cap_limit + 1, sizeof(unsigned int));
+	unsigned int * length_keys = calloc(cap_limit + 1, sizeof(unsigned int));
+	unsigned int * touched_keys = calloc(cap_limit + 1, sizeof(unsigned int));
+	unsigned int * keys = calloc(key_size, sizeof(unsigned int));
+	unsigned int * frequencies = calloc(key_size, sizeof(unsigned int));
+	unsigned char * code_lengths = calloc(key_size, sizeof(unsigned char));
+	unsigned int num_length_keys = 0;
+	unsigned int num_value_keys = 0;
+
+	enum pxq_status status = PXQ_OK;
+	if (!value_hist || !value_keys || !value_frequencies || !length_hist || !length_keys || !touched_keys
+				|| !keys || !frequencies || !code_lengths) {
+		status = PXQ_ERROR_MEMORY;
+		cap_limit = 1;
+	} else {
+		// A cap splits runs but never removes one, so the values that
+		// occur are the same for every cap, and their keys are sorted once
+		for (unsigned int i = 0; i < num_pairs; i++) {
+			value_hist[pairs[i].symbol] = 1;
+		}
+		for (unsigned int v = 0; v < num_values; v++) {
+			if (value_hist[v]) {
+				value_keys[num_value_keys++] = v;
+				value_hist[v] = 0;
+			}
 		}
 	}
 
-	bitstream[bit_write] = '\0';
-	printf("%s\n", bitstream);
-	*outBitStreamP = bitstream;
-
-	free(buffer);
-	free((void*)huffman_table);
-}
-
-void rle_naive_process_runs(
-		unsigned int const * const rle_lengths,
-		unsigned int const * const rle_values,
-		unsigned int const size) {
-
-	unsigned int symbols_huffman_size;
-	unsigned int const * symbols_huffman_table;
-	unsigned int num_symbols;
-
-	generate_huffman_table(&symbols_huffman_table, &symbols_huffman_size, &num_symbols, rle_values, 1, size);
-
-	printf("%u symbols, Huffman table %u, %u distinct values\n", num_symbols, symbols_huffman_size, num_symbols + symbols_huffman_size);
-
-	unsigned int bits = 0;
-	while(num_symbols + symbols_huffman_size > (1 << bits)) bits++;
+	unsigned int short_pairs = 0;
+	unsigned int best_cap = 2;
+	unsigned int best_cost = UINT_MAX;
+
+	// Every cap gets its exact cost. Runs no longer than the cap are
+	// folded in for good as the cap grows, so only the longer runs are
+	// split again for each cap, which over all caps is no more work than
+	// the length of the data. The values only change with the number of
+	// pieces the longer runs split into, which often stays the same from
+	// one cap to the next, and then so does their cost.
+	unsigned int value_cost = 0;
+	for (unsigned int cap = 2; cap <= cap_limit; cap++) {
+		// Runs that fit within the cap are identical for every larger cap,
+		// fold them into the histograms once and for all.
+		while (short_pairs < num_pairs && pairs[short_pairs].length <= cap) {
+			struct _rle_pair const * const p = &pairs[short_pairs++];
+			value_hist[p->symbol] += p->count;
+			if (length_hist[p->length] == 0) {
+				length_keys[num_length_keys++] = p->length;
+			}
+			length_hist[p->length] += p->count;
+		}
 
-	printf("%u bits per value node address\n", bits);
-	printf("total Huffman value table size %u bits\n", 3 + bits * (2 * symbols_huffman_size + 1));
+		// Longer runs split into full-length runs plus a remainder.
+		// Add them temporarily, remembering which lengths appeared.
+		unsigned int num_touched = 0;
+		for (unsigned int i = short_pairs; i < num_pairs; i++) {
+			struct _rle_pair const * const p = &pairs[i];
+			unsigned int const full = p->length / cap;
+			unsigned int const remainder = p->length % cap;
+			value_hist[p->symbol] += p->count * (full + (remainder ? 1 : 0));
+			if (length_hist[cap] == 0) {
+				touched_keys[num_touched++] = cap;
+			}
+			length_hist[cap] += p->count * full;
+			if (remainder) {
+				if (length_hist[remainder] == 0) {
+					touched_keys[num_touched++] = remainder;
+				}
+				length_hist[remainder] += p->count;
+			}
+		}
 
-	char** symbol_codes;
+		unsigned int num_keys = 0;
+		for (unsigned int i = 0; i < num_length_keys; i++) {
+			keys[num_keys++] = length_keys[i];
+		}
+		for (unsigned int i = 0; i < num_touched; i++) {
+			keys[num_keys++] = touched_keys[i];
+		}
+		unsigned int length_cost;
+		status = _sparse_cost(&length_cost, keys, num_keys,
+					length_hist, frequencies, code_lengths, inLengthsCoder);
+
+		int values_changed = cap == 2;
+		for (unsigned int i = 0; i < num_value_keys; i++) {
+			if (value_frequencies[i] != value_hist[value_keys[i]]) {
+				value_frequencies[i] = value_hist[value_keys[i]];
+				values_changed = 1;
+			}
+		}
+		if (status == PXQ_OK && values_changed) {
+			status = coder_sparse_cost(&value_cost, value_keys, value_frequencies, num_value_keys,
+						code_lengths, inValuesCoder);
+		}
+		if (status != PXQ_OK) {
+			break;
+		}
 
-	symbol_codes = generate_huffman_codes(symbols_huffman_table, num_symbols);
+		unsigned int const cost = length_cost + value_cost;
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_cap = cap;
+		}
 
-	for (int i = 0; i < num_symbols; i++) {
-		if (symbol_codes[i]) {
-//			printf("Symbol %u has code %s\n", i, symbol_codes[i]);
+		// Undo the temporary contributions of the longer runs
+		for (unsigned int i = short_pairs; i < num_pairs; i++) {
+			struct _rle_pair const * const p = &pairs[i];
+			unsigned int const full = p->length / cap;
+			unsigned int const remainder = p->length % cap;
+			value_hist[p->symbol] -= p->count * (full + (remainder ? 1 : 0));
+			length_hist[cap] -= p->count * full;
+			if (remainder) {
+				length_hist[remainder] -= p->count;
+			}
 		}
 	}
 
-	unsigned int lengths_huffman_size;
-	unsigned int const * lengths_huffman_table;
-	unsigned int num_lengths;
-
-	generate_huffman_table(&lengths_huffman_table, &lengths_huffman_size, &num_lengths, rle_lengths, 1, size);
-
-	bits = 0;
-	while(num_lengths + lengths_huffman_size > (1 << bits)) bits++;
-
-	printf("%u bits per length node address\n", bits);
-	printf("total Huffman length table size %u bits\n", 3 + bits * (2 * lengths_huffman_size + 1));
-
-	char** length_codes;
-
-	length_codes = generate_huffman_codes(lengths_huffman_table, num_lengths);
+	free(pairs);
+	free(value_hist);
+	free(value_keys);
+	free(value_frequencies);
+	free(length_hist);
+	free(length_keys);
+	free(touched_keys);
+	free(keys);
+	free(frequencies);
+	free(code_lengths);
+
+	*outMaxRunLength = best_cap;
+	*outCost = best_cost;
+	return status;
+}
 
-	for (unsigned int i = 0; i < num_lengths; i++) {
-		if (length_codes[i]) {
-//			printf("length %u has code %s\n", i, length_codes[i]);
-		}
+void rle_write_runs(
+		struct bit_writer * const writer,
+		unsigned int const * const inLengths,
+		unsigned int const * const inSymbols,
+		unsigned int const inSize,
+		struct stream_coder const * const lengthCoder,
+		struct stream_coder const * const symbolCoder) {
+	for (unsigned int i = 0; i < inSize; i++) {
+		coder_write_symbol(writer, lengthCoder, inLengths[i]);
+		coder_write_symbol(writer, symbolCoder, inSymbols[i]);
 	}
-	unsigned int output_bits = 0;
+}
 
-	for (unsigned i = 0; i < size; i++) {
-		output_bits += (unsigned int)strlen(length_codes[rle_lengths[i]])
-					+ (unsigned int)strlen(symbol_codes[rle_values[i]]);
+enum pxq_status rle_read_runs(
+		struct bit_reader * const reader,
+		unsigned int * const outData,
+		unsigned int const outSize,
+		struct stream_coder const * const lengthCoder,
+		struct stream_coder const * const symbolCoder) {
+	unsigned int write_offset = 0;
+	while (write_offset < outSize) {
+		unsigned int const length = coder_read_symbol(reader, lengthCoder);
+		unsigned int const symbol = coder_read_symbol(reader, symbolCoder);
+		if (reader->overrun || length == 0 || length > outSize - write_offset) {
+			return PXQ_ERROR_FORMAT;
+		}
+		for (unsigned int i = 0; i < length; i++) {
+			outData[write_offset++] = symbol;
+		}
 	}
-	printf("Total output size %u bits (= %u bytes)\n", output_bits, (output_bits + 7) / 8);
-
+	return PXQ_OK;
 }
 
-static void _allocate_arrays(
+static int _allocate_arrays(
 		unsigned int ** const lengthArrayP,
 		unsigned int ** const symbolArrayP,
 		unsigned int const array_size) {
 
-	// Allocate first array
 	*lengthArrayP = malloc(array_size * sizeof(unsigned int));
+	*symbolArrayP = malloc(array_size * sizeof(unsigned int));
 
-	// Check that allocation was successful, exit if not
-	if (!*lengthArrayP) {
-		fprintf(stderr, "%s:%d Could not allocate %lu bytes for RLE lengths\n",
-					__FILE__,
-					__LINE__,
-					array_size * sizeof(unsigned int));
-		exit(1);
+	// Check that both allocations were successful, release both if not
+	if (!*lengthArrayP || !*symbolArrayP) {
+		free(*lengthArrayP);
+		free(*symbolArrayP);
+		*lengthArrayP = NULL;
+		*symbolArrayP = NULL;
+		return 0;
 	}
 
-	// Allocate second array
-	*symbolArrayP = malloc(array_size * sizeof(unsigned int));
+	return 1;
+}
 
-	// Check that allocation was successful, exit if not
-	if (!*symbolArrayP) {
-		fprintf(stderr, "%s:%d Could not allocate %lu bytes for RLE symbols\n",
-					__FILE__,
-					__LINE__,
-					array_size * sizeof(unsigned int));
-		exit(1);
+static enum pxq_status _sparse_cost(
+		unsigned int * const outCost,
+		unsigned int * const keys,
+		unsigned int const num_keys,
+		unsigned int const * const histogram,
+		unsigned int * const frequencies,
+		unsigned char * const code_lengths,
+		enum pxq_coder const forced) {
+
+	qsort(keys, num_keys, sizeof(unsigned int), _compare_keys);
+	for (unsigned int i = 0; i < num_keys; i++) {
+		frequencies[i] = histogram[keys[i]];
 	}
 
+	return coder_sparse_cost(outCost, keys, frequencies, num_keys, code_lengths, forced);
 }
 
-static void _resize_arrays(
-		unsigned int ** const lengthArrayP,
-		unsigned int ** const symbolArrayP,
-		unsigned int const array_size) {
-
-	// Resize first array
-	*lengthArrayP = realloc(*lengthArrayP, array_size * sizeof(unsigned int));
+static int _compare_keys(void const * const v1, void const * const v2) {
+	unsigned int const k1 = *(unsigned int const *)v1;
+	unsigned int const k2 = *(unsigned int const *)v2;
+	return (k1 > k2) - (k1 < k2);
+}
 
-	// Check that resize was successful, exit if not
-	if (!*lengthArrayP) {
-		fprintf(stderr, "%s:%d Could not re-allocate %lu bytes for RLE lengths\n",
-					__FILE__,
-					__LINE__,
-					array_size * sizeof(unsigned int));
-		exit(1);
+static int _compare_pairs(void const * const v1, void const * const v2) {
+	struct _rle_pair const * const p1 = (struct _rle_pair const *)v1;
+	struct _rle_pair const * const p2 = (struct _rle_pair const *)v2;
+	if (p1->length != p2->length) {
+		return p1->length < p2->length ? -1 : 1;
 	}
-
-	// Resize second array
-	*symbolArrayP = realloc(*symbolArrayP, array_size * sizeof(unsigned int));
-
-	// Check that resize was successful, exit if not
-	if (!*symbolArrayP) {
-		fprintf(stderr, __FILE__"%s:%d Could not re-allocate %lu bytes for RLE values\n",
-					__FILE__,
-					__LINE__,
-					array_size * sizeof(unsigned int));
-		exit(1);
+	if (p1->symbol != p2->symbol) {
+		return p1->symbol < p2->symbol ? -1 : 1;
 	}
+	return 0;
 }
@@ -20,26 +20,58 @@
 #ifndef __RLE_H__
 #define __RLE_H__
 
-void rle_find_runs(
-	unsigned int const ** const outLengthP,
-	unsigned int const ** const outSymbolP,
-	unsigned int * const outSize,
+#include "bits.h"
+#include "coder.h"
+#include "pxqueeze.h"
+
+/*
+ * Splits the data into runs of identical symbols, no longer than
+ * inMaxRunLength. The output arrays must hold inSize entries.
+ * Returns the number of runs.
+ */
+unsigned int rle_find_runs(
+	unsigned int * const outLengths,
+	unsigned int * const outSymbols,
 	unsigned int const * const inData,
 	unsigned int const inSize,
 	unsigned int const inMaxRunLength);
 
-void rle_flat_table(
-	char const ** const outBitStreamP,
-	unsigned int const * const inLengthP,
-	unsigned int const * const inSymbolP,
-	unsigned int const inSize);
+/*
+ * Scans the data once without a cap on run lengths, then derives the
+ * exact value and length histograms for every cap from 2 to
+ * inMaxRunLength, and returns the cap for which the lengths and the
+ * values, each with its cheapest coder (or the forced one), produce the
+ * fewest bits, stream headers included.
+ */
+enum pxq_status rle_find_best_max_run(
+	unsigned int * const outMaxRunLength,
+	unsigned int * const outCost,
+	unsigned int const * const inData,
+	unsigned int const inSize,
+	unsigned int const inMaxRunLength,
+	enum pxq_coder const inLengthsCoder,
+	enum pxq_coder const inValuesCoder);
+
+/*
+ * One coder for lengths, one for values, that's it.
+ * Each run is written as its length followed by its value.
+ */
+void rle_write_runs(
+	struct bit_writer * const writer,
+	unsigned int const * const inLengths,
+	unsigned int const * const inSymbols,
+	unsigned int const inSize,
+	struct stream_coder const * const lengthCoder,
+	struct stream_coder const * const symbolCoder);
 
 /*
- * One Huffman table for lengths, one for values, that's it.
+ * Decodes runs until exactly outSize symbols have been produced.
  */
-void rle_naive_process_runs(
-	unsigned int const * const rle_lengths,
-	unsigned int const * const rle_values,
-	unsigned int const size);
+enum pxq_status rle_read_runs(
+	struct bit_reader * const reader,
+	unsigned int * const outData,
+	unsigned int const outSize,
+	struct stream_coder const * const lengthCoder,
+	struct stream_coder const * const symbolCoder);
 
 #endif
@@ -0,0 +1,667 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "tga.h"
+
+/*
+ * Most workers in the pool, and most connections open at once
+ */
+#define SERVER_MAX_WORKERS 64
+#define SERVER_MAX_CONNECTIONS 256
+
+/*
+ * How long a worker waits on a client that stops sending or reading
+ * in the middle of a request, in seconds
+ */
+#define SERVER_TIMEOUT 10
+
+/*
+ * Image that workers compress before taking jobs, so that their
+ * contexts are sized and their pages touched for typical screens
+ */
+#define SERVER_WARM_WIDTH 320
+#define SERVER_WARM_HEIGHT 200
+
+/*
+ * RLE cap of the quick first answer to jobs that search
+ */
+#define SERVER_FAST_RUN 128
+
+struct _server;
+
+/*
+ * One worker of the pool. Its buffers stay allocated between jobs,
+ * so that a warm worker only allocates when an image is larger than
+ * any it's seen before.
+ */
+struct _server_worker {
+	pthread_t thread;
+	struct _server * server;
+	struct pxq_context * context;
+	unsigned int num_threads;	// BWT threads of each job, its share of the processors
+	unsigned char * request;
+	size_t request_capacity;
+};
+
+/*
+ * State shared between the dispatcher, which watches the connections
+ * between requests, and the workers, which each take the next
+ * connection that has a request, answer it, and hand the connection
+ * back through the self-pipe.
+ */
+struct _server {
+	pthread_mutex_t lock;
+	pthread_cond_t jobs_ready;
+	int stopping;
+	int wake[2];
+	int jobs[SERVER_MAX_CONNECTIONS];	// connections with a request, oldest first
+	unsigned int first_job;
+	unsigned int num_jobs;
+	int returned[SERVER_MAX_CONNECTIONS];	// connections to watch again
+	unsigned int num_returned;
+	unsigned int num_closed;	// connections that workers closed
+	struct _server_worker workers[SERVER_MAX_WORKERS];
+};
+
+/*
+ * Write end of the self-pipe of the running server, and whether a
+ * signal asked it to stop: that's all a signal handler can reach
+ */
+static volatile sig_atomic_t _signal_pipe = -1;
+static volatile sig_atomic_t _signal_stop;
+
+/*
+* Helper function: watch the listener and the idle connections, and
+* queue those that have a request, until a signal stops the server
+*/
+static void _dispatch(
+		struct _server * const server,
+		int const listener);
+
+/*
+* Helper function: warm up, then answer requests as they're queued
+*/
+static void * _serve(void * const worker);
+
+/*
+* Helper function: compress a synthetic screen, to set up the context
+*/
+static void _warm_up(struct _server_worker * const worker);
+
+/*
+* Helper function: read one job from a connection and answer it
+*/
+static enum pxq_status _serve_job(
+		struct _server_worker * const worker,
+		int const connection);
+
+/*
+* Helper function: run a job with the given parameters and send the
+* result as one message of the response
+*/
+static enum pxq_status _answer(
+		struct _server_worker * const worker,
+		int const connection,
+		enum server_job const job,
+		unsigned int const * const pixels,
+		unsigned int const width,
+		unsigned int const height,
+		struct params const * const params,
+		int const final);
+
+/*
+* Helper function: read exactly the given number of bytes
+*/
+static enum pxq_status _receive(
+		int const connection,
+		unsigned char * const outData,
+		size_t const inSize);
+
+/*
+* Helper function: write exactly the given number of bytes
+*/
+static enum pxq_status _send(
+		int const connection,
+		unsigned char const * const inData,
+		size_t const inSize);
+
+/*
+* Helper function: send a status on its own, as the last message of
+* the response, for jobs that fail
+*/
+static enum pxq_status _send_status(
+		int const connection,
+		enum pxq_status const status);
+
+/*
+* Helper function: wake the dispatcher up
+*/
+static void _wake(int const pipe_end);
+
+/*
+* Helper function: stop the server on SIGINT and SIGTERM
+*/
+static void _on_signal(int const signal);
+
+/*
+* Helper function: 32-bit little-endian words
+*/
+static unsigned int _get_word(unsigned char const * const data);
+static void _put_word(unsigned char * const data, unsigned int const word);
+
+enum pxq_status server_run(
+		char const * const inPath,
+		unsigned int const inNumWorkers) {
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (!inPath || !*inPath || strlen(inPath) >= sizeof(address.sun_path)) {
+		return PXQ_ERROR_PARAMS;
+	}
+	strcpy(address.sun_path, inPath);
+
+	long const processors = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int const num_processors = processors > 0 ? (unsigned int)processors : 1;
+	unsigned int num_workers = inNumWorkers ? inNumWorkers : num_processors;
+	if (num_workers > SERVER_MAX_WORKERS) {
+		num_workers = SERVER_MAX_WORKERS;
+	}
+
+	// A socket left over from an earlier server would make bind fail,
+	// but one that a server still listens on isn't ours to remove
+	struct stat existing;
+	if (!stat(inPath, &existing) && S_ISSOCK(existing.st_mode)) {
+		int const probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (probe < 0) {
+			return PXQ_ERROR_IO;
+		}
+		int const live = !connect(probe, (struct sockaddr const *)&address, sizeof(address));
+		close(probe);
+		if (live) {
+			return PXQ_ERROR_IO;
+		}
+		unlink(inPath);
+	}
+	int const listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		return PXQ_ERROR_IO;
+	}
+	if (bind(listener, (struct sockaddr const *)&address, sizeof(address))) {
+		close(listener);
+		return PXQ_ERROR_IO;
+	}
+
+	struct _server server;
+	memset(&server, 0, sizeof(server));
+	if (listen(listener, SOMAXCONN)
+				|| fcntl(listener, F_SETFL, O_NONBLOCK)
+				|| pipe(server.wake)) {
+		close(listener);
+		unlink(inPath);
+		return PXQ_ERROR_IO;
+	}
+	fcntl(server.wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(server.wake[1], F_SETFL, O_NONBLOCK);
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.jobs_ready, NULL);
+
+	// Workers leave the signals to the dispatcher, and split the
+	// processors between them for the BWT. Their contexts are created
+	// up front, and warmed up before they take jobs.
+	sigset_t signals;
+	sigset_t previous_mask;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &previous_mask);
+	unsigned int num_started = 0;
+	while (num_started < num_workers) {
+		struct _server_worker * const worker = &server.workers[num_started];
+		worker->server = &server;
+		worker->num_threads = num_processors / num_workers ? num_processors / num_workers : 1;
+		worker->context = pxq_create_context();
+		if (!worker->context) {
+			break;
+		}
+		if (pthread_create(&worker->thread, NULL, _serve, worker)) {
+			pxq_destroy_context(worker->context);
+			break;
+		}
+		num_started++;
+	}
+	pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+
+	if (num_started) {
+		struct sigaction action;
+		struct sigaction previous_interrupt;
+		struct sigaction previous_terminate;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = _on_signal;
+		sigemptyset(&action.sa_mask);
+		_signal_stop = 0;
+		_signal_pipe = server.wake[1];
+		sigaction(SIGINT, &action, &previous_interrupt);
+		sigaction(SIGTERM, &action, &previous_terminate);
+		_dispatch(&server, listener);
+		sigaction(SIGINT, &previous_interrupt, NULL);
+		sigaction(SIGTERM, &previous_terminate, NULL);
+		_signal_pipe = -1;
+	}
+
+	// Workers finish the request they're on, connections that are
+	// still queued or handed back are closed
+	pthread_mutex_lock(&server.lock);
+	server.stopping = 1;
+	pthread_cond_broadcast(&server.jobs_ready);
+	pthread_mutex_unlock(&server.lock);
+	for (unsigned int w = 0; w < num_started; w++) {
+		pthread_join(server.workers[w].thread, NULL);
+		pxq_destroy_context(server.workers[w].context);
+		free(server.workers[w].request);
+	}
+	for (unsigned int j = 0; j < server.num_jobs; j++) {
+		close(server.jobs[(server.first_job + j) % SERVER_MAX_CONNECTIONS]);
+	}
+	for (unsigned int r = 0; r < server.num_returned; r++) {
+		close(server.returned[r]);
+	}
+	pthread_cond_destroy(&server.jobs_ready);
+	pthread_mutex_destroy(&server.lock);
+	close(server.wake[0]);
+	close(server.wake[1]);
+	close(listener);
+	unlink(inPath);
+	return num_started ? PXQ_OK : PXQ_ERROR_MEMORY;
+}
+
+static void _dispatch(
+		struct _server * const server,
+		int const listener) {
+
+	int idle[SERVER_MAX_CONNECTIONS];
+	unsigned int num_idle = 0;
+	unsigned int num_open = 0;
+	struct pollfd watched[2 + SERVER_MAX_CONNECTIONS];
+
+	while (!_signal_stop) {
+		// The listener waits while there's no room for connections
+		watched[0].fd = server->wake[0];
+		watched[0].events = POLLIN;
+		watched[1].fd = num_open < SERVER_MAX_CONNECTIONS ? listener : -1;
+		watched[1].events = POLLIN;
+		for (unsigned int i = 0; i < num_idle; i++) {
+			watched[2 + i].fd = idle[i];
+			watched[2 + i].events = POLLIN;
+		}
+		if (poll(watched, 2 + num_idle, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		// A connection that has a request, or that the client closed,
+		// goes to a worker, which reads what's there
+		pthread_mutex_lock(&server->lock);
+		for (unsigned int i = num_idle; i-- > 0; ) {
+			if (watched[2 + i].revents) {
+				server->jobs[(server->first_job + server->num_jobs) % SERVER_MAX_CONNECTIONS] = idle[i];
+				server->num_jobs++;
+				idle[i] = idle[--num_idle];
+				pthread_cond_signal(&server->jobs_ready);
+			}
+		}
+		if (watched[0].revents) {
+			char drained[64];
+			while (read(server->wake[0], drained, sizeof(drained)) > 0) {
+			}
+			for (unsigned int r = 0; r < server->num_returned; r++) {
+				idle[num_idle++] = server->returned[r];
+			}
+			server->num_returned = 0;
+			num_open -= server->num_closed;
+			server->num_closed = 0;
+		}
+		pthread_mutex_unlock(&server->lock);
+
+		if (watched[1].revents) {
+			while (num_open < SERVER_MAX_CONNECTIONS) {
+				int const connection = accept(listener, NULL, NULL);
+				if (connection < 0) {
+					if (errno == EINTR || errno == ECONNABORTED) {
+						continue;
+					}
+					break;
+				}
+				struct timeval timeout;
+				memset(&timeout, 0, sizeof(timeout));
+				timeout.tv_sec = SERVER_TIMEOUT;
+				setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+				idle[num_idle++] = connection;
+				num_open++;
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < num_idle; i++) {
+		close(idle[i]);
+	}
+}
+
+static void * _serve(void * const worker) {
+	struct _server_worker * const server_worker = (struct _server_worker *)worker;
+	struct _server * const server = server_worker->server;
+
+	_warm_up(server_worker);
+	for (;;) {
+		pthread_mutex_lock(&server->lock);
+		while (!server->num_jobs && !server->stopping) {
+			pthread_cond_wait(&server->jobs_ready, &server->lock);
+		}
+		if (server->stopping) {
+			pthread_mutex_unlock(&server->lock);
+			break;
+		}
+		int const connection = server->jobs[server->first_job];
+		server->first_job = (server->first_job + 1) % SERVER_MAX_CONNECTIONS;
+		server->num_jobs--;
+		pthread_mutex_unlock(&server->lock);
+
+		enum pxq_status const status = _serve_job(server_worker, connection);
+
+		// Between requests, the dispatcher watches the connection
+		pthread_mutex_lock(&server->lock);
+		if (status == PXQ_OK) {
+			server->returned[server->num_returned++] = connection;
+		} else {
+			close(connection);
+			server->num_closed++;
+		}
+		pthread_mutex_unlock(&server->lock);
+		_wake(server->wake[1]);
+	}
+	return NULL;
+}
+
+static void _warm_up(struct _server_worker * const worker) {
+	unsigned int const size = SERVER_WARM_WIDTH * SERVER_WARM_HEIGHT;
+	unsigned int * const pixels = malloc(size * sizeof(unsigned int));
+	if (!pixels) {
+		return;
+	}
+
+	// Bands of color with scattered pixels, so that every stage of the
+	// search has runs, tiles and rows to work through
+	unsigned int state = 1;
+	for (unsigned int i = 0; i < size; i++) {
+		state = state * 1103515245 + 12345;
+		pixels[i] = (i / SERVER_WARM_WIDTH / 8 + i % SERVER_WARM_WIDTH / 40) % 16;
+		if ((state >> 16) % 16 == 0) {
+			pixels[i] = state >> 28;
+		}
+	}
+	struct params params;
+	memset(&params, 0, sizeof(params));
+	params.num_threads = worker->num_threads;
+	unsigned char * compressed;
+	size_t compressed_size;
+	if (pxq_compress(worker->context, &compressed, &compressed_size, NULL,
+				pixels, SERVER_WARM_WIDTH, SERVER_WARM_HEIGHT, &params) == PXQ_OK) {
+		free(compressed);
+	}
+	free(pixels);
+
+	// Room for a true-color TGA of the same size
+	size_t const capacity = 18 + (size_t)size * 4;
+	worker->request = malloc(capacity);
+	if (worker->request) {
+		worker->request_capacity = capacity;
+	}
+}
+
+static enum pxq_status _serve_job(
+		struct _server_worker * const worker,
+		int const connection) {
+
+	unsigned char header[SERVER_REQUEST_WORDS * 4];
+	enum pxq_status status = _receive(connection, header, sizeof(header));
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	enum server_job const job = (enum server_job)_get_word(header);
+	struct params params;
+	memset(&params, 0, sizeof(params));
+	params.max_rle_run = _get_word(header + 4);
+	params.lengths_coder = (enum pxq_coder)_get_word(header + 8);
+	params.values_coder = (enum pxq_coder)_get_word(header + 12);
+	params.model = (enum pxq_model)_get_word(header + 16);
+	params.tile_size = _get_word(header + 20);
+	params.tile_flips = _get_word(header + 24) != 0;
+	params.predictor = (enum pxq_predictor)_get_word(header + 28);
+	params.bwt_block_size = _get_word(header + 32);
+	params.num_threads = _get_word(header + 36);
+	params.lz_window = _get_word(header + 40);
+	params.ram_budget = _get_word(header + 44);
+	size_t const size = _get_word(header + 48);
+
+	// Jobs don't get more threads than the worker's share
+	if (!params.num_threads || params.num_threads > worker->num_threads) {
+		params.num_threads = worker->num_threads;
+	}
+
+	// Without a valid job and size, the rest of the stream can't be framed
+	if (job >= SERVER_JOB_COUNT || size > SERVER_MAX_IMAGE_BYTES) {
+		_send_status(connection, PXQ_ERROR_PARAMS);
+		return PXQ_ERROR_PARAMS;
+	}
+	if (size > worker->request_capacity) {
+		unsigned char * const request = realloc(worker->request, size);
+		if (!request) {
+			_send_status(connection, PXQ_ERROR_MEMORY);
+			return PXQ_ERROR_MEMORY;
+		}
+		worker->request = request;
+		worker->request_capacity = size;
+	}
+	status = _receive(connection, worker->request, size);
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	unsigned int * pixels;
+	unsigned int width;
+	unsigned int height;
+	status = tga_decode(&pixels, &width, &height, worker->request, size);
+	if (status != PXQ_OK) {
+		return _send_status(connection, status);
+	}
+
+	// Searching takes far longer than a live preview can wait, so jobs
+	// that search first get the result of quick settings: no tiles, a
+	// fixed predictor and cap, and neither BWT nor LZ
+	if (!params.tile_size || params.predictor == PXQ_PREDICTOR_AUTO || !params.max_rle_run) {
+		struct params fast = params;
+		fast.tile_size = params.tile_size ? params.tile_size : 1;
+		fast.predictor = params.predictor != PXQ_PREDICTOR_AUTO
+					? params.predictor : PXQ_PREDICTOR_UP;
+		fast.max_rle_run = params.max_rle_run ? params.max_rle_run : SERVER_FAST_RUN;
+		fast.bwt_block_size = 0;
+		fast.lz_window = 0;
+		status = _answer(worker, connection, job, pixels, width, height, &fast, 0);
+	}
+	if (status == PXQ_OK) {
+		status = _answer(worker, connection, job, pixels, width, height, &params, 1);
+	}
+	free(pixels);
+	return status;
+}
+
+static enum pxq_status _answer(
+		struct _server_worker * const worker,
+		int const connection,
+		enum server_job const job,
+		unsigned int const * const pixels,
+		unsigned int const width,
+		unsigned int const height,
+		struct params const * const params,
+		int const final) {
+
+	struct pxq_stats stats;
+	unsigned char * compressed = NULL;
+	size_t compressed_size = 0;
+	enum pxq_status status;
+	if (job == SERVER_JOB_ESTIMATE) {
+		status = pxq_estimate(worker->context, &stats, pixels, width, height, params);
+	} else {
+		status = pxq_compress(worker->context, &compressed, &compressed_size, &stats,
+					pixels, width, height, params);
+	}
+
+	// A first answer that fails is left out, the last one says why
+	if (status != PXQ_OK) {
+		return final ? _send_status(connection, status) : PXQ_OK;
+	}
+
+	unsigned int const words[2 + SERVER_STATS_WORDS + 1] = {
+		PXQ_OK,
+		final,
+		stats.width,
+		stats.height,
+		stats.total_bits,
+		stats.header_bits,
+		stats.tile_size,
+		stats.unique_tiles,
+		stats.palette_size,
+		stats.bwt_blocks,
+		stats.lz.window,
+		stats.tile_size ? stats.map.total_bits : 0,
+		stats.pixels.total_bits,
+		stats.ram.peak,
+		stats.ram.tables,
+		stats.ram.tile_map,
+		stats.ram.tile_dictionary,
+		stats.ram.predictors,
+		stats.ram.bwt_block,
+		stats.ram.mtf,
+		stats.ram.lz_window,
+		(unsigned int)compressed_size,
+	};
+	unsigned char response[sizeof(words)];
+	for (unsigned int w = 0; w < sizeof(words) / sizeof(words[0]); w++) {
+		_put_word(response + w * 4, words[w]);
+	}
+	status = _send(connection, response, sizeof(response));
+	if (status == PXQ_OK && compressed_size) {
+		status = _send(connection, compressed, compressed_size);
+	}
+	free(compressed);
+	return status;
+}
+
+static enum pxq_status _receive(
+		int const connection,
+		unsigned char * const outData,
+		size_t const inSize) {
+
+	size_t done = 0;
+	while (done < inSize) {
+		ssize_t const received = recv(connection, outData + done, inSize - done, 0);
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+		if (received <= 0) {
+			return PXQ_ERROR_IO;
+		}
+		done += (size_t)received;
+	}
+	return PXQ_OK;
+}
+
+static enum pxq_status _send(
+		int const connection,
+		unsigned char const * const inData,
+		size_t const inSize) {
+
+	size_t done = 0;
+	while (done < inSize) {
+		// A client that hangs up must not kill the server with SIGPIPE
+		ssize_t const sent = send(connection, inData + done, inSize - done, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			return PXQ_ERROR_IO;
+		}
+		done += (size_t)sent;
+	}
+	return PXQ_OK;
+}
+
+static enum pxq_status _send_status(
+		int const connection,
+		enum pxq_status const status) {
+	unsigned char response[8];
+	_put_word(response, status);
+	_put_word(response + 4, 1);
+	return _send(connection, response, sizeof(response));
+}
+
+static void _wake(int const pipe_end) {
+	// A full pipe wakes the dispatcher up just as well
+	ssize_t const written = write(pipe_end, "", 1);
+	(void)written;
+}
+
+static void _on_signal(int const signal) {
+	(void)signal;
+	int const saved_errno = errno;
+	_signal_stop = 1;
+	if (_signal_pipe >= 0) {
+		_wake(_signal_pipe);
+	}
+	errno = saved_errno;
+}
+
+static unsigned int _get_word(unsigned char const * const data) {
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+}
+
+static void _put_word(unsigned char * const data, unsigned int const word) {
+	data[0] = word & 0xFF;
+	data[1] = (word >> 8) & 0xFF;
+	data[2] = (word >> 16) & 0xFF;
+	data[3] = word >> 24;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "pxqueeze.h"
+
+/*
+ * Jobs that clients send. Compressing returns the statistics and the
+ * compressed data, estimating only returns the statistics. Parameters
+ * left at 0 are searched, as with pxq_compress.
+ */
+enum server_job {
+	SERVER_JOB_COMPRESS = 0,
+	SERVER_JOB_ESTIMATE,
+	SERVER_JOB_COUNT,
+};
+
+/*
+ * Largest TGA image that a job can carry, in bytes
+ */
+#define SERVER_MAX_IMAGE_BYTES (16 * 1024 * 1024)
+
+/*
+ * Words of a request header, and of the statistics in a response
+ */
+#define SERVER_REQUEST_WORDS 13
+#define SERVER_STATS_WORDS 19
+
+/*
+ * Serves jobs on a Unix stream socket, with a pool of workers that
+ * each keep their own context and request buffer from one job to the
+ * next, warmed up on a synthetic screen before they take any job. A
+ * connection can carry any number of jobs one after the other, each
+ * answered by whichever worker is free, with its share of the
+ * processors for the BWT at most. All words are 32 bits, little-endian.
+ *
+ * A request is the job, the fields of struct params in order from
+ * max_rle_run to ram_budget, and the size of the image in bytes,
+ * followed by the image as an uncompressed TGA file.
+ *
+ * A response is one or more messages. Each starts with an enum
+ * pxq_status, then 1 if it's the last message of the response or 0 if
+ * another follows. If the status is PXQ_OK, the message goes on with
+ * the statistics: width, height, total bits, header bits, tile size,
+ * unique tiles, palette size, BWT blocks and LZ window, the bits of
+ * the tile map and of the pixels, then the decoder RAM: peak, tables,
+ * tile map, tile dictionary, predictors, BWT block, move-to-front and
+ * LZ window. It ends with the size of the compressed data in bytes and
+ * the data itself, or 0 when estimating. Jobs that search for the tile
+ * size, the predictor or the RLE cap first get a message with the
+ * result of quick settings, in a few milliseconds for a screen, then
+ * the last message with the result of the search.
+ *
+ * The server closes the connection after a request it can't read to
+ * the end, or that stalls for more than a few seconds. It doesn't
+ * replace a socket that another server still listens on. It returns
+ * once SIGINT or SIGTERM stops it, after the requests that workers are
+ * on are answered, and removes the socket. Otherwise, it only returns
+ * if it can't set up the socket or start any worker. Only one server
+ * can run in a process at a time.
+ */
+enum pxq_status server_run(
+		char const * const inPath,
+		unsigned int const inNumWorkers);
+
+#endif
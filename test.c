@@ -0,0 +1,1244 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bits.h"
+#include "coder.h"
+#include "huffman.h"
+#include "model.h"
+#include "predict.h"
+#include "pxqueeze.h"
+#include "rle.h"
+#include "server.h"
+#include "tga.h"
+#include "tile.h"
+
+/*
+ * Checks of each stage, on synthetic images, from the RLE cap search
+ * up. Each test reports what it checks on failure, and the run fails if
+ * any test does.
+ */
+
+static unsigned int _failures;
+
+/*
+* Helper function: report a failed check
+*/
+static void _check(
+		int const condition,
+		char const * const test,
+		char const * const what);
+
+/*
+* Helper function: xorshift generator, so that every run sees the same data
+*/
+static unsigned int _random(unsigned int * const state);
+
+/*
+* Helper function: exact size of the runs of the data for a given cap,
+* each stream with its cheapest coder or the forced one
+*/
+static unsigned int _rle_cost(
+		unsigned int const * const data,
+		unsigned int const size,
+		unsigned int const max_run,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder);
+
+/*
+* Helper function: a synthetic screen, bands of color with 8x8 sprites
+* on a tile grid, some of them mirrored, flipped or both, and a few
+* scattered pixels
+*/
+static void _make_screen(
+		unsigned int * const pixels,
+		unsigned int const width,
+		unsigned int const height,
+		unsigned int const seed);
+
+/*
+* Helper function: symbols made of a few random words, over and over in
+* random order, which is what the BWT and LZ do best with
+*/
+static void _make_words(
+		unsigned int * const pixels,
+		unsigned int const size,
+		unsigned int const seed);
+
+/*
+* Helper function: compress, decompress and compare, returns the status
+* of the compression
+*/
+static enum pxq_status _round_trip(
+		char const * const test,
+		unsigned int const * const pixels,
+		unsigned int const width,
+		unsigned int const height,
+		struct params const * const params,
+		struct pxq_stats * const outStats);
+
+/*
+* Helper function: send a server request, with the job and parameters
+* as words and the image as a TGA file
+*/
+static int _server_request(
+		int const connection,
+		unsigned int const * const words,
+		unsigned char const * const tga,
+		size_t const tga_size);
+
+/*
+* Helper function: read one message of a server response, its status,
+* final flag, statistics and compressed data size as words
+*/
+static int _server_message(
+		int const connection,
+		unsigned int * const outWords,
+		unsigned char * * const outData);
+
+static void _test_rle_caps(void);
+static void _test_tiles(void);
+static void _test_predictors(void);
+static void _test_models(void);
+static void _test_library(void);
+static void _test_huffman(void);
+static void _test_ram_budget(void);
+static void _test_sequences(void);
+static void _test_bwt_blocks(void);
+static void _test_lz(void);
+static void _test_server(void);
+
+int main(void) {
+	_test_rle_caps();
+	_test_tiles();
+	_test_predictors();
+	_test_models();
+	_test_library();
+	_test_huffman();
+	_test_ram_budget();
+	_test_sequences();
+	_test_bwt_blocks();
+	_test_lz();
+	_test_server();
+
+	if (_failures) {
+		printf("%u checks failed\n", _failures);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
+
+/*
+ * The cap search derives the runs of every cap from histograms, without
+ * splitting the data again: the cost it reports must be that of the
+ * runs at the cap it picks, and no cap within the limit may cost less.
+ */
+static void _test_rle_caps(void) {
+	static enum pxq_coder const coders[][2] = {
+		{ PXQ_CODER_AUTO, PXQ_CODER_AUTO },
+		{ PXQ_CODER_GOLOMB, PXQ_CODER_HUFFMAN },
+		{ PXQ_CODER_GAMMA, PXQ_CODER_DELTA },
+	};
+	static unsigned int const shared[] = { 6, 12, 15 };
+	static unsigned int const limits[] = { 9, 65534 };
+	unsigned int const size = 3000;
+	unsigned int * const data = malloc(size * sizeof(unsigned int));
+	if (!data) {
+		_check(0, "rle caps", "allocation");
+		return;
+	}
+
+	for (unsigned int seed = 0; seed <= 4; seed++) {
+		// Runs of 6, 12 and 15 of two values in turn first, where caps that
+		// are the length of no run, like 3, can cost the least, then random
+		// runs, some of them long
+		unsigned int state = 1 + seed;
+		unsigned int const longest = seed == 4 ? 1000 : 20 << seed;
+		unsigned int count = 0;
+		for (unsigned int run = 0; count < size; run++) {
+			unsigned int length;
+			unsigned int value;
+			if (seed == 0) {
+				length = shared[_random(&state) % 3];
+				value = run % 2;
+				if (length > size - count) {
+					// Whole runs only, none cut to another length
+					break;
+				}
+			} else {
+				length = 1 + _random(&state) % 8;
+				if (_random(&state) % 16 == 0) {
+					length = 1 + _random(&state) % longest;
+				}
+				value = _random(&state) % 12;
+			}
+			for (unsigned int k = 0; k < length && count < size; k++) {
+				data[count++] = value;
+			}
+		}
+		unsigned int last_cap = 2;
+		for (unsigned int i = 0, length = 1; i + 1 < count; i++) {
+			length = data[i + 1] == data[i] ? length + 1 : 1;
+			if (length > last_cap) {
+				last_cap = length;
+			}
+		}
+
+		for (unsigned int l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+			for (unsigned int c = 0; c < sizeof(coders) / sizeof(coders[0]); c++) {
+				unsigned int max_run;
+				unsigned int cost;
+				enum pxq_status const status = rle_find_best_max_run(&max_run, &cost,
+							data, count, limits[l], coders[c][0], coders[c][1]);
+				_check(status == PXQ_OK, "rle caps", "search fails");
+				if (status != PXQ_OK) {
+					continue;
+				}
+				_check(max_run >= 2 && max_run <= limits[l], "rle caps", "cap out of range");
+				_check(cost == _rle_cost(data, count, max_run, coders[c][0], coders[c][1]),
+							"rle caps", "reported cost differs from the runs at that cap");
+
+				// Caps beyond the longest run all produce the same runs
+				int cheapest = 1;
+				for (unsigned int cap = 2; cap <= last_cap && cap <= limits[l]; cap++) {
+					cheapest = cheapest
+								&& _rle_cost(data, count, cap, coders[c][0], coders[c][1]) >= cost;
+				}
+				_check(cheapest, "rle caps", "a cap costs less than the one picked");
+			}
+		}
+	}
+	free(data);
+}
+
+/*
+ * Tiles are deduplicated at every size, numbered by first appearance,
+ * and drawn back into the image; sprites that are only mirrored or
+ * flipped copies of each other share a unique tile once flips are on.
+ */
+static void _test_tiles(void) {
+	static unsigned int const tile_sizes[] = { 8, 16, 32 };
+	unsigned int const width = 128;
+	unsigned int const height = 96;
+	unsigned int pixels[128 * 96];
+	unsigned int drawn[128 * 96];
+	_make_screen(pixels, width, height, 7);
+
+	unsigned int num_unique[2][3];
+	for (int flips = 0; flips <= 1; flips++) {
+		for (unsigned int s = 0; s < 3; s++) {
+			unsigned int const tile_size = tile_sizes[s];
+			struct tile_index index;
+			enum pxq_status status = tile_build_index(&index, pixels, width, height,
+						tile_size, flips);
+			_check(status == PXQ_OK, "tiles", "index fails");
+			if (status != PXQ_OK) {
+				continue;
+			}
+			num_unique[flips][s] = index.num_unique;
+			_check(index.tiles_x == width / tile_size && index.tiles_y == height / tile_size,
+						"tiles", "wrong map size");
+
+			unsigned int seen = 0;
+			for (unsigned int t = 0; t < index.tiles_x * index.tiles_y; t++) {
+				unsigned int const unique = flips ? index.map[t] >> TILE_FLIP_BITS : index.map[t];
+				_check(unique <= seen, "tiles", "tiles out of order");
+				if (unique == seen) {
+					seen++;
+				}
+			}
+			_check(seen == index.num_unique, "tiles", "unused unique tiles");
+
+			status = tile_expand(drawn, width, height, tile_size, flips,
+						index.unique, index.num_unique, index.map);
+			_check(status == PXQ_OK && !memcmp(drawn, pixels, sizeof(pixels)),
+						"tiles", "map draws a different image");
+			tile_free_index(&index);
+		}
+	}
+	_check(num_unique[1][0] < num_unique[0][0], "tiles", "flips don't share tiles");
+
+	struct tile_index index;
+	_check(tile_build_index(&index, pixels, width, height - 4, 8, 0) == PXQ_ERROR_PARAMS,
+				"tiles", "partial tiles are accepted");
+
+	// Through the library, with the size and flips given or searched
+	struct params params;
+	memset(&params, 0, sizeof(params));
+	params.predictor = PXQ_PREDICTOR_NONE;
+	params.tile_size = 8;
+	params.tile_flips = 1;
+	struct pxq_stats stats;
+	_check(_round_trip("tiles", pixels, width, height, &params, &stats) == PXQ_OK
+				&& stats.tile_size == 8
+				&& stats.unique_tiles == num_unique[stats.tile_flips != 0][0],
+				"tiles", "compression fails");
+	params.tile_size = 0;
+	_check(_round_trip("tiles", pixels, width, height, &params, &stats) == PXQ_OK,
+				"tiles", "search fails");
+	params.tile_size = 8;
+	_check(_round_trip("tiles", pixels, width, height - 4, &params, &stats) == PXQ_ERROR_PARAMS,
+				"tiles", "partial tiles are compressed");
+}
+
+/*
+ * Every predictor, and any mix of them from row to row, decodes back
+ * to the symbols with residuals in the same range; the choice of each
+ * row finds the predictor that leaves nothing to code, and searching
+ * for predictors pays off on gradients.
+ */
+static void _test_predictors(void) {
+	unsigned int const width = 40;
+	unsigned int const height = 30;
+	unsigned int const num_symbols = 13;
+	unsigned int symbols[40 * 30];
+	unsigned int residuals[40 * 30];
+	unsigned int decoded[40 * 30];
+	unsigned char predictors[30];
+	unsigned int state = 21;
+	for (unsigned int i = 0; i < width * height; i++) {
+		symbols[i] = (i % width + i / width * 3 + _random(&state) % 2) % num_symbols;
+	}
+
+	for (unsigned int p = 0; p <= PXQ_PREDICTOR_COUNT; p++) {
+		// Then one random predictor per row
+		for (unsigned int y = 0; y < height; y++) {
+			predictors[y] = p < PXQ_PREDICTOR_COUNT && p != PXQ_PREDICTOR_AUTO ? p
+						: PXQ_PREDICTOR_NONE + _random(&state) % (PXQ_PREDICTOR_COUNT - 1);
+		}
+		enum pxq_status status = predict_encode(residuals, symbols, width, height,
+					num_symbols, predictors);
+		if (status == PXQ_OK) {
+			status = predict_decode(decoded, residuals, width, height, num_symbols, predictors);
+		}
+		_check(status == PXQ_OK, "predictors", "prediction fails");
+		int in_range = 1;
+		for (unsigned int i = 0; i < width * height; i++) {
+			in_range = in_range && residuals[i] < num_symbols;
+		}
+		_check(in_range, "predictors", "residuals out of range");
+		_check(!memcmp(decoded, symbols, sizeof(symbols)), "predictors", "decodes differently");
+	}
+
+	// Rows that repeat the one above, then rows of one symbol each
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			symbols[y * width + x] = y < height / 2 ? 1 + x * 7 % 12 : 1 + y % 12;
+		}
+	}
+	enum pxq_status status = predict_choose(predictors, symbols, width, height, num_symbols);
+	if (status == PXQ_OK) {
+		status = predict_encode(residuals, symbols, width, height, num_symbols, predictors);
+	}
+	_check(status == PXQ_OK, "predictors", "choice fails");
+	unsigned int leftover = 0;
+	for (unsigned int y = 1; y < height; y++) {
+		for (unsigned int x = y < height / 2 ? 0 : 1; x < width; x++) {
+			leftover += residuals[y * width + x] != 0;
+		}
+	}
+	_check(leftover == 0, "predictors", "rows left with residuals");
+
+	// Through the library, searching or not
+	unsigned int const screen_width = 160;
+	unsigned int const screen_height = 100;
+	unsigned int screen[160 * 100];
+	for (unsigned int y = 0; y < screen_height; y++) {
+		for (unsigned int x = 0; x < screen_width; x++) {
+			screen[y * screen_width + x] = (x + 2 * y) % 32;
+		}
+	}
+	struct params params;
+	memset(&params, 0, sizeof(params));
+	params.tile_size = 1;
+	params.predictor = PXQ_PREDICTOR_NONE;
+	struct pxq_stats plain;
+	struct pxq_stats predicted;
+	_check(_round_trip("predictors", screen, screen_width, screen_height, &params, &plain)
+				== PXQ_OK, "predictors", "compression fails");
+	params.predictor = PXQ_PREDICTOR_AUTO;
+	_check(_round_trip("predictors", screen, screen_width, screen_height, &params, &predicted)
+				== PXQ_OK, "predictors", "search fails");
+	unsigned int rows = 0;
+	for (unsigned int p = 0; p < PXQ_PREDICTOR_COUNT; p++) {
+		rows += predicted.predictor_rows[p];
+	}
+	_check(predicted.palette_size && rows == screen_height, "predictors", "rows not predicted");
+	_check(predicted.total_bits < plain.total_bits / 2, "predictors", "gradient not predicted");
+	for (unsigned int p = PXQ_PREDICTOR_LEFT; p < PXQ_PREDICTOR_COUNT; p++) {
+		params.predictor = (enum pxq_predictor)p;
+		_check(_round_trip("predictors", screen, screen_width, screen_height, &params, &predicted)
+					== PXQ_OK, "predictors", "compression fails");
+	}
+}
+
+/*
+ * Each model round-trips when forced, and the search picks the
+ * cheapest: pairs for runs that come in a few shapes, contexts for
+ * values that follow from the previous one. Both keep their tables
+ * within bounds on streams with more pairs or previous values than
+ * they can hold.
+ */
+static void _test_models(void) {
+	unsigned int const width = 256;
+	unsigned int const height = 64;
+	unsigned int const size = width * height;
+	unsigned int * const pixels = malloc(size * sizeof(unsigned int));
+	if (!pixels) {
+		_check(0, "models", "allocation");
+		return;
+	}
+
+	struct params params;
+	memset(&params, 0, sizeof(params));
+	params.tile_size = 1;
+	params.predictor = PXQ_PREDICTOR_NONE;
+	params.max_rle_run = 64;
+
+	for (unsigned int kind = 0; kind < 4; kind++) {
+		// Runs of a few shapes, then of many, then values that follow
+		// each other in a cycle, short or long
+		unsigned int const num_values = kind == 0 ? 4 : kind == 1 ? 40 : kind == 2 ? 8 : 48;
+		unsigned int state = 5 + kind;
+		unsigned int value = 0;
+		for (unsigned int i = 0; i < size; ) {
+			unsigned int const pick = _random(&state);
+			unsigned int length;
+			if (kind < 2) {
+				value = (value + 1 + pick % (num_values - 1)) % num_values;
+				length = kind == 0 ? 2 + value * 3 : 1 + (pick >> 8) % 24;
+			} else {
+				value = (value + 1 + (pick % 16 == 0)) % num_values;
+				length = 1 + (pick >> 8) % 16;
+			}
+			for (unsigned int r = 0; r < length && i < size; r++) {
+				pixels[i++] = value;
+			}
+		}
+
+		struct pxq_stats stats[PXQ_MODEL_COUNT];
+		for (unsigned int m = 0; m < PXQ_MODEL_COUNT; m++) {
+			params.model = (enum pxq_model)m;
+			enum pxq_status const status = _round_trip("models", pixels, width, height,
+						&params, &stats[m]);
+			_check(status == PXQ_OK, "models", "compression fails");
+			if (status != PXQ_OK) {
+				free(pixels);
+				return;
+			}
+			_check(m == PXQ_MODEL_AUTO || stats[m].pixels.model == m,
+						"models", "forced model not used");
+		}
+		for (unsigned int m = PXQ_MODEL_INDEPENDENT; m < PXQ_MODEL_COUNT; m++) {
+			_check(stats[PXQ_MODEL_AUTO].total_bits <= stats[m].total_bits,
+						"models", "search misses the cheapest model");
+		}
+		_check(stats[PXQ_MODEL_PAIRS].pixels.model_symbols <= MODEL_MAX_PAIRS
+					&& stats[PXQ_MODEL_CONTEXT].pixels.model_symbols <= MODEL_MAX_CONTEXTS,
+					"models", "tables too large");
+
+		struct pxq_stream_stats const * const picked = &stats[PXQ_MODEL_AUTO].pixels;
+		if (kind == 0) {
+			// Only the last run, cut short, can escape
+			_check(picked->model == PXQ_MODEL_PAIRS && picked->escapes <= 1,
+						"models", "pairs not picked");
+		} else if (kind == 1) {
+			_check(stats[PXQ_MODEL_PAIRS].pixels.escapes > 0, "models", "no escapes");
+		} else {
+			_check(picked->model == PXQ_MODEL_CONTEXT, "models", "contexts not picked");
+		}
+	}
+	free(pixels);
+}
+
+/*
+ * The entry points check their arguments, estimating reports what
+ * compressing produces, and a decoded image survives a trip through a
+ * TGA file.
+ */
+static void _test_library(void) {
+	unsigned int const width = 64;
+	unsigned int const height = 48;
+	unsigned int pixels[64 * 48];
+	for (unsigned int i = 0; i < width * height; i++) {
+		pixels[i] = (i % width / 8 + i / width / 6) % 32;
+	}
+	struct params params;
+	memset(&params, 0, sizeof(params));
+
+	struct pxq_context * const context = pxq_create_context();
+	if (!context) {
+		_check(0, "library", "no context");
+		return;
+	}
+
+	struct pxq_stats estimate;
+	struct pxq_stats stats;
+	_check(pxq_estimate(context, NULL, pixels, width, height, &params) == PXQ_ERROR_PARAMS,
+				"library", "estimate without statistics is accepted");
+	_check(pxq_estimate(context, &estimate, pixels, 0, height, &params) == PXQ_ERROR_PARAMS,
+				"library", "empty image is accepted");
+	_check(pxq_estimate(context, &estimate, pixels, width, height, &params) == PXQ_OK,
+				"library", "estimate fails");
+
+	unsigned char * compressed;
+	size_t compressed_size;
+	enum pxq_status status = pxq_compress(context, &compressed, &compressed_size, NULL,
+				pixels, width, height, &params);
+	_check(status == PXQ_OK, "library", "compress without statistics fails");
+	if (status == PXQ_OK) {
+		free(compressed);
+	}
+	status = pxq_compress(context, &compressed, &compressed_size, &stats,
+				pixels, width, height, &params);
+	_check(status == PXQ_OK, "library", "compress fails");
+	if (status != PXQ_OK) {
+		pxq_destroy_context(context);
+		return;
+	}
+	_check(estimate.total_bits == stats.total_bits, "library", "estimate differs");
+	_check((stats.total_bits + 7) / 8 == compressed_size, "library", "size differs");
+
+	unsigned int * decompressed;
+	unsigned int decompressed_width;
+	unsigned int decompressed_height;
+	_check(pxq_decompress(context, &decompressed, &decompressed_width, &decompressed_height,
+				compressed, compressed_size / 2) == PXQ_ERROR_FORMAT,
+				"library", "truncated data is accepted");
+	status = pxq_decompress(context, &decompressed, &decompressed_width, &decompressed_height,
+				compressed, compressed_size);
+	free(compressed);
+	_check(status == PXQ_OK, "library", "decompress fails");
+	if (status == PXQ_OK) {
+		unsigned char * tga;
+		size_t tga_size;
+		unsigned int * decoded;
+		unsigned int decoded_width;
+		unsigned int decoded_height;
+		status = tga_encode(&tga, &tga_size, decompressed, decompressed_width, decompressed_height);
+		if (status == PXQ_OK) {
+			status = tga_decode(&decoded, &decoded_width, &decoded_height, tga, tga_size);
+			free(tga);
+		}
+		_check(status == PXQ_OK, "library", "TGA round trip fails");
+		if (status == PXQ_OK) {
+			_check(decoded_width == width && decoded_height == height
+						&& !memcmp(decoded, pixels, sizeof(pixels)),
+						"library", "TGA round trip differs");
+			free(decoded);
+		}
+		free(decompressed);
+	}
+	pxq_destroy_context(context);
+}
+
+/*
+ * Tables read back from their serialized form decode every symbol,
+ * through the lookup table for short codes and through the length
+ * counts for long ones, up to the longest allowed, right up to the end
+ * of the data. Both ways of costing a table give its written size.
+ */
+static void _test_huffman(void) {
+	unsigned int const num_symbols = 300;
+	unsigned int frequencies[300];
+	unsigned int symbols[2000];
+
+	for (unsigned int shape = 0; shape < 3; shape++) {
+		unsigned int state = 7 + shape;
+		for (unsigned int s = 0; s < num_symbols; s++) {
+			if (shape == 0) {
+				frequencies[s] = 1 + _random(&state) % 100;
+			} else if (shape == 1) {
+				// Halving frequencies make codes as long as allowed
+				frequencies[s] = s < 30 ? 1U << (30 - s) : 1;
+			} else {
+				frequencies[s] = s % 3 ? 0 : 1 + _random(&state) % 5;
+			}
+		}
+
+		struct huffman_table table;
+		if (huffman_build_table(&table, frequencies, num_symbols) != PXQ_OK) {
+			_check(0, "huffman", "table build fails");
+			continue;
+		}
+		unsigned int longest = 0;
+		for (unsigned int s = 0; s < table.num_symbols; s++) {
+			if (table.code_lengths[s] > longest) {
+				longest = table.code_lengths[s];
+			}
+		}
+		_check(shape != 1 || longest == HUFFMAN_MAX_LENGTH, "huffman", "no long codes");
+
+		struct bit_writer writer;
+		bits_init_writer(&writer);
+		huffman_write_table(&writer, &table);
+		unsigned int occurring[300];
+		unsigned char lengths[300];
+		unsigned int num_occurring = 0;
+		for (unsigned int s = 0; s < table.num_symbols; s++) {
+			if (table.code_lengths[s]) {
+				occurring[num_occurring] = s;
+				lengths[num_occurring++] = table.code_lengths[s];
+			}
+		}
+		_check(writer.size == huffman_serialized_bits(&table)
+					&& writer.size == huffman_table_bits(occurring, lengths, num_occurring),
+					"huffman", "table size differs from its cost");
+		unsigned int const count = sizeof(symbols) / sizeof(symbols[0]);
+		for (unsigned int i = 0; i < count; i++) {
+			// Every symbol that has a code, then random ones
+			unsigned int s = i < num_symbols ? i : _random(&state) % num_symbols;
+			while (!frequencies[s]) {
+				s = (s + 1) % num_symbols;
+			}
+			symbols[i] = s;
+			huffman_write_symbol(&writer, &table, s);
+		}
+		size_t const bits = writer.size;
+		huffman_free_table(&table);
+		_check(!writer.failed, "huffman", "write fails");
+
+		struct bit_reader reader;
+		bits_init_reader(&reader, writer.data, (bits + 7) / 8);
+		enum pxq_status const status = huffman_read_table(&table, &reader);
+		_check(status == PXQ_OK, "huffman", "table read fails");
+		if (status == PXQ_OK) {
+			_check(table.lookup != NULL, "huffman", "no lookup table");
+			unsigned int mismatches = 0;
+			for (unsigned int i = 0; i < count; i++) {
+				if (huffman_read_symbol(&reader, &table) != symbols[i]) {
+					mismatches++;
+				}
+			}
+			_check(!mismatches && !reader.overrun && reader.position == bits,
+						"huffman", "decoded symbols differ");
+			// Padding up to the next byte may hold a few more codes
+			for (unsigned int i = 0; i < 8; i++) {
+				huffman_read_symbol(&reader, &table);
+			}
+			_check(reader.overrun, "huffman", "reading past the end isn't reported");
+			huffman_free_table(&table);
+		}
+		bits_free_writer(&writer);
+	}
+}
+
+/*
+ * Every stage stays within the budget, falling back to smaller BWT
+ * blocks, a smaller LZ window or table-free coders, and a budget that
+ * nothing fits is reported as such.
+ */
+static void _test_ram_budget(void) {
+	static unsigned int const budgets[] = { 0, 8192, 2048, 1024, 300, 100, 40 };
+	unsigned int const width = 128;
+	unsigned int const height = 96;
+	unsigned int * const pixels = malloc(width * height * sizeof(unsigned int));
+	if (!pixels) {
+		_check(0, "RAM budget", "allocation");
+		return;
+	}
+
+	for (unsigned int stages = 0; stages < 3; stages++) {
+		if (stages == 1) {
+			_make_words(pixels, width * height, 3);
+		} else {
+			_make_screen(pixels, width, height, 3);
+		}
+		unsigned int smallest = ~0U;
+		for (unsigned int b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++) {
+			struct params params;
+			memset(&params, 0, sizeof(params));
+			params.bwt_block_size = stages == 1 ? 4096 : 0;
+			params.lz_window = stages == 2 ? 8192 : 0;
+			params.ram_budget = budgets[b];
+			struct pxq_stats stats;
+			enum pxq_status const status = _round_trip("RAM budget", pixels, width, height,
+						&params, &stats);
+			_check(status == PXQ_OK, "RAM budget", "compression fails within the budget");
+			if (status != PXQ_OK) {
+				continue;
+			}
+			_check(!budgets[b] || stats.ram.peak <= budgets[b], "RAM budget", "over the budget");
+			_check(stages != 1 || budgets[b] < 2048 || stats.bwt_blocks, "RAM budget",
+						"BWT blocks don't shrink to fit");
+			_check(stats.total_bits >= smallest || b == 0, "RAM budget",
+						"a smaller budget compresses better");
+			smallest = stats.total_bits;
+		}
+
+		struct params params;
+		memset(&params, 0, sizeof(params));
+		params.bwt_block_size = stages == 1 ? 4096 : 0;
+		params.lz_window = stages == 2 ? 8192 : 0;
+		params.ram_budget = 2;
+		struct pxq_stats stats;
+		struct pxq_context * const context = pxq_create_context();
+		_check(context && pxq_estimate(context, &stats, pixels, width, height, &params)
+					== PXQ_ERROR_BUDGET, "RAM budget", "impossible budget isn't reported");
+		pxq_destroy_context(context);
+	}
+	free(pixels);
+}
+
+/*
+ * Frames that change a little from one to the next decode back, with
+ * any model, and within a budget that forces table-free coders on
+ * frames whose own tables don't fit. The stages of single images are
+ * refused.
+ */
+static void _test_sequences(void) {
+	static unsigned int const budgets[] = { 0, 200, 16, 2 };
+	unsigned int const width = 96;
+	unsigned int const height = 64;
+	unsigned int const size = width * height;
+	unsigned int const num_frames = 5;
+	unsigned int * const frames = malloc(num_frames * size * sizeof(unsigned int));
+	unsigned int const * pointers[5];
+	if (!frames) {
+		_check(0, "sequences", "allocation");
+		return;
+	}
+	_make_screen(frames, width, height, 11);
+	unsigned int state = 11;
+	for (unsigned int k = 1; k < num_frames; k++) {
+		memcpy(frames + k * size, frames + (k - 1) * size, size * sizeof(unsigned int));
+		for (unsigned int i = 0; i < 40; i++) {
+			unsigned int const start = _random(&state) % (size - 8);
+			for (unsigned int x = 0; x < 8; x++) {
+				frames[k * size + start + x] = (k + i) % 16;
+			}
+		}
+	}
+	for (unsigned int k = 0; k < num_frames; k++) {
+		pointers[k] = frames + k * size;
+	}
+
+	struct pxq_context * const context = pxq_create_context();
+	for (unsigned int stage = 0; stage < 4 && context; stage++) {
+		struct params params;
+		memset(&params, 0, sizeof(params));
+		params.tile_size = stage == 0 ? 8 : 1;
+		params.predictor = stage == 1 ? PXQ_PREDICTOR_LEFT : PXQ_PREDICTOR_NONE;
+		params.bwt_block_size = stage == 2 ? 4096 : 0;
+		params.lz_window = stage == 3 ? 256 : 0;
+		unsigned char * compressed = NULL;
+		size_t compressed_size;
+		_check(pxq_compress_sequence(context, &compressed, &compressed_size, NULL,
+					pointers, num_frames, width, height, &params) == PXQ_ERROR_PARAMS,
+					"sequences", "single image stage accepted");
+		free(compressed);
+	}
+	for (unsigned int m = PXQ_MODEL_AUTO; m < PXQ_MODEL_COUNT && context; m++) {
+		for (unsigned int b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++) {
+			struct params params;
+			memset(&params, 0, sizeof(params));
+			params.model = (enum pxq_model)m;
+			params.ram_budget = budgets[b];
+			struct pxq_stats stats[5];
+			unsigned char * compressed;
+			size_t compressed_size;
+			enum pxq_status status = pxq_compress_sequence(context, &compressed, &compressed_size,
+						stats, pointers, num_frames, width, height, &params);
+			if (budgets[b] == 2) {
+				_check(status == PXQ_ERROR_BUDGET, "sequences", "impossible budget isn't reported");
+				if (status == PXQ_OK) {
+					free(compressed);
+				}
+				continue;
+			}
+			_check(status == PXQ_OK, "sequences", "compression fails");
+			if (status != PXQ_OK) {
+				continue;
+			}
+			unsigned int total_bits = 0;
+			for (unsigned int k = 0; k < num_frames; k++) {
+				_check(!budgets[b] || stats[k].ram.peak <= budgets[b], "sequences",
+							"frame over the budget");
+				total_bits += stats[k].total_bits;
+			}
+			_check((total_bits + 7) / 8 == compressed_size, "sequences", "size differs");
+
+			unsigned int * decompressed;
+			unsigned int decompressed_frames;
+			unsigned int decompressed_width;
+			unsigned int decompressed_height;
+			status = pxq_decompress_sequence(context, &decompressed, &decompressed_frames,
+						&decompressed_width, &decompressed_height, compressed, compressed_size);
+			free(compressed);
+			_check(status == PXQ_OK, "sequences", "decompression fails");
+			if (status == PXQ_OK) {
+				_check(decompressed_frames == num_frames && decompressed_width == width
+							&& decompressed_height == height
+							&& !memcmp(decompressed, frames, num_frames * size * sizeof(unsigned int)),
+							"sequences", "decompressed frames differ");
+				free(decompressed);
+			}
+		}
+	}
+	pxq_destroy_context(context);
+	free(frames);
+}
+
+/*
+ * Segmentations into blocks of any size up to the limit decode back,
+ * and don't depend on how many threads look for them.
+ */
+static void _test_bwt_blocks(void) {
+	static unsigned int const block_sizes[] = { 1, 100, 1000, 5000, 100000 };
+	unsigned int const width = 160;
+	unsigned int const height = 100;
+	unsigned int * const pixels = malloc(width * height * sizeof(unsigned int));
+	if (!pixels) {
+		_check(0, "BWT blocks", "allocation");
+		return;
+	}
+	_make_words(pixels, width * height, 5);
+
+	for (unsigned int b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++) {
+		unsigned int bits = 0;
+		for (unsigned int threads = 1; threads <= 4; threads += 3) {
+			struct params params;
+			memset(&params, 0, sizeof(params));
+			params.tile_size = 1;
+			params.predictor = PXQ_PREDICTOR_NONE;
+			params.bwt_block_size = block_sizes[b];
+			params.num_threads = threads;
+			struct pxq_stats stats;
+			enum pxq_status const status = _round_trip("BWT blocks", pixels, width, height,
+						&params, &stats);
+			_check(status == PXQ_OK, "BWT blocks", "compression fails");
+			if (status != PXQ_OK) {
+				continue;
+			}
+			_check(stats.bwt_largest_block <= block_sizes[b], "BWT blocks", "block too large");
+			_check(block_sizes[b] < 1000 || stats.bwt_blocks > 0, "BWT blocks",
+						"BWT not picked where it wins");
+			_check(threads == 1 || stats.total_bits == bits, "BWT blocks",
+						"result depends on the threads");
+			bits = stats.total_bits;
+		}
+	}
+	free(pixels);
+}
+
+/*
+ * LZ coded images decode back, with matches at the recent distances
+ * as well as new ones, and windows larger than the distance stream
+ * can code are cut down to what it can, on an image large enough for
+ * matches to reach further.
+ */
+static void _test_lz(void) {
+	static unsigned int const windows[] = { 1, 64, 4096, 1U << 20 };
+	unsigned int const width = 512;
+	unsigned int const height = 512;
+	unsigned int const size = width * height;
+	unsigned int * const pixels = malloc(size * sizeof(unsigned int));
+	if (!pixels) {
+		_check(0, "LZ", "allocation");
+		return;
+	}
+
+	// Chunks that copy from far back, cycling through a few distances,
+	// with a word-like start that also makes short distances repeat
+	unsigned int state = 13;
+	_make_words(pixels, size, 13);
+	for (unsigned int i = 0; i < 200000; i++) {
+		if (_random(&state) % 4 == 0) {
+			pixels[i] = _random(&state) % 16;
+		}
+	}
+	for (unsigned int i = 200000; i < size; i++) {
+		unsigned int const distance = 66000 + (i / 64 % 8) * 16384;
+		pixels[i] = pixels[i - distance];
+	}
+
+	for (unsigned int w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+		struct params params;
+		memset(&params, 0, sizeof(params));
+		params.tile_size = 1;
+		params.predictor = PXQ_PREDICTOR_NONE;
+		params.lz_window = windows[w];
+		struct pxq_stats stats;
+		enum pxq_status const status = _round_trip("LZ", pixels, width, height, &params, &stats);
+		_check(status == PXQ_OK, "LZ", "compression fails");
+		if (status != PXQ_OK) {
+			continue;
+		}
+		_check(stats.lz.window <= windows[w] && stats.lz.window <= PXQ_MAX_SYMBOLS,
+					"LZ", "window too large");
+		_check(windows[w] < 4096 || stats.lz.window, "LZ", "LZ not picked where it wins");
+		_check(windows[w] < 4096 || stats.lz.reps[0] + stats.lz.reps[1]
+					+ stats.lz.reps[2] + stats.lz.reps[3] + stats.lz.short_reps,
+					"LZ", "no rep tokens");
+	}
+	free(pixels);
+}
+
+/*
+ * The server answers jobs from several connections, first with quick
+ * settings and then with the search for jobs that search, keeps its
+ * socket from a second server, and removes it once SIGTERM stops it.
+ */
+static void _test_server(void) {
+	unsigned int const width = 64;
+	unsigned int const height = 48;
+	unsigned int pixels[64 * 48];
+	for (unsigned int i = 0; i < width * height; i++) {
+		pixels[i] = (i % width / 8 + i / width / 6) % 32;
+	}
+	unsigned char * tga;
+	size_t tga_size;
+	if (tga_encode(&tga, &tga_size, pixels, width, height) != PXQ_OK) {
+		_check(0, "server", "TGA encoding fails");
+		return;
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/pxqueeze_test_%d.sock", (int)getpid());
+	pid_t const child = fork();
+	if (child < 0) {
+		_check(0, "server", "fork fails");
+		free(tga);
+		return;
+	}
+	if (child == 0) {
+		_exit(server_run(path, 2) == PXQ_OK ? 0 : 1);
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	// A server that stops answering fails the test rather than hang it
+	struct timeval timeout;
+	memset(&timeout, 0, sizeof(timeout));
+	timeout.tv_sec = 10;
+	int connections[2];
+	for (unsigned int c = 0; c < 2; c++) {
+		connections[c] = socket(AF_UNIX, SOCK_STREAM, 0);
+		setsockopt(connections[c], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		for (unsigned int attempt = 0; attempt < 500; attempt++) {
+			if (!connect(connections[c], (struct sockaddr const *)&address, sizeof(address))) {
+				break;
+			}
+			usleep(10000);
+		}
+	}
+
+	// Searching jobs on both connections at once get two answers each,
+	// the last one from the search, and both decompress to the image
+	unsigned int words[SERVER_REQUEST_WORDS];
+	memset(words, 0, sizeof(words));
+	words[0] = SERVER_JOB_COMPRESS;
+	words[SERVER_REQUEST_WORDS - 1] = (unsigned int)tga_size;
+	for (unsigned int c = 0; c < 2; c++) {
+		_check(_server_request(connections[c], words, tga, tga_size), "server", "request fails");
+	}
+	struct pxq_context * const context = pxq_create_context();
+	for (unsigned int c = 0; c < 2; c++) {
+		for (unsigned int message = 0; message < 2; message++) {
+			unsigned int response[2 + SERVER_STATS_WORDS + 1];
+			unsigned char * data;
+			if (!_server_message(connections[c], response, &data)) {
+				_check(0, "server", "response fails");
+				break;
+			}
+			_check(response[0] == PXQ_OK && response[1] == message, "server", "wrong messages");
+			unsigned int * decompressed;
+			unsigned int decompressed_width;
+			unsigned int decompressed_height;
+			enum pxq_status const status = pxq_decompress(context, &decompressed,
+						&decompressed_width, &decompressed_height,
+						data, response[2 + SERVER_STATS_WORDS]);
+			_check(status == PXQ_OK, "server", "decompression fails");
+			if (status == PXQ_OK) {
+				_check(decompressed_width == width && decompressed_height == height
+							&& !memcmp(decompressed, pixels, sizeof(pixels)),
+							"server", "decompressed image differs");
+				free(decompressed);
+			}
+			free(data);
+		}
+	}
+	pxq_destroy_context(context);
+
+	// Jobs that don't search get one answer, on the same connection
+	words[0] = SERVER_JOB_ESTIMATE;
+	words[1] = 64;
+	words[5] = 1;
+	words[7] = PXQ_PREDICTOR_NONE;
+	unsigned int response[2 + SERVER_STATS_WORDS + 1];
+	unsigned char * data = NULL;
+	_check(_server_request(connections[0], words, tga, tga_size)
+				&& _server_message(connections[0], response, &data)
+				&& response[0] == PXQ_OK && response[1] == 1
+				&& response[2 + SERVER_STATS_WORDS] == 0,
+				"server", "estimate fails");
+	free(data);
+
+	// Jobs that can't be framed get a status, and the connection closes,
+	// possibly before the image is sent
+	words[0] = SERVER_JOB_COUNT;
+	unsigned char closed;
+	_server_request(connections[1], words, tga, tga_size);
+	_check(_server_message(connections[1], response, &data)
+				&& response[0] == PXQ_ERROR_PARAMS && response[1] == 1
+				&& recv(connections[1], &closed, 1, 0) <= 0,
+				"server", "invalid job is accepted");
+	free(data);
+
+	_check(server_run(path, 1) == PXQ_ERROR_IO && !access(path, F_OK),
+				"server", "live socket is replaced");
+	close(connections[0]);
+	close(connections[1]);
+	kill(child, SIGTERM);
+	int exit_status;
+	_check(waitpid(child, &exit_status, 0) == child
+				&& WIFEXITED(exit_status) && WEXITSTATUS(exit_status) == 0,
+				"server", "no clean stop");
+	_check(access(path, F_OK) != 0, "server", "socket left behind");
+	free(tga);
+}
+
+static void _check(
+		int const condition,
+		char const * const test,
+		char const * const what) {
+	if (!condition) {
+		fprintf(stderr, "%s: %s\n", test, what);
+		_failures++;
+	}
+}
+
+static unsigned int _random(unsigned int * const state) {
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static unsigned int _rle_cost(
+		unsigned int const * const data,
+		unsigned int const size,
+		unsigned int const max_run,
+		enum pxq_coder const lengths_coder,
+		enum pxq_coder const values_coder) {
+
+	unsigned int num_values = 0;
+	for (unsigned int i = 0; i < size; i++) {
+		if (data[i] >= num_values) {
+			num_values = data[i] + 1;
+		}
+	}
+	unsigned int * const length_hist = calloc(max_run + 1, sizeof(unsigned int));
+	unsigned int * const value_hist = calloc(num_values + 1, sizeof(unsigned int));
+	unsigned int cost = ~0U;
+	if (length_hist && value_hist) {
+		// Split the runs here rather than with the RLE stage
+		for (unsigned int i = 0; i < size; ) {
+			unsigned int length = 1;
+			while (length < max_run && i + length < size && data[i + length] == data[i]) {
+				length++;
+			}
+			length_hist[length]++;
+			value_hist[data[i]]++;
+			i += length;
+		}
+		struct stream_coder length_coder;
+		struct stream_coder value_coder;
+		unsigned int length_costs[PXQ_CODER_COUNT];
+		unsigned int value_costs[PXQ_CODER_COUNT];
+		if (coder_choose(&length_coder, length_costs, length_hist, max_run + 1,
+					lengths_coder) == PXQ_OK
+					&& coder_choose(&value_coder, value_costs, value_hist, num_values,
+					values_coder) == PXQ_OK) {
+			cost = length_costs[length_coder.coder] + value_costs[value_coder.coder];
+		}
+		coder_free(&length_coder);
+		coder_free(&value_coder);
+	}
+	free(length_hist);
+	free(value_hist);
+	return cost;
+}
+
+static void _make_screen(
+		unsigned int * const pixels,
+		unsigned int const width,
+		unsigned int const height,
+		unsigned int const seed) {
+
+	static unsigned char const sprites[2][8] = {
+		{ 0x18, 0x3C, 0x7E, 0xDB, 0xFF, 0x24, 0x5A, 0xA5 },
+		{ 0xF0, 0x88, 0x84, 0x82, 0xFE, 0x80, 0x80, 0xC0 },
+	};
+	unsigned int state = seed;
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			pixels[y * width + x] = y / 12 % 4;
+		}
+	}
+	for (unsigned int ty = 0; ty + 8 <= height; ty += 8) {
+		for (unsigned int tx = 0; tx + 8 <= width; tx += 8) {
+			unsigned int const pick = _random(&state) % 8;
+			if (pick >= 4) {
+				continue;
+			}
+			unsigned int const flips = _random(&state) % 4;
+			for (unsigned int y = 0; y < 8; y++) {
+				for (unsigned int x = 0; x < 8; x++) {
+					unsigned int const sy = flips & 2 ? 7 - y : y;
+					unsigned int const sx = flips & 1 ? 7 - x : x;
+					if (sprites[pick & 1][sy] & (0x80 >> sx)) {
+						pixels[(ty + y) * width + tx + x] = 4 + pick;
+					}
+				}
+			}
+		}
+	}
+	for (unsigned int i = 0; i < width * height / 64; i++) {
+		pixels[_random(&state) % (width * height)] = 8 + _random(&state) % 8;
+	}
+}
+
+static enum pxq_status _round_trip(
+		char const * const test,
+		unsigned int const * const pixels,
+		unsigned int const width,
+		unsigned int const height,
+		struct params const * const params,
+		struct pxq_stats * const outStats) {
+
+	struct pxq_context * const context = pxq_create_context();
+	if (!context) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	unsigned char * compressed;
+	size_t compressed_size;
+	enum pxq_status status = pxq_compress(context, &compressed, &compressed_size, outStats,
+				pixels, width, height, params);
+	if (status == PXQ_OK) {
+		unsigned int * decompressed;
+		unsigned int decompressed_width;
+		unsigned int decompressed_height;
+		enum pxq_status const decoded = pxq_decompress(context, &decompressed,
+					&decompressed_width, &decompressed_height, compressed, compressed_size);
+		_check(decoded == PXQ_OK, test, "decompression fails");
+		if (decoded == PXQ_OK) {
+			_check(decompressed_width == width && decompressed_height == height
+						&& !memcmp(decompressed, pixels, width * height * sizeof(unsigned int)),
+						test, "decompressed image differs");
+			free(decompressed);
+		}
+		free(compressed);
+	}
+	pxq_destroy_context(context);
+	return status;
+}
+
+static void _make_words(
+		unsigned int * const pixels,
+		unsigned int const size,
+		unsigned int const seed) {
+	unsigned int words[6][5];
+	unsigned int state = seed;
+	for (unsigned int w = 0; w < 6; w++) {
+		for (unsigned int k = 0; k < 5; k++) {
+			words[w][k] = _random(&state) % 16;
+		}
+	}
+	for (unsigned int i = 0; i < size; ) {
+		unsigned int const w = _random(&state) % 6;
+		for (unsigned int k = 0; k < 5 && i < size; k++) {
+			pixels[i++] = words[w][k];
+		}
+	}
+}
+
+static int _server_request(
+		int const connection,
+		unsigned int const * const words,
+		unsigned char const * const tga,
+		size_t const tga_size) {
+
+	unsigned char header[SERVER_REQUEST_WORDS * 4];
+	for (unsigned int w = 0; w < SERVER_REQUEST_WORDS; w++) {
+		for (unsigned int b = 0; b < 4; b++) {
+			header[w * 4 + b] = (words[w] >> (b * 8)) & 0xFF;
+		}
+	}
+	return send(connection, header, sizeof(header), MSG_NOSIGNAL) == (ssize_t)sizeof(header)
+				&& send(connection, tga, tga_size, MSG_NOSIGNAL) == (ssize_t)tga_size;
+}
+
+static int _server_message(
+		int const connection,
+		unsigned int * const outWords,
+		unsigned char * * const outData) {
+
+	*outData = NULL;
+	unsigned char message[(2 + SERVER_STATS_WORDS + 1) * 4];
+	size_t size = 8;
+	for (size_t done = 0; done < size; ) {
+		ssize_t const received = recv(connection, message + done, size - done, 0);
+		if (received <= 0) {
+			return 0;
+		}
+		done += (size_t)received;
+		if (done == 8 && message[0] == PXQ_OK && !message[1] && !message[2] && !message[3]) {
+			size = sizeof(message);
+		}
+	}
+	for (unsigned int w = 0; w < size / 4; w++) {
+		outWords[w] = message[w * 4] | (message[w * 4 + 1] << 8)
+					| (message[w * 4 + 2] << 16) | ((unsigned int)message[w * 4 + 3] << 24);
+	}
+	if (size == 8) {
+		return 1;
+	}
+
+	size_t const data_size = outWords[2 + SERVER_STATS_WORDS];
+	*outData = malloc(data_size ? data_size : 1);
+	if (!*outData) {
+		return 0;
+	}
+	for (size_t done = 0; done < data_size; ) {
+		ssize_t const received = recv(connection, *outData + done, data_size - done, 0);
+		if (received <= 0) {
+			free(*outData);
+			*outData = NULL;
+			return 0;
+		}
+		done += (size_t)received;
+	}
+	return 1;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+
+# Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+# SPDX-License-Identifier: AGPL-3.0-or-later
+
+mkdir -p out/bin
+
+rm -f out/bin/pxqueeze_test
+cc -O3 test.c pxqueeze.c bits.c bwt.c coder.c histogram.c huffman.c lz.c model.c mtf.c predict.c rle.c server.c tga.c tile.c universal.c -o out/bin/pxqueeze_test -lm -pthread
+out/bin/pxqueeze_test
@@ -22,17 +22,154 @@
 
 #include "tga.h"
 
-unsigned int* tga_read() {
-	unsigned char* tga = malloc(192044);
-	FILE* inputfile = fopen("out/gfx/jbq.tga", "rb");
-	fread(tga, 1, 192044, inputfile);
+enum pxq_status tga_decode(
+		unsigned int ** const outPixelsP,
+		unsigned int * const outWidth,
+		unsigned int * const outHeight,
+		unsigned char const * const inData,
+		size_t const inSize) {
+
+	if (inSize < 18) {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	unsigned int const id_length = inData[0];
+	unsigned int const colormap_type = inData[1];
+	unsigned int const image_type = inData[2];
+	unsigned int const colormap_length = inData[5] | (inData[6] << 8);
+	unsigned int const colormap_depth = inData[7];
+	unsigned int const width = inData[12] | (inData[13] << 8);
+	unsigned int const height = inData[14] | (inData[15] << 8);
+	unsigned int const depth = inData[16];
+
+	// Uncompressed true-color (2) or grayscale (3) only
+	unsigned int bytes_per_pixel;
+	if (image_type == 2 && (depth == 24 || depth == 32)) {
+		bytes_per_pixel = depth / 8;
+	} else if (image_type == 3 && depth == 8) {
+		bytes_per_pixel = 1;
+	} else {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	size_t const offset = 18 + id_length
+				+ (colormap_type ? colormap_length * ((colormap_depth + 7) / 8) : 0);
+	size_t const count = (size_t)width * height;
+	if (count == 0 || offset + count * bytes_per_pixel > inSize) {
+		return PXQ_ERROR_FORMAT;
+	}
+
+	unsigned int* pixels = malloc(count * sizeof(unsigned int));
+	if (!pixels) {
+		return PXQ_ERROR_MEMORY;
+	}
+
+	unsigned char const * const tga = inData + offset;
+	for (size_t i = 0; i < count; i++) {
+		if (bytes_per_pixel == 1) {
+			pixels[i] = tga[i] / 8;
+		} else {
+			unsigned char const * const p = tga + bytes_per_pixel * i;
+			pixels[i] = (5 * p[2] + 9 * p[1] + 2 * p[0]) / 512;
+		}
+	}
+
+	*outPixelsP = pixels;
+	*outWidth = width;
+	*outHeight = height;
+	return PXQ_OK;
+}
+
+enum pxq_status tga_read(
+		unsigned int ** const outPixelsP,
+		unsigned int * const outWidth,
+		unsigned int * const outHeight,
+		char const * const inPath) {
+
+	FILE* inputfile = fopen(inPath, "rb");
+	if (!inputfile) {
+		return PXQ_ERROR_IO;
+	}
+
+	fseek(inputfile, 0, SEEK_END);
+	long const size = ftell(inputfile);
+	fseek(inputfile, 0, SEEK_SET);
+	if (size < 0) {
+		fclose(inputfile);
+		return PXQ_ERROR_IO;
+	}
+
+	unsigned char* tga = malloc(size + 1);
+	if (!tga) {
+		fclose(inputfile);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	size_t const read = fread(tga, 1, size, inputfile);
 	fclose(inputfile);
+	if (read != (size_t)size) {
+		free(tga);
+		return PXQ_ERROR_IO;
+	}
 
-	unsigned int* pixels = malloc(64000 * sizeof(unsigned int));
+	enum pxq_status status = tga_decode(outPixelsP, outWidth, outHeight, tga, size);
+	free(tga);
+	return status;
+}
 
-	for (int i = 0; i < 64000; i++) {
-		pixels[i] = (5 * tga[18 + 3 * i + 2] + 9 * tga[18 + 3 * i + 1] + 2 * tga[18 + 3 * i]) / 512;
+enum pxq_status tga_encode(
+		unsigned char ** const outDataP,
+		size_t * const outSizeP,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight) {
+
+	if (inWidth == 0 || inWidth > 65535 || inHeight == 0 || inHeight > 65535) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	size_t const count = (size_t)inWidth * inHeight;
+	unsigned char * tga = calloc(18 + count, 1);
+	if (!tga) {
+		return PXQ_ERROR_MEMORY;
 	}
 
-	return pixels;
+	// Uncompressed grayscale, 8 bits per pixel, no ID and no colormap
+	tga[2] = 3;
+	tga[12] = inWidth & 0xFF;
+	tga[13] = inWidth >> 8;
+	tga[14] = inHeight & 0xFF;
+	tga[15] = inHeight >> 8;
+	tga[16] = 8;
+	for (size_t i = 0; i < count; i++) {
+		tga[18 + i] = inPixels[i] < 32 ? inPixels[i] * 255 / 31 : 255;
+	}
+
+	*outDataP = tga;
+	*outSizeP = 18 + count;
+	return PXQ_OK;
+}
+
+enum pxq_status tga_write(
+		char const * const inPath,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight) {
+
+	unsigned char * tga;
+	size_t size;
+	enum pxq_status status = tga_encode(&tga, &size, inPixels, inWidth, inHeight);
+	if (status != PXQ_OK) {
+		return status;
+	}
+
+	FILE* outputfile = fopen(inPath, "wb");
+	if (!outputfile || fwrite(tga, 1, size, outputfile) != size) {
+		status = PXQ_ERROR_IO;
+	}
+	if (outputfile && fclose(outputfile)) {
+		status = PXQ_ERROR_IO;
+	}
+	free(tga);
+	return status;
 }
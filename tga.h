@@ -20,6 +20,51 @@
 #ifndef __TGA_H__
 #define __TGA_H__
 
-unsigned int* tga_read();
+#include <stddef.h>
+
+#include "pxqueeze.h"
+
+/*
+ * Converts an uncompressed true-color or grayscale TGA image held in
+ * memory into 32 gray levels, one symbol per pixel, in storage order.
+ */
+enum pxq_status tga_decode(
+	unsigned int ** const outPixelsP,
+	unsigned int * const outWidth,
+	unsigned int * const outHeight,
+	unsigned char const * const inData,
+	size_t const inSize);
+
+/*
+ * Same as tga_decode, from a file.
+ */
+enum pxq_status tga_read(
+	unsigned int ** const outPixelsP,
+	unsigned int * const outWidth,
+	unsigned int * const outHeight,
+	char const * const inPath);
+
+/*
+ * Converts symbols back into an uncompressed 8-bit grayscale TGA image,
+ * into a buffer allocated with malloc, which the caller frees. Symbols
+ * are the 32 gray levels that tga_decode produces, higher ones are
+ * saturated to white. The image is written in storage order, such that
+ * tga_decode returns the same symbols.
+ */
+enum pxq_status tga_encode(
+	unsigned char ** const outDataP,
+	size_t * const outSizeP,
+	unsigned int const * const inPixels,
+	unsigned int const inWidth,
+	unsigned int const inHeight);
+
+/*
+ * Same as tga_encode, to a file.
+ */
+enum pxq_status tga_write(
+	char const * const inPath,
+	unsigned int const * const inPixels,
+	unsigned int const inWidth,
+	unsigned int const inHeight);
 
 #endif
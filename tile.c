@@ -0,0 +1,245 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile.h"
+
+/*
+* Helper function: symbol at (x, y) of a tile drawn with flips
+*/
+static inline unsigned int _tile_symbol(
+		unsigned int const * const tile,
+		unsigned int const tile_size,
+		unsigned int const flip,
+		unsigned int const x,
+		unsigned int const y) {
+	unsigned int const sx = (flip & 1) ? tile_size - 1 - x : x;
+	unsigned int const sy = (flip & 2) ? tile_size - 1 - y : y;
+	return tile[sy * tile_size + sx];
+}
+
+/*
+* Helper function: hash of a tile of the image, read with flips
+*/
+static unsigned int _hash_tile(
+		unsigned int const * const tile,
+		unsigned int const pitch,
+		unsigned int const tile_size,
+		unsigned int const flip);
+
+/*
+* Helper function: whether a unique tile matches a tile of the image
+* read with flips
+*/
+static int _same_tile(
+		unsigned int const * const unique,
+		unsigned int const * const tile,
+		unsigned int const pitch,
+		unsigned int const tile_size,
+		unsigned int const flip);
+
+enum pxq_status tile_build_index(
+		struct tile_index * const index,
+		unsigned int const * const inPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inTileSize,
+		int const inFlips) {
+
+	memset(index, 0, sizeof(struct tile_index));
+
+	if (inTileSize == 0 || inWidth % inTileSize || inHeight % inTileSize) {
+		return PXQ_ERROR_PARAMS;
+	}
+
+	unsigned int const tiles_x = inWidth / inTileSize;
+	unsigned int const tiles_y = inHeight / inTileSize;
+	unsigned int const num_tiles = tiles_x * tiles_y;
+	unsigned int const tile_area = inTileSize * inTileSize;
+
+	// Open addressing, at most half full. Slots hold unique tile
+	// numbers plus one, zero marks an empty slot.
+	unsigned int table_size = 1;
+	while (table_size < 2 * num_tiles) {
+		table_size <<= 1;
+	}
+
+	unsigned int * slots = calloc(table_size, sizeof(unsigned int));
+	unsigned int * hashes = malloc(num_tiles * sizeof(unsigned int));
+	unsigned int * origins = malloc(num_tiles * sizeof(unsigned int));
+	index->map = malloc(num_tiles * sizeof(unsigned int));
+	if (!slots || !hashes || !origins || !index->map) {
+		free(slots);
+		free(hashes);
+		free(origins);
+		tile_free_index(index);
+		return PXQ_ERROR_MEMORY;
+	}
+
+	// Unique tiles are first recorded by their position in the image,
+	// and only copied out once they're all known.
+	unsigned int num_unique = 0;
+	unsigned int const num_flips = inFlips ? 1U << TILE_FLIP_BITS : 1;
+	for (unsigned int t = 0; t < num_tiles; t++) {
+		unsigned int const * const tile = inPixels
+					+ (t / tiles_x) * inTileSize * inWidth
+					+ (t % tiles_x) * inTileSize;
+		unsigned int found = 0;
+		unsigned int found_flip = 0;
+		unsigned int identity_hash = 0;
+		for (unsigned int flip = 0; flip < num_flips && !found; flip++) {
+			unsigned int const hash = _hash_tile(tile, inWidth, inTileSize, flip);
+			if (flip == 0) {
+				identity_hash = hash;
+			}
+			for (unsigned int slot = hash & (table_size - 1);
+						slots[slot];
+						slot = (slot + 1) & (table_size - 1)) {
+				unsigned int const u = slots[slot] - 1;
+				if (hashes[u] == hash) {
+					unsigned int const * const unique = inPixels
+								+ (origins[u] / tiles_x) * inTileSize * inWidth
+								+ (origins[u] % tiles_x) * inTileSize;
+					if (_same_tile(unique, tile, inWidth, inTileSize, flip)) {
+						found = slots[slot];
+						found_flip = flip;
+						break;
+					}
+				}
+			}
+		}
+
+		if (!found) {
+			unsigned int slot = identity_hash & (table_size - 1);
+			while (slots[slot]) {
+				slot = (slot + 1) & (table_size - 1);
+			}
+			hashes[num_unique] = identity_hash;
+			origins[num_unique] = t;
+			slots[slot] = ++num_unique;
+			found = num_unique;
+		}
+
+		index->map[t] = inFlips ? ((found - 1) << TILE_FLIP_BITS) | found_flip : found - 1;
+	}
+
+	free(slots);
+	free(hashes);
+
+	index->unique = malloc((num_unique * tile_area + 1) * sizeof(unsigned int));
+	if (!index->unique) {
+		free(origins);
+		tile_free_index(index);
+		return PXQ_ERROR_MEMORY;
+	}
+	for (unsigned int u = 0; u < num_unique; u++) {
+		unsigned int const * const tile = inPixels
+					+ (origins[u] / tiles_x) * inTileSize * inWidth
+					+ (origins[u] % tiles_x) * inTileSize;
+		for (unsigned int y = 0; y < inTileSize; y++) {
+			memcpy(index->unique + u * tile_area + y * inTileSize,
+						tile + y * inWidth,
+						inTileSize * sizeof(unsigned int));
+		}
+	}
+	free(origins);
+
+	index->tile_size = inTileSize;
+	index->flips = inFlips;
+	index->tiles_x = tiles_x;
+	index->tiles_y = tiles_y;
+	index->num_unique = num_unique;
+	return PXQ_OK;
+}
+
+void tile_free_index(struct tile_index * const index) {
+	free(index->unique);
+	free(index->map);
+	memset(index, 0, sizeof(struct tile_index));
+}
+
+enum pxq_status tile_expand(
+		unsigned int * const outPixels,
+		unsigned int const inWidth,
+		unsigned int const inHeight,
+		unsigned int const inTileSize,
+		int const inFlips,
+		unsigned int const * const inUnique,
+		unsigned int const inNumUnique,
+		unsigned int const * const inMap) {
+
+	unsigned int const tiles_x = inWidth / inTileSize;
+	unsigned int const tiles_y = inHeight / inTileSize;
+	unsigned int const tile_area = inTileSize * inTileSize;
+
+	for (unsigned int t = 0; t < tiles_x * tiles_y; t++) {
+		unsigned int const u = inFlips ? inMap[t] >> TILE_FLIP_BITS : inMap[t];
+		unsigned int const flip = inFlips ? inMap[t] & ((1U << TILE_FLIP_BITS) - 1) : 0;
+		if (u >= inNumUnique) {
+			return PXQ_ERROR_FORMAT;
+		}
+		unsigned int * const tile = outPixels
+					+ (t / tiles_x) * inTileSize * inWidth
+					+ (t % tiles_x) * inTileSize;
+		for (unsigned int y = 0; y < inTileSize; y++) {
+			for (unsigned int x = 0; x < inTileSize; x++) {
+				tile[y * inWidth + x] = _tile_symbol(inUnique + u * tile_area,
+							inTileSize, flip, x, y);
+			}
+		}
+	}
+	return PXQ_OK;
+}
+
+static unsigned int _hash_tile(
+		unsigned int const * const tile,
+		unsigned int const pitch,
+		unsigned int const tile_size,
+		unsigned int const flip) {
+	// FNV-1a over the symbols, in the order a flipped tile reads them
+	unsigned int hash = 2166136261U;
+	for (unsigned int y = 0; y < tile_size; y++) {
+		unsigned int const sy = (flip & 2) ? tile_size - 1 - y : y;
+		for (unsigned int x = 0; x < tile_size; x++) {
+			unsigned int const sx = (flip & 1) ? tile_size - 1 - x : x;
+			hash = (hash ^ tile[sy * pitch + sx]) * 16777619U;
+		}
+	}
+	return hash;
+}
+
+static int _same_tile(
+		unsigned int const * const unique,
+		unsigned int const * const tile,
+		unsigned int const pitch,
+		unsigned int const tile_size,
+		unsigned int const flip) {
+	for (unsigned int y = 0; y < tile_size; y++) {
+		unsigned int const sy = (flip & 2) ? tile_size - 1 - y : y;
+		for (unsigned int x = 0; x < tile_size; x++) {
+			unsigned int const sx = (flip & 1) ? tile_size - 1 - x : x;
+			if (unique[y * pitch + x] != tile[sy * pitch + sx]) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
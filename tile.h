@@ -0,0 +1,75 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __TILE_H__
+#define __TILE_H__
+
+#include "pxqueeze.h"
+
+/*
+ * Flips applied to a tile when it's drawn: bit 0 mirrors horizontally,
+ * bit 1 flips vertically.
+ */
+#define TILE_FLIP_BITS 2
+
+/*
+ * An image cut into square tiles, each of which is a reference to one
+ * of the unique tiles. With flips enabled, map entries hold the index
+ * of the unique tile shifted left by TILE_FLIP_BITS, plus the flips.
+ */
+struct tile_index {
+	unsigned int tile_size;
+	int flips;
+	unsigned int tiles_x;
+	unsigned int tiles_y;
+	unsigned int num_unique;
+	unsigned int * unique;
+	unsigned int * map;
+};
+
+/*
+ * Builds the index in linear time, with a hash table of the unique
+ * tiles. Unique tiles are numbered in order of first appearance, and
+ * stored one after the other, each in row order. The image dimensions
+ * must be multiples of the tile size.
+ */
+enum pxq_status tile_build_index(
+	struct tile_index * const index,
+	unsigned int const * const inPixels,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	unsigned int const inTileSize,
+	int const inFlips);
+
+void tile_free_index(struct tile_index * const index);
+
+/*
+ * Draws the tiles of a map into an image.
+ */
+enum pxq_status tile_expand(
+	unsigned int * const outPixels,
+	unsigned int const inWidth,
+	unsigned int const inHeight,
+	unsigned int const inTileSize,
+	int const inFlips,
+	unsigned int const * const inUnique,
+	unsigned int const inNumUnique,
+	unsigned int const * const inMap);
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <math.h>
+
+#include "universal.h"
+
+/*
+ * Largest Exp-Golomb order tried
+ */
+#define UNIVERSAL_MAX_ORDER 16
+
+/*
+* Helper function: position of the highest bit set, plus one
+*/
+static unsigned int _width(unsigned int const value);
+
+/*
+* Helper function: payload of a histogram for a given code and parameter
+*/
+static unsigned int _histogram_bits(
+		enum pxq_coder const coder,
+		unsigned int const param,
+		unsigned int const offset,
+		unsigned int const * const values,
+		unsigned int const * const frequencies,
+		unsigned int const count);
+
+unsigned int universal_bits(
+		enum pxq_coder const coder,
+		unsigned int const param,
+		unsigned int const value) {
+	switch (coder) {
+		case PXQ_CODER_GAMMA:
+			// N - 1 zeroes, then value + 1 in N bits
+			return 2 * _width(value + 1) - 1;
+		case PXQ_CODER_DELTA: {
+			// Width in gamma, then value + 1 without its leading one
+			unsigned int const width = _width(value + 1);
+			return 2 * _width(width) - 1 + width - 1;
+		}
+		case PXQ_CODER_EXP_GOLOMB:
+			// Gamma code of value + 2^k, minus k of its leading zeroes
+			return 2 * _width(value + (1U << param)) - 1 - param;
+		case PXQ_CODER_GOLOMB: {
+			// Quotient in unary, remainder in truncated binary
+			unsigned int const b = _width(param - 1);
+			unsigned int const cutoff = (1U << b) - param;
+			return value / param + 1 + b - ((value % param) < cutoff ? 1 : 0);
+		}
+		default:
+			return 0;
+	}
+}
+
+unsigned int universal_best_param(
+		unsigned int * const outBits,
+		enum pxq_coder const coder,
+		unsigned int const offset,
+		unsigned int const * const values,
+		unsigned int const * const frequencies,
+		unsigned int const count) {
+
+	unsigned int best_param = coder == PXQ_CODER_GOLOMB ? 1 : 0;
+	unsigned int best_bits = _histogram_bits(coder, best_param, offset, values, frequencies, count);
+
+	if (coder == PXQ_CODER_EXP_GOLOMB) {
+		for (unsigned int k = 1; k <= UNIVERSAL_MAX_ORDER; k++) {
+			unsigned int const bits = _histogram_bits(coder, k, offset, values, frequencies, count);
+			if (bits < best_bits) {
+				best_bits = bits;
+				best_param = k;
+			}
+		}
+	} else if (coder == PXQ_CODER_GOLOMB) {
+		// For a geometric distribution with mean mu, the best divisor is
+		// ceil(log(1 + theta) / -log(theta)) with theta = mu / (1 + mu)
+		// (Gallager and Van Voorhis). Real histograms aren't quite
+		// geometric, so check the neighbors too.
+		double total = 0;
+		double sum = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			total += frequencies[i];
+			sum += (double)frequencies[i] * (values[i] - offset);
+		}
+		unsigned int m = 1;
+		if (total > 0 && sum > 0) {
+			double const mu = sum / total;
+			double const theta = mu / (1 + mu);
+			double const estimate = ceil(log(1 + theta) / -log(theta));
+			m = estimate < 1 ? 1 : (estimate > 65536 ? 65536 : (unsigned int)estimate);
+		}
+		for (unsigned int candidate = m > 1 ? m - 1 : 1; candidate <= m + 1; candidate++) {
+			unsigned int const bits = _histogram_bits(coder, candidate, offset, values, frequencies, count);
+			if (bits < best_bits) {
+				best_bits = bits;
+				best_param = candidate;
+			}
+		}
+	}
+
+	*outBits = best_bits;
+	return best_param;
+}
+
+unsigned int universal_param_bits(
+		enum pxq_coder const coder,
+		unsigned int const param) {
+	switch (coder) {
+		case PXQ_CODER_EXP_GOLOMB:
+			return 5;
+		case PXQ_CODER_GOLOMB:
+			return universal_bits(PXQ_CODER_GAMMA, 0, param - 1);
+		default:
+			return 0;
+	}
+}
+
+void universal_write(
+		struct bit_writer * const writer,
+		enum pxq_coder const coder,
+		unsigned int const param,
+		unsigned int const value) {
+	switch (coder) {
+		case PXQ_CODER_GAMMA: {
+			unsigned int const width = _width(value + 1);
+			bits_write(writer, 0, width - 1);
+			bits_write(writer, value + 1, width);
+			break;
+		}
+		case PXQ_CODER_DELTA: {
+			unsigned int const width = _width(value + 1);
+			universal_write(writer, PXQ_CODER_GAMMA, 0, width - 1);
+			bits_write(writer, value + 1, width - 1);
+			break;
+		}
+		case PXQ_CODER_EXP_GOLOMB: {
+			unsigned int const width = _width(value + (1U << param));
+			bits_write(writer, 0, width - 1 - param);
+			bits_write(writer, value + (1U << param), width);
+			break;
+		}
+		case PXQ_CODER_GOLOMB: {
+			for (unsigned int q = value / param; q > 0; q--) {
+				bits_write(writer, 1, 1);
+			}
+			bits_write(writer, 0, 1);
+			unsigned int const b = _width(param - 1);
+			unsigned int const cutoff = (1U << b) - param;
+			unsigned int const r = value % param;
+			if (r < cutoff) {
+				bits_write(writer, r, b - 1);
+			} else {
+				bits_write(writer, r + cutoff, b);
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+unsigned int universal_read(
+		struct bit_reader * const reader,
+		enum pxq_coder const coder,
+		unsigned int const param) {
+	switch (coder) {
+		case PXQ_CODER_GAMMA: {
+			unsigned int zeroes = 0;
+			while (!bits_read(reader, 1)) {
+				if (reader->overrun || ++zeroes >= 32) {
+					reader->overrun = 1;
+					return 0;
+				}
+			}
+			return ((1U << zeroes) | bits_read(reader, zeroes)) - 1;
+		}
+		case PXQ_CODER_DELTA: {
+			unsigned int const bits = universal_read(reader, PXQ_CODER_GAMMA, 0);
+			if (bits >= 32) {
+				reader->overrun = 1;
+				return 0;
+			}
+			return ((1U << bits) | bits_read(reader, bits)) - 1;
+		}
+		case PXQ_CODER_EXP_GOLOMB: {
+			unsigned int zeroes = 0;
+			while (!bits_read(reader, 1)) {
+				if (reader->overrun || ++zeroes + param >= 32) {
+					reader->overrun = 1;
+					return 0;
+				}
+			}
+			return ((1U << (zeroes + param)) | bits_read(reader, zeroes + param))
+						- (1U << param);
+		}
+		case PXQ_CODER_GOLOMB: {
+			unsigned int q = 0;
+			while (bits_read(reader, 1)) {
+				if (reader->overrun || ++q > PXQ_MAX_SYMBOLS) {
+					reader->overrun = 1;
+					return 0;
+				}
+			}
+			unsigned int const b = _width(param - 1);
+			if (b == 0) {
+				return q;
+			}
+			unsigned int const cutoff = (1U << b) - param;
+			unsigned int r = bits_read(reader, b - 1);
+			if (r >= cutoff) {
+				r = ((r << 1) | bits_read(reader, 1)) - cutoff;
+			}
+			return q * param + r;
+		}
+		default:
+			reader->overrun = 1;
+			return 0;
+	}
+}
+
+void universal_write_param(
+		struct bit_writer * const writer,
+		enum pxq_coder const coder,
+		unsigned int const param) {
+	switch (coder) {
+		case PXQ_CODER_EXP_GOLOMB:
+			bits_write(writer, param, 5);
+			break;
+		case PXQ_CODER_GOLOMB:
+			universal_write(writer, PXQ_CODER_GAMMA, 0, param - 1);
+			break;
+		default:
+			break;
+	}
+}
+
+unsigned int universal_read_param(
+		struct bit_reader * const reader,
+		enum pxq_coder const coder) {
+	switch (coder) {
+		case PXQ_CODER_EXP_GOLOMB: {
+			unsigned int const k = bits_read(reader, 5);
+			if (k > UNIVERSAL_MAX_ORDER) {
+				reader->overrun = 1;
+			}
+			return k;
+		}
+		case PXQ_CODER_GOLOMB: {
+			unsigned int const m = universal_read(reader, PXQ_CODER_GAMMA, 0) + 1;
+			if (m > 65536) {
+				reader->overrun = 1;
+				return 1;
+			}
+			return m;
+		}
+		default:
+			return 0;
+	}
+}
+
+static unsigned int _width(unsigned int const value) {
+	return value ? 32 - __builtin_clz(value) : 0;
+}
+
+static unsigned int _histogram_bits(
+		enum pxq_coder const coder,
+		unsigned int const param,
+		unsigned int const offset,
+		unsigned int const * const values,
+		unsigned int const * const frequencies,
+		unsigned int const count) {
+	// Small divisors can make long unary codes, don't let them wrap
+	unsigned long long bits = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		bits += (unsigned long long)frequencies[i]
+					* universal_bits(coder, param, values[i] - offset);
+	}
+	return bits > ~0U ? ~0U : (unsigned int)bits;
+}
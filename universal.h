@@ -0,0 +1,83 @@
+/*
+ * Copyright 2024 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef __UNIVERSAL_H__
+#define __UNIVERSAL_H__
+
+#include "bits.h"
+#include "pxqueeze.h"
+
+/*
+ * Table-free codes for values from 0 up, where small values are the
+ * most frequent. Gamma and delta codes take no parameter, Exp-Golomb
+ * takes its order k, Golomb takes its divisor m.
+ */
+
+/*
+ * Size of the code for one value.
+ */
+unsigned int universal_bits(
+		enum pxq_coder const coder,
+		unsigned int const param,
+		unsigned int const value);
+
+/*
+ * Picks the parameter that minimizes the payload for a histogram of
+ * values (each given with its frequency, and coded minus offset), and
+ * returns the payload size in outBits.
+ */
+unsigned int universal_best_param(
+		unsigned int * const outBits,
+		enum pxq_coder const coder,
+		unsigned int const offset,
+		unsigned int const * const values,
+		unsigned int const * const frequencies,
+		unsigned int const count);
+
+/*
+ * Size of the parameter in a stream header.
+ */
+unsigned int universal_param_bits(
+		enum pxq_coder const coder,
+		unsigned int const param);
+
+void universal_write(
+		struct bit_writer * const writer,
+		enum pxq_coder const coder,
+		unsigned int const param,
+		unsigned int const value);
+
+/*
+ * Malformed data sets the reader's overrun flag.
+ */
+unsigned int universal_read(
+		struct bit_reader * const reader,
+		enum pxq_coder const coder,
+		unsigned int const param);
+
+void universal_write_param(
+		struct bit_writer * const writer,
+		enum pxq_coder const coder,
+		unsigned int const param);
+
+unsigned int universal_read_param(
+		struct bit_reader * const reader,
+		enum pxq_coder const coder);
+
+#endif